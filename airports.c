@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+#include "airports.h"
+
+// smallest number of slots allocated for a table
+#define TABLE_MIN_CAPACITY 16
+
+/** Hashes an airport id (64 bit FNV-1a).
+ *
+ * @param id Airport id, need not be null terminated
+ * @param length Number of characters in id
+ * @return Hash of id
+ */
+uint64_t hash_id(const char* id, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char) id[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/** Initializes an empty airport table.
+ *
+ * @param table Table to initialize
+ */
+void init_airport_table(AirportTable* table) {
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+/** Places airport in the first free slot of its probe sequence.
+ *
+ * @param slots Slot array with at least one free slot
+ * @param capacity Number of slots, a power of two
+ * @param airport Airport to place
+ */
+void place_airport(Airport** slots, size_t capacity, Airport* airport) {
+    size_t mask = capacity - 1;
+    size_t index = (size_t) airport->hash & mask;
+    while (slots[index] != NULL) {
+        index = (index + 1) & mask;
+    }
+    slots[index] = airport;
+}
+
+/** Moves table's airports into a new slot array of the given size.
+ *
+ * @param table Table to resize
+ * @param capacity New number of slots, a power of two with room for more
+ *        than the table's airports
+ */
+void resize_airport_table(AirportTable* table, size_t capacity) {
+    Airport** slots = calloc(capacity, sizeof(Airport*));
+
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (table->slots[i] != NULL) {
+            place_airport(slots, capacity, table->slots[i]);
+        }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+}
+
+/** Doubles the number of slots in table and rehashes its airports.
+ *
+ * @param table Table to grow
+ */
+void grow_airport_table(AirportTable* table) {
+    resize_airport_table(table, table->capacity == 0 ? TABLE_MIN_CAPACITY :
+            table->capacity * 2);
+}
+
+/** Makes room in table for count airports in total, so that inserting
+ * them rehashes nothing.
+ *
+ * @param table Table to grow
+ * @param count Number of airports the table should hold
+ */
+void airport_table_reserve(AirportTable* table, size_t count) {
+    size_t capacity = table->capacity == 0 ? TABLE_MIN_CAPACITY :
+            table->capacity;
+    while (count * 2 > capacity) {
+        capacity *= 2;
+    }
+    if (capacity != table->capacity) {
+        resize_airport_table(table, capacity);
+    }
+}
+
+/** Finds the airport with the given id.
+ *
+ * @param table Table to search
+ * @param id Airport id, need not be null terminated but must not hold '\0'
+ *        within its length
+ * @param length Number of characters in id
+ * @param hash Hash of id as given by hash_id
+ * @return Airport known by id, or NULL if there is none
+ */
+Airport* airport_table_find(const AirportTable* table, const char* id,
+        size_t length, uint64_t hash) {
+    if (table->count == 0) {
+        return NULL;
+    }
+    size_t mask = table->capacity - 1;
+    size_t index = (size_t) hash & mask;
+
+    // table is never full, so the probe always reaches an empty slot
+    while (table->slots[index] != NULL) {
+        Airport* airport = table->slots[index];
+        if (airport->hash == hash && strncmp(airport->id, id, length) == 0
+                && airport->id[length] == '\0') {
+            return airport;
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+/** Inserts an airport into table. The airport's id must not already be
+ * present and its hash must already be set.
+ *
+ * @param table Table to insert into
+ * @param airport Airport to insert
+ */
+void airport_table_insert(AirportTable* table, Airport* airport) {
+    // keep load factor at or below one half
+    if ((table->count + 1) * 2 > table->capacity) {
+        grow_airport_table(table);
+    }
+    place_airport(table->slots, table->capacity, airport);
+    table->count++;
+}
+
+/** Initializes an empty airport list.
+ *
+ * @param list List to initialize
+ */
+void init_airport_list(AirportList* list) {
+    list->head = calloc(1, sizeof(AirportNode) +
+            sizeof(AirportNode*) * LIST_MAX_LEVEL);
+    list->level = 1;
+    list->seed = 0x2545F4914F6CDD1DULL;
+    list->count = 0;
+}
+
+/** Picks the number of levels for a new node, each extra level having
+ * probability one quarter.
+ *
+ * @param list List the node is for
+ * @return Number of levels, between 1 and LIST_MAX_LEVEL
+ */
+int random_level(AirportList* list) {
+    // xorshift64
+    list->seed ^= list->seed << 13;
+    list->seed ^= list->seed >> 7;
+    list->seed ^= list->seed << 17;
+
+    uint64_t bits = list->seed;
+    int level = 1;
+    while (level < LIST_MAX_LEVEL && (bits & 3) == 0) {
+        level++;
+        bits >>= 2;
+    }
+    return level;
+}
+
+/** Compares an airport's id with a possibly unterminated key.
+ *
+ * @param airport Airport whose id is compared
+ * @param id Key, need not be null terminated
+ * @param length Number of characters in key
+ * @return < 0 if the airport goes before key, 0 if key is a prefix of the
+ *         airport's id, > 0 otherwise
+ */
+int compare_airport(const Airport* airport, const char* id, size_t length) {
+    return strncmp(airport->id, id, length);
+}
+
+/** Inserts an airport into list in id order. The airport's id must not
+ * already be present.
+ *
+ * @param list List to insert into
+ * @param airport Airport to insert
+ */
+void airport_list_insert(AirportList* list, Airport* airport) {
+    AirportNode* update[LIST_MAX_LEVEL];
+    AirportNode* node = list->head;
+
+    // find the last node before airport on each level
+    for (int i = list->level - 1; i >= 0; --i) {
+        while (node->next[i] != NULL &&
+                strcmp(node->next[i]->airport->id, airport->id) < 0) {
+            node = node->next[i];
+        }
+        update[i] = node;
+    }
+
+    int level = random_level(list);
+    for (int i = list->level; i < level; ++i) {
+        update[i] = list->head;
+    }
+    if (level > list->level) {
+        list->level = level;
+    }
+
+    AirportNode* inserted = malloc(sizeof(AirportNode) +
+            sizeof(AirportNode*) * level);
+    inserted->airport = airport;
+    for (int i = 0; i < level; ++i) {
+        inserted->next[i] = update[i]->next[i];
+        update[i]->next[i] = inserted;
+    }
+    list->count++;
+}
+
+/** Fills an empty list from airports already in id order, without
+ * searching for where each one goes.
+ *
+ * @param list Empty list to fill
+ * @param airports Airports in strictly increasing id order
+ * @param count Number of airports
+ */
+void airport_list_build(AirportList* list, Airport** airports, size_t count) {
+    // last node on each level so far
+    AirportNode* tails[LIST_MAX_LEVEL];
+    for (int i = 0; i < LIST_MAX_LEVEL; ++i) {
+        tails[i] = list->head;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        int level = random_level(list);
+        if (level > list->level) {
+            list->level = level;
+        }
+        AirportNode* node = malloc(sizeof(AirportNode) +
+                sizeof(AirportNode*) * level);
+        node->airport = airports[i];
+        for (int j = 0; j < level; ++j) {
+            node->next[j] = NULL;
+            tails[j]->next[j] = node;
+            tails[j] = node;
+        }
+    }
+    list->count = count;
+}
+
+/** Finds the first airport whose id is not before the given key. Walking
+ * on from the result with next[0] visits airports in id order.
+ *
+ * @param list List to search
+ * @param id Key, need not be null terminated
+ * @param length Number of characters in key
+ * @return First node at or after key, or NULL if there is none
+ */
+AirportNode* airport_list_seek(const AirportList* list, const char* id,
+        size_t length) {
+    AirportNode* node = list->head;
+    for (int i = list->level - 1; i >= 0; --i) {
+        while (node->next[i] != NULL &&
+                compare_airport(node->next[i]->airport, id, length) < 0) {
+            node = node->next[i];
+        }
+    }
+    return node->next[0];
+}
@@ -0,0 +1,73 @@
+#ifndef AIRPORTS_H
+#define AIRPORTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Representation of an Airport. **/
+typedef struct Airport {
+    // Airport ID
+    char* id;
+
+    // Airport info
+    char* info;
+
+    // port which Airport is on
+    int port;
+
+    // cached hash of id
+    uint64_t hash;
+} Airport;
+
+/** Open addressing hash index of airports keyed by id. **/
+typedef struct AirportTable {
+    // slots holding airports, NULL when empty
+    Airport** slots;
+
+    // number of slots, always zero or a power of two
+    size_t capacity;
+
+    // number of occupied slots
+    size_t count;
+} AirportTable;
+
+// maximum number of levels in an airport list
+#define LIST_MAX_LEVEL 32
+
+/** Node of an airport skiplist. **/
+typedef struct AirportNode {
+    // airport held by node, NULL for the head node
+    Airport* airport;
+
+    // successor on each of the node's levels
+    struct AirportNode* next[];
+} AirportNode;
+
+/** Skiplist of airports ordered by id. **/
+typedef struct AirportList {
+    // head node with LIST_MAX_LEVEL levels
+    AirportNode* head;
+
+    // number of levels currently in use
+    int level;
+
+    // state of the level generator
+    uint64_t seed;
+
+    // number of airports in list
+    size_t count;
+} AirportList;
+
+uint64_t hash_id(const char* id, size_t length);
+void init_airport_table(AirportTable* table);
+Airport* airport_table_find(const AirportTable* table, const char* id,
+        size_t length, uint64_t hash);
+void airport_table_insert(AirportTable* table, Airport* airport);
+void airport_table_reserve(AirportTable* table, size_t count);
+void init_airport_list(AirportList* list);
+void airport_list_insert(AirportList* list, Airport* airport);
+void airport_list_build(AirportList* list, Airport** airports, size_t count);
+AirportNode* airport_list_seek(const AirportList* list, const char* id,
+        size_t length);
+
+#endif
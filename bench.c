@@ -0,0 +1,924 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include "smoke.h"
+
+/** Finds a program built alongside the bench, named as the bench is with
+ * "bench" swapped for its role, so bench2310 runs mapper2310 and a bench
+ * built by cmake runs mapper.
+ *
+ * @param role "mapper", "control", "roc", "bench" or "microbench"
+ * @return Path of the program, or NULL if the bench cannot find itself
+ */
+char* sibling_program(const char* role) {
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length <= 0) {
+        return NULL;
+    }
+    self[length] = '\0';
+    char* name = strrchr(self, '/') + 1;
+    char* suffix = strstr(name, "bench");
+    size_t size = length + strlen(role) + 1;
+    char* path = malloc(size);
+    snprintf(path, size, "%.*s%s%s", (int) (name - self), self, role,
+            suffix == NULL ? "" : suffix + strlen("bench"));
+    return path;
+}
+
+/** Starts a server program and reads the port it prints.
+ *
+ * @param path Program to run
+ * @param args Arguments, args[0] being the program's name, NULL terminated
+ * @param port Set to the port the server listens on
+ * @return Process id of the server, or -1 if it could not be started
+ */
+pid_t start_server(char* path, char** args, int* port) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(path, args);
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid == -1) {
+        close(fds[0]);
+        return -1;
+    }
+    FILE* reader = fdopen(fds[0], "r");
+    char line[PORT_MAX_CHARS + 1];
+    *port = 0;
+    if (fgets(line, sizeof(line), reader) != NULL) {
+        *port = atoi(line);
+    }
+    fclose(reader);
+    if (*port <= 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/** Stops every server started so far.
+ *
+ * @param servers Servers of the run
+ */
+void stop_servers(BenchServers* servers) {
+    for (int i = 0; i < servers->countControls; ++i) {
+        kill(servers->controls[i], SIGTERM);
+        waitpid(servers->controls[i], NULL, 0);
+    }
+    if (servers->mapper > 0) {
+        kill(servers->mapper, SIGTERM);
+        waitpid(servers->mapper, NULL, 0);
+    }
+    servers->countControls = 0;
+    servers->mapper = 0;
+}
+
+/** Builds the arguments of a server: the options passed on from the bench
+ * followed by the given arguments.
+ *
+ * @param path Program to run
+ * @param options Options of the bench
+ * @param rest Arguments after the options, NULL terminated
+ * @return Arguments, NULL terminated
+ */
+char** server_arguments(char* path, const BenchOptions* options,
+        char** rest) {
+    char** args = calloc(12, sizeof(char*));
+    int count = 0;
+    args[count++] = path;
+    if (options->threads > 0) {
+        args[count++] = "-t";
+        args[count] = malloc(PORT_MAX_CHARS + 8);
+        snprintf(args[count++], PORT_MAX_CHARS + 8, "%d", options->threads);
+    }
+    if (options->socketDirectory != NULL) {
+        args[count++] = "-u";
+        args[count++] = options->socketDirectory;
+    }
+    for (int i = 0; rest[i] != NULL; ++i) {
+        args[count++] = rest[i];
+    }
+    return args;
+}
+
+/** Asks the mapper for every control's port until it knows them all.
+ *
+ * @param servers Servers of the run
+ * @return false if the controls were not all registered in time
+ */
+bool wait_for_registration(const BenchServers* servers) {
+    long deadline = now_ns() + BENCH_REGISTER_TIMEOUT * 1000000000L;
+    while (now_ns() < deadline) {
+        int fd = outbound_socket_maker(servers->mapperPort);
+        if (fd == -1) {
+            return false;
+        }
+        FILE* writer = fdopen(dup(fd), "w");
+        FILE* reader = fdopen(fd, "r");
+        for (int i = 0; i < servers->countControls; ++i) {
+            fprintf(writer, "?bench%d\n", i);
+        }
+        fflush(writer);
+        int known = 0;
+        char line[80];
+        for (int i = 0; i < servers->countControls &&
+                fgets(line, sizeof(line), reader) != NULL; ++i) {
+            if (atoi(line) == servers->controlPorts[i]) {
+                known++;
+            }
+        }
+        fclose(writer);
+        fclose(reader);
+        if (known == servers->countControls) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+/** Starts the mapper and the controls, which register with it.
+ *
+ * @param options Options of the bench
+ * @param servers Where to store the servers started
+ * @return false if a server could not be started or did not register
+ */
+bool start_servers(const BenchOptions* options, BenchServers* servers) {
+    servers->controls = malloc(sizeof(pid_t) * options->controls);
+    servers->controlPorts = malloc(sizeof(int) * options->controls);
+    servers->countControls = 0;
+    char* mapperPath = sibling_program("mapper");
+    char* controlPath = sibling_program("control");
+    if (mapperPath == NULL || controlPath == NULL) {
+        return false;
+    }
+
+    char* none[] = {NULL};
+    servers->mapper = start_server(mapperPath,
+            server_arguments(mapperPath, options, none),
+            &servers->mapperPort);
+    if (servers->mapper == -1) {
+        servers->mapper = 0;
+        return false;
+    }
+
+    char mapperPort[PORT_MAX_CHARS];
+    snprintf(mapperPort, sizeof(mapperPort), "%d", servers->mapperPort);
+    for (int i = 0; i < options->controls; ++i) {
+        char id[32];
+        char info[32];
+        snprintf(id, sizeof(id), "bench%d", i);
+        snprintf(info, sizeof(info), "info%d", i);
+        // controls of a run in frames register in frames too
+        char* framedRest[] = {"-b", id, info, mapperPort, NULL};
+        char* linesRest[] = {id, info, mapperPort, NULL};
+        char** rest = options->framed ? framedRest : linesRest;
+        pid_t pid = start_server(controlPath,
+                server_arguments(controlPath, options, rest),
+                &servers->controlPorts[i]);
+        if (pid == -1) {
+            return false;
+        }
+        servers->controls[servers->countControls++] = pid;
+    }
+    return wait_for_registration(servers);
+}
+
+/** Reads the CPU time a process has used, in user and system mode.
+ *
+ * @param pid Process to measure
+ * @return CPU time in ns, or 0 if it cannot be read
+ */
+long process_cpu_ns(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    char line[1024];
+    long ticks = 0;
+    if (fgets(line, sizeof(line), file) != NULL) {
+        // the fields after the name, which may hold spaces, are numbered
+        // from 3; utime and stime are 14 and 15
+        char* field = strrchr(line, ')');
+        unsigned long user = 0;
+        unsigned long system = 0;
+        if (field != NULL && sscanf(field + 2, "%*c %*d %*d %*d %*d %*d "
+                "%*u %*u %*u %*u %*u %lu %lu", &user, &system) == 2) {
+            ticks = (long) (user + system);
+        }
+    }
+    fclose(file);
+    return ticks * (1000000000L / sysconf(_SC_CLK_TCK));
+}
+
+/** Reads the CPU time the calling process has used.
+ *
+ * @return CPU time in ns
+ */
+long own_cpu_ns(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000L +
+            (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000L;
+}
+
+/** Gives up on a roc, closing its connections.
+ *
+ * @param roc Roc to give up on
+ * @param result Counters of the process
+ */
+void fail_roc(SimulatedRoc* roc, BenchResult* result) {
+    if (roc->mapperFd != -1) {
+        close(roc->mapperFd);
+    }
+    if (roc->controlFd != -1) {
+        close(roc->controlFd);
+    }
+    roc->mapperFd = -1;
+    roc->controlFd = -1;
+    roc->stage = TRIP_FAILED;
+    result->errors++;
+}
+
+/** Sends a request. With one request in flight per connection the
+ * socket's buffer always has room for it.
+ *
+ * @param fd Socket to send on
+ * @param request Line or frame to send
+ * @param length Number of bytes in request
+ * @return false if the request could not be sent whole
+ */
+bool send_request(int fd, const char* request, size_t length) {
+    return send(fd, request, length, MSG_NOSIGNAL) == (ssize_t) length;
+}
+
+/** Checks whether a roc's reply has arrived whole.
+ *
+ * @param roc Roc with a request in flight
+ * @return true if the reply line or frame is complete
+ */
+bool reply_complete(const SimulatedRoc* roc) {
+    if (!roc->framed) {
+        return memchr(roc->reply, '\n', roc->replyLength) != NULL;
+    }
+    return roc->replyLength >= FRAME_LENGTH_BYTES &&
+            roc->replyLength >= FRAME_LENGTH_BYTES + frame_u32(roc->reply);
+}
+
+/** Reads the port from a roc's complete reply to its lookup.
+ *
+ * @param roc Roc whose lookup was answered
+ * @return Port given, or 0 if there was none
+ */
+int reply_port(const SimulatedRoc* roc) {
+    if (!roc->framed) {
+        return atoi(roc->reply);
+    }
+    Frame frame;
+    if (!parse_frame((char*) roc->reply + FRAME_LENGTH_BYTES,
+            roc->replyLength - FRAME_LENGTH_BYTES, &frame) ||
+            frame.code != FRAME_OK || frame.length != 2) {
+        return 0;
+    }
+    return frame_u16(frame.payload);
+}
+
+/** Starts a trip by sending the roc's lookup to the mapper.
+ *
+ * @param roc Idle roc
+ * @param due Time the trip was due to start
+ * @param result Counters of the process
+ */
+void start_trip(SimulatedRoc* roc, long due, BenchResult* result) {
+    roc->scheduled = due;
+    roc->sent = now_ns();
+    roc->replyLength = 0;
+    roc->stage = TRIP_LOOKUP;
+    if (!send_request(roc->mapperFd, roc->query, roc->queryLength)) {
+        fail_roc(roc, result);
+    }
+}
+
+/** Starts a trip which has fallen due, or holds it back until the roc's
+ * current trip ends.
+ *
+ * @param roc Roc the trip belongs to
+ * @param due Time the trip fell due
+ * @param result Counters of the process
+ */
+void trip_due(SimulatedRoc* roc, long due, BenchResult* result) {
+    if (roc->stage == TRIP_IDLE) {
+        start_trip(roc, due, result);
+    } else if (roc->stage != TRIP_FAILED) {
+        if (roc->backlog == 0) {
+            roc->backlogDue = due;
+        }
+        roc->backlog++;
+    }
+}
+
+/** Reads the reply to a roc's request in flight and, once it is whole,
+ * moves the trip on.
+ *
+ * @param roc Roc whose socket is ready
+ * @param interval Time between the trips of one roc, 0 to start the next
+ *        as soon as one ends
+ * @param stopping True once no more trips are to be started
+ * @param end Time trips stop counting towards throughput
+ * @param result Counters of the process
+ */
+void advance_trip(SimulatedRoc* roc, long interval, bool stopping, long end,
+        BenchResult* result) {
+    int fd = roc->stage == TRIP_LOOKUP ? roc->mapperFd : roc->controlFd;
+    ssize_t got = recv(fd, roc->reply + roc->replyLength,
+            sizeof(roc->reply) - 1 - roc->replyLength, 0);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (got <= 0) {
+        fail_roc(roc, result);
+        return;
+    }
+    roc->replyLength += got;
+    if (!reply_complete(roc)) {
+        if (roc->replyLength == sizeof(roc->reply) - 1) {
+            fail_roc(roc, result);
+        }
+        return;
+    }
+    roc->reply[roc->replyLength] = '\0';
+    long now = now_ns();
+
+    // the mapper has answered, so visit the control it named
+    if (roc->stage == TRIP_LOOKUP) {
+        histogram_record(&result->lookup, now - roc->sent);
+        if (reply_port(roc) != roc->controlPort) {
+            fail_roc(roc, result);
+            return;
+        }
+        roc->sent = now;
+        roc->replyLength = 0;
+        roc->stage = TRIP_VISIT;
+        if (!send_request(roc->controlFd, roc->visit, roc->visitLength)) {
+            fail_roc(roc, result);
+        }
+        return;
+    }
+
+    // control has answered, so the trip is over
+    histogram_record(&result->visit, now - roc->sent);
+    histogram_record(&result->trip, now - roc->scheduled);
+    if (now <= end) {
+        result->trips++;
+    }
+    roc->stage = TRIP_IDLE;
+    if (stopping) {
+        return;
+    }
+    if (interval == 0) {
+        start_trip(roc, now, result);
+    } else if (roc->backlog > 0) {
+        roc->backlog--;
+        long due = roc->backlogDue;
+        roc->backlogDue += interval;
+        start_trip(roc, due, result);
+    }
+}
+
+/** Writes a request for a roc as a line or as a frame.
+ *
+ * @param data Where to write the request
+ * @param framed True for a frame
+ * @param command Command of the frame
+ * @param text Line without its '\n', or payload of the frame
+ * @return Number of bytes written
+ */
+size_t encode_request(char* data, bool framed, FrameCommand command,
+        const char* text) {
+    if (!framed) {
+        return (size_t) sprintf(data, "%s%s\n",
+                command == FRAME_QUERY ? "?" : "", text);
+    }
+    Frame frame = {0, command, (char*) text, strlen(text)};
+    encode_frame(data, &frame);
+    return FRAME_LENGTH_BYTES + FRAME_HEADER_BYTES + frame.length;
+}
+
+/** Connects a roc to a server, asking for frames if the bench uses them.
+ *
+ * @param port Port of the server
+ * @param framed True to ask for frames
+ * @return Socket connected to the server, or -1 if the connection could
+ *         not be made or frames were refused
+ */
+int connect_roc(int port, bool framed) {
+    int fd = outbound_socket_maker(port);
+    if (fd != -1 && framed && !request_frames(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/** Connects a bench process's rocs to the mapper and their controls.
+ *
+ * @param rocs Rocs of the process
+ * @param count Number of rocs
+ * @param first Index of the first roc among all the bench's rocs
+ * @param framed True for the rocs to speak in frames
+ * @param servers Servers of the run
+ * @param epollFd Epoll instance to watch the connections with
+ * @param result Counters of the process
+ */
+void connect_rocs(SimulatedRoc* rocs, int count, int first, bool framed,
+        const BenchServers* servers, int epollFd, BenchResult* result) {
+    for (int i = 0; i < count; ++i) {
+        SimulatedRoc* roc = &rocs[i];
+        int home = (first + i) % servers->countControls;
+        memset(roc, 0, sizeof(SimulatedRoc));
+        roc->controlPort = servers->controlPorts[home];
+        roc->framed = framed;
+        char text[32];
+        snprintf(text, sizeof(text), "bench%d", home);
+        roc->queryLength = encode_request(roc->query, framed, FRAME_QUERY,
+                text);
+        snprintf(text, sizeof(text), "plane%d", first + i);
+        roc->visitLength = encode_request(roc->visit, framed, FRAME_VISIT,
+                text);
+        roc->mapperFd = connect_roc(servers->mapperPort, framed);
+        roc->controlFd = connect_roc(roc->controlPort, framed);
+        if (roc->mapperFd == -1 || roc->controlFd == -1) {
+            fail_roc(roc, result);
+            continue;
+        }
+        int fds[] = {roc->mapperFd, roc->controlFd};
+        for (int j = 0; j < 2; ++j) {
+            fcntl(fds[j], F_SETFL, fcntl(fds[j], F_GETFL) | O_NONBLOCK);
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u32 = (uint32_t) i;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[j], &event);
+        }
+    }
+}
+
+/** Arms a timer to fire at a monotonic time.
+ *
+ * @param timerFd Timer to arm
+ * @param at Monotonic time in ns
+ */
+void arm_timer(int timerFd, long at) {
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(struct itimerspec));
+    timer.it_value.tv_sec = at / 1000000000L;
+    timer.it_value.tv_nsec = at % 1000000000L;
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+/** Runs trips on a bench process's rocs until the run ends. With a rate
+ * given, trips fall due on a fixed schedule, staggered across the rocs,
+ * whether or not earlier ones have been answered, so that a slow server
+ * shows as latency rather than as fewer trips being tried.
+ *
+ * @param rocs Rocs of the process
+ * @param count Number of rocs
+ * @param rate Trips started per second by the process, 0 for as fast as
+ *        the rocs are answered
+ * @param seconds Seconds trips are started for
+ * @param epollFd Epoll instance watching the rocs' connections
+ * @param result Counters of the process
+ */
+void run_trips(SimulatedRoc* rocs, int count, long rate, int seconds,
+        int epollFd, BenchResult* result) {
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = (uint32_t) count;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+
+    long cpuStart = own_cpu_ns();
+    long start = now_ns();
+    long end = start + seconds * 1000000000L;
+    long interval = rate == 0 ? 0 : count * 1000000000L / rate;
+    long ticket = 0;
+    long nextDue = start;
+    if (interval == 0) {
+        for (int i = 0; i < count; ++i) {
+            trip_due(&rocs[i], start, result);
+        }
+        nextDue = end;
+    }
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    bool stopping = false;
+    while (true) {
+        long now = now_ns();
+        stopping = now >= end;
+
+        // start every trip which has fallen due
+        while (!stopping && nextDue <= now) {
+            trip_due(&rocs[ticket % count], nextDue, result);
+            ticket++;
+            nextDue = start + ticket / count * interval +
+                    ticket % count * interval / count;
+        }
+
+        int busy = 0;
+        if (stopping) {
+            for (int i = 0; i < count; ++i) {
+                if (rocs[i].stage == TRIP_LOOKUP ||
+                        rocs[i].stage == TRIP_VISIT) {
+                    busy++;
+                }
+            }
+            if (busy == 0 ||
+                    now >= end + BENCH_DRAIN_TIMEOUT * 1000000000L) {
+                break;
+            }
+        }
+        arm_timer(timerFd, stopping ?
+                end + BENCH_DRAIN_TIMEOUT * 1000000000L :
+                (nextDue < end ? nextDue : end));
+
+        int ready = epoll_wait(epollFd, events, REACTOR_MAX_EVENTS, -1);
+        for (int i = 0; i < ready; ++i) {
+            uint32_t index = events[i].data.u32;
+            if (index == (uint32_t) count) {
+                uint64_t expirations;
+                while (read(timerFd, &expirations, sizeof(expirations)) > 0) {
+                }
+                continue;
+            }
+            SimulatedRoc* roc = &rocs[index];
+            if (roc->stage == TRIP_LOOKUP || roc->stage == TRIP_VISIT) {
+                advance_trip(roc, interval, stopping, end, result);
+            }
+        }
+    }
+    result->cpuNs = own_cpu_ns() - cpuStart;
+    close(timerFd);
+}
+
+/** Runs a bench process: connects its rocs, tells the parent it is ready,
+ * waits to be told to go, runs its trips and sends back what it measured.
+ *
+ * @param options Options of the bench
+ * @param servers Servers of the run
+ * @param first Index of the process's first roc among all the rocs
+ * @param count Number of rocs the process runs
+ * @param resultFd Pipe to the parent
+ * @param goFd Pipe closed by the parent to start the run
+ */
+void run_bench_process(const BenchOptions* options,
+        const BenchServers* servers, int first, int count, int resultFd,
+        int goFd) {
+    raise_file_limit();
+    BenchResult* result = calloc(1, sizeof(BenchResult));
+    SimulatedRoc* rocs = malloc(sizeof(SimulatedRoc) * count);
+    int epollFd = epoll_create1(0);
+    connect_rocs(rocs, count, first, options->framed, servers, epollFd,
+            result);
+
+    char byte = 0;
+    if (write(resultFd, &byte, 1) != 1 || read(goFd, &byte, 1) != 0) {
+        _exit(1);
+    }
+    long rate = (long) ((double) options->rate * count / options->rocs);
+    if (options->rate > 0 && rate == 0) {
+        rate = 1;
+    }
+    run_trips(rocs, count, rate, options->seconds, epollFd, result);
+
+    char* data = (char*) result;
+    size_t sent = 0;
+    while (sent < sizeof(BenchResult)) {
+        ssize_t wrote = write(resultFd, data + sent,
+                sizeof(BenchResult) - sent);
+        if (wrote <= 0) {
+            _exit(1);
+        }
+        sent += wrote;
+    }
+    _exit(0);
+}
+
+/** Reads exactly the bytes asked for from a pipe.
+ *
+ * @param fd Pipe to read
+ * @param data Where to store the bytes
+ * @param length Number of bytes
+ * @return false if the pipe closed first
+ */
+bool read_whole(int fd, void* data, size_t length) {
+    size_t got = 0;
+    while (got < length) {
+        ssize_t count = read(fd, (char*) data + got, length - got);
+        if (count <= 0) {
+            return false;
+        }
+        got += count;
+    }
+    return true;
+}
+
+/** Adds the counts of one histogram into another.
+ *
+ * @param total Histogram to add to
+ * @param part Histogram to add
+ */
+void add_histogram(Histogram* total, const Histogram* part) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        total->buckets[i] += part->buckets[i];
+    }
+}
+
+/** Prints one kind of latency as the stats command does.
+ *
+ * @param name Kind of latency
+ * @param histogram Latencies measured
+ */
+void print_latency(const char* name, const Histogram* histogram) {
+    printf("latency %s p50_ns=%ld p99_ns=%ld p999_ns=%ld\n", name,
+            histogram_percentile(histogram, 0.5),
+            histogram_percentile(histogram, 0.99),
+            histogram_percentile(histogram, 0.999));
+}
+
+/** Runs the rocs across as many processes as their connections need, and
+ * prints what they measured with the CPU time the servers used.
+ *
+ * @param options Options of the bench
+ * @param servers Servers of the run
+ * @param perSecond Set to the requests answered per second
+ * @return false if a process failed
+ */
+bool run_bench(const BenchOptions* options, const BenchServers* servers,
+        long* perSecond) {
+    // each roc holds two connections
+    int perProcess = (raise_file_limit() - BENCH_RESERVED_FILES) / 2;
+    int countProcesses = (options->rocs + perProcess - 1) / perProcess;
+    pid_t* pids = malloc(sizeof(pid_t) * countProcesses);
+    int* resultFds = malloc(sizeof(int) * countProcesses);
+    int go[2];
+    if (pipe(go) != 0) {
+        return false;
+    }
+    for (int i = 0; i < countProcesses; ++i) {
+        int first = i * options->rocs / countProcesses;
+        int count = (i + 1) * options->rocs / countProcesses - first;
+        int fds[2];
+        if (pipe(fds) != 0) {
+            return false;
+        }
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            close(fds[0]);
+            close(go[1]);
+            run_bench_process(options, servers, first, count, fds[1], go[0]);
+        }
+        close(fds[1]);
+        resultFds[i] = fds[0];
+    }
+    close(go[0]);
+
+    // every process has connected its rocs before the clock starts
+    bool succeeded = true;
+    for (int i = 0; i < countProcesses; ++i) {
+        char byte;
+        succeeded = read_whole(resultFds[i], &byte, 1) && succeeded;
+    }
+    long mapperCpu = process_cpu_ns(servers->mapper);
+    long controlCpu = 0;
+    for (int i = 0; i < servers->countControls; ++i) {
+        controlCpu -= process_cpu_ns(servers->controls[i]);
+    }
+    close(go[1]);
+
+    BenchResult* total = calloc(1, sizeof(BenchResult));
+    BenchResult* part = malloc(sizeof(BenchResult));
+    for (int i = 0; i < countProcesses; ++i) {
+        if (!read_whole(resultFds[i], part, sizeof(BenchResult))) {
+            succeeded = false;
+            continue;
+        }
+        total->trips += part->trips;
+        total->errors += part->errors;
+        total->cpuNs += part->cpuNs;
+        add_histogram(&total->lookup, &part->lookup);
+        add_histogram(&total->visit, &part->visit);
+        add_histogram(&total->trip, &part->trip);
+    }
+    mapperCpu = process_cpu_ns(servers->mapper) - mapperCpu;
+    for (int i = 0; i < servers->countControls; ++i) {
+        controlCpu += process_cpu_ns(servers->controls[i]);
+    }
+    for (int i = 0; i < countProcesses; ++i) {
+        close(resultFds[i]);
+        waitpid(pids[i], NULL, 0);
+    }
+
+    // a trip is two requests, a lookup then a visit
+    long trips = total->trips > 0 ? total->trips : 1;
+    *perSecond = total->trips * 2 / options->seconds;
+    printf("run controls=%d rocs=%d threads=%d processes=%d rate=%ld "
+            "seconds=%d protocol=%s\n", options->controls, options->rocs,
+            options->threads, countProcesses, options->rate, options->seconds,
+            options->framed ? "frames" : "lines");
+    printf("requests count=%ld per_second=%ld errors=%ld\n",
+            total->trips * 2, *perSecond, total->errors);
+    print_latency("lookup", &total->lookup);
+    print_latency("visit", &total->visit);
+    print_latency("trip", &total->trip);
+    printf("cpu mapper_ns_per_lookup=%ld control_ns_per_visit=%ld "
+            "bench_ns_per_request=%ld\n", mapperCpu / trips,
+            controlCpu / trips, total->cpuNs / (trips * 2));
+    fflush(stdout);
+    free(part);
+    free(total);
+    free(resultFds);
+    free(pids);
+    return succeeded;
+}
+
+/** Parses a comma separated list of counts, such as 1,2,4,8.
+ *
+ * @param list Counts in text
+ * @param counts Set to the counts, allocated
+ * @param count Set to the number of counts
+ * @return false if a count is not a number from 1 to 2^24
+ */
+bool parse_counts(const char* list, int** counts, int* count) {
+    *counts = malloc(sizeof(int) * (strlen(list) / 2 + 1));
+    *count = 0;
+    const char* next = list;
+    while (true) {
+        char* rest;
+        long value = strtol(next, &rest, 10);
+        if (rest == next || value <= 0 || value > 1 << 24 ||
+                (*rest != ',' && *rest != '\0')) {
+            return false;
+        }
+        (*counts)[(*count)++] = (int) value;
+        if (*rest == '\0') {
+            return true;
+        }
+        next = rest + 1;
+    }
+}
+
+/** Parses the bench's options.
+ *
+ * @param argc Program argument count
+ * @param argv Program arguments
+ * @param options Where to store the options, defaults if not given
+ * @return false if the options are invalid or arguments follow them
+ * @options
+ *    -n count - number of controls to start
+ *    -m count - number of simulated rocs, each with two connections
+ *    -r rate - trips started per second, 0 for as fast as answered
+ *    -d seconds - how long to start trips for
+ *    -t count - number of worker threads in each server
+ *    -u directory - connect through Unix domain sockets in this directory
+ *    -b - have rocs ask for frames rather than speak in lines
+ *    -T counts - run once for each of these worker thread counts
+ *    -M counts - run once for each of these roc counts, within each
+ *                thread count
+ *    -S - check that the servers answer preload, a restore from a
+ *         snapshot, @since, watch and frames as they should, rather than
+ *         measure; -t and -u are passed on to the servers
+ */
+bool parse_bench_options(int argc, char** argv, BenchOptions* options) {
+    options->controls = 4;
+    options->rocs = 100;
+    options->rate = 0;
+    options->seconds = 10;
+    options->threads = 0;
+    options->socketDirectory = NULL;
+    options->framed = false;
+    options->sweepThreads = NULL;
+    options->countSweepThreads = 0;
+    options->sweepRocs = NULL;
+    options->countSweepRocs = 0;
+    options->smoke = false;
+
+    opterr = 0;
+    int option;
+    while ((option = getopt(argc, argv, "n:m:r:d:t:u:bT:M:S")) != -1) {
+        if (option == 'T' || option == 'M') {
+            bool threads = option == 'T';
+            if (!parse_counts(optarg, threads ? &options->sweepThreads :
+                    &options->sweepRocs, threads ?
+                    &options->countSweepThreads : &options->countSweepRocs)) {
+                return false;
+            }
+            continue;
+        }
+        if (option == 'u' && strlen(optarg) != 0) {
+            options->socketDirectory = optarg;
+            continue;
+        }
+        if (option == 'b') {
+            options->framed = true;
+            continue;
+        }
+        if (option == 'S') {
+            options->smoke = true;
+            continue;
+        }
+        if (option != 'n' && option != 'm' && option != 'r' &&
+                option != 'd' && option != 't') {
+            return false;
+        }
+        char* rest;
+        long value = strtol(optarg, &rest, 10);
+        if (strlen(rest) != 0 || strlen(optarg) == 0 || value < 0 ||
+                value > 1 << 24 || (value == 0 && option != 'r')) {
+            return false;
+        }
+        if (option == 'n') {
+            options->controls = (int) value;
+        } else if (option == 'm') {
+            options->rocs = (int) value;
+        } else if (option == 'r') {
+            options->rate = value;
+        } else if (option == 'd') {
+            options->seconds = (int) value;
+        } else {
+            options->threads = (int) value;
+        }
+    }
+    return optind == argc && init_transport(options->socketDirectory);
+}
+
+/** Entry point to the bench.
+ * @exit
+ *   1 - Invalid options
+ *   2 - The servers could not be started
+ *   3 - A bench process failed
+ *   4 - A smoke check failed
+ */
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parse_bench_options(argc, argv, &options)) {
+        fprintf(stderr, "Usage: bench2310 [-n controls] [-m rocs] "
+                "[-r rate] [-d seconds] [-t threads] [-u directory] [-b] "
+                "[-T threads,...] [-M rocs,...] [-S]\n");
+        return 1;
+    }
+    if (options.smoke) {
+        return run_smoke(&options) ? 0 : 4;
+    }
+    // without a sweep, one run with the counts given
+    int countThreads = options.sweepThreads == NULL ? 1 :
+            options.countSweepThreads;
+    int countRocs = options.sweepRocs == NULL ? 1 : options.countSweepRocs;
+    long* perSecond = malloc(sizeof(long) * countThreads * countRocs);
+    bool succeeded = true;
+    for (int i = 0; i < countThreads * countRocs; ++i) {
+        BenchOptions run = options;
+        if (options.sweepThreads != NULL) {
+            run.threads = options.sweepThreads[i / countRocs];
+        }
+        if (options.sweepRocs != NULL) {
+            run.rocs = options.sweepRocs[i % countRocs];
+        }
+        // each run has servers of its own, started with its thread count
+        BenchServers servers;
+        memset(&servers, 0, sizeof(BenchServers));
+        if (!start_servers(&run, &servers)) {
+            stop_servers(&servers);
+            fprintf(stderr, "Can not start servers\n");
+            return 2;
+        }
+        succeeded = run_bench(&run, &servers, &perSecond[i]) && succeeded;
+        stop_servers(&servers);
+    }
+
+    // how throughput grows with threads and rocs, once every run is done
+    for (int i = 0; countThreads * countRocs > 1 &&
+            i < countThreads * countRocs; ++i) {
+        printf("scaling threads=%d rocs=%d per_second=%ld\n",
+                options.sweepThreads == NULL ? options.threads :
+                options.sweepThreads[i / countRocs],
+                options.sweepRocs == NULL ? options.rocs :
+                options.sweepRocs[i % countRocs], perSecond[i]);
+    }
+    free(perSecond);
+    return succeeded ? 0 : 3;
+}
@@ -0,0 +1,136 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <sys/types.h>
+#include "networking.h"
+
+// descriptors each bench process keeps back from its rocs' connections
+#define BENCH_RESERVED_FILES 64
+
+// seconds the controls are given to register with the mapper
+#define BENCH_REGISTER_TIMEOUT 5
+
+// seconds trips still in flight at the end of a run are waited for
+#define BENCH_DRAIN_TIMEOUT 1
+
+/** Where a simulated roc is in its trip. **/
+typedef enum TripStage {
+    TRIP_IDLE = 0,
+    TRIP_LOOKUP = 1,
+    TRIP_VISIT = 2,
+    TRIP_FAILED = 3
+} TripStage;
+
+/** A roc kept connected to the mapper and to its home control, making the
+ * lookup and the visit of a roc2310 run over and over.
+ */
+typedef struct SimulatedRoc {
+    // sockets connected to the mapper and to the home control
+    int mapperFd;
+    int controlFd;
+
+    // port the mapper should give for the home control
+    int controlPort;
+
+    // true if the roc's connections speak in frames
+    bool framed;
+
+    // query sent to the mapper and plane id sent to control, as lines or
+    // frames
+    char query[48];
+    size_t queryLength;
+    char visit[48];
+    size_t visitLength;
+
+    // how far the current trip has got
+    TripStage stage;
+
+    // monotonic time in ns at which the current trip was due to start,
+    // and at which its request in flight was sent
+    long scheduled;
+    long sent;
+
+    // number of trips which fell due while the roc was busy, and the time
+    // the first of them was due
+    int backlog;
+    long backlogDue;
+
+    // reply line or frame received so far
+    char reply[80];
+    size_t replyLength;
+} SimulatedRoc;
+
+/** Options given on the command line of the bench. **/
+typedef struct BenchOptions {
+    // number of controls started
+    int controls;
+
+    // number of simulated rocs, each holding two connections
+    int rocs;
+
+    // trips started per second over all rocs, 0 to start each roc's next
+    // trip as soon as its last one ends
+    long rate;
+
+    // seconds trips are started for
+    int seconds;
+
+    // worker threads of each server, 0 for the servers' default
+    int threads;
+
+    // directory of Unix domain sockets to connect through, NULL for TCP
+    char* socketDirectory;
+
+    // true for rocs to ask for frames rather than speak in lines
+    bool framed;
+
+    // worker thread counts a sweep runs the servers with, NULL for threads
+    // alone
+    int* sweepThreads;
+    int countSweepThreads;
+
+    // roc counts a sweep runs, NULL for rocs alone
+    int* sweepRocs;
+    int countSweepRocs;
+
+    // true to run the smoke checks rather than measure
+    bool smoke;
+} BenchOptions;
+
+/** Mapper and controls started for a run. **/
+typedef struct BenchServers {
+    // mapper process and port
+    pid_t mapper;
+    int mapperPort;
+
+    // control processes and ports
+    pid_t* controls;
+    int* controlPorts;
+    int countControls;
+} BenchServers;
+
+/** What one bench process measured, sent whole to the parent. **/
+typedef struct BenchResult {
+    // trips finished before the end of the run
+    long trips;
+
+    // rocs which could not connect or lost a connection
+    long errors;
+
+    // CPU time the process spent running trips
+    long cpuNs;
+
+    // time from sending a request to its reply, by kind of request
+    Histogram lookup;
+    Histogram visit;
+
+    // time from a trip falling due to its visit's reply
+    Histogram trip;
+} BenchResult;
+
+char* sibling_program(const char* role);
+pid_t start_server(char* path, char** args, int* port);
+char** server_arguments(char* path, const BenchOptions* options,
+        char** rest);
+
+#endif
@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+#include "networking.h"
+
+/** Finds the entry for a key, expired or not.
+ *
+ * @param cache Cache to search
+ * @param key Key as given by cache_key
+ * @return Entry for key, or NULL if there is none
+ */
+CacheEntry* find_entry(RouteCache* cache, const char* key) {
+    if (cache->countEntries == 0) {
+        return NULL;
+    }
+    uint64_t hash = hash_id(key, strlen(key));
+    size_t mask = cache->capacitySlots - 1;
+
+    // slots are never full, so the probe always reaches an empty one
+    for (size_t index = (size_t) hash & mask; cache->slots[index] != NULL;
+            index = (index + 1) & mask) {
+        CacheEntry* entry = cache->slots[index];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/** Places an entry in the first free slot of its probe sequence.
+ *
+ * @param slots Slot array with at least one free slot
+ * @param capacity Number of slots, a power of two
+ * @param entry Entry to place
+ */
+void place_entry(CacheEntry** slots, size_t capacity, CacheEntry* entry) {
+    size_t mask = capacity - 1;
+    size_t index = (size_t) entry->hash & mask;
+    while (slots[index] != NULL) {
+        index = (index + 1) & mask;
+    }
+    slots[index] = entry;
+}
+
+/** Makes the key an id's port is cached under. Ports are only known to
+ * hold for the mapper which gave them, so the key is "mapper id", as the
+ * entry's line in the file ends.
+ *
+ * @param mapper Port of the mapper shard which owns id
+ * @param id Airport id
+ * @return Key, to be freed by the caller
+ */
+char* cache_key(int mapper, const char* id) {
+    size_t length = strlen(id) + PORT_MAX_CHARS + 2;
+    char* key = malloc(length);
+    snprintf(key, length, "%d %s", mapper, id);
+    return key;
+}
+
+/** Adds an entry for a key not yet in the cache.
+ *
+ * @param cache Cache to add to
+ * @param key Key as given by cache_key
+ * @param port Port of the airport, 0 if it is being asked for
+ * @param expires Time after which the port must be asked for again
+ * @param source How the port came to be known
+ * @return The entry added
+ */
+CacheEntry* add_entry(RouteCache* cache, const char* key, int port,
+        time_t expires, CacheSource source) {
+    if (cache->countEntries == cache->capacityEntries) {
+        cache->capacityEntries = cache->capacityEntries == 0 ? 16 :
+                cache->capacityEntries * 2;
+        cache->entries = realloc(cache->entries,
+                sizeof(CacheEntry*) * cache->capacityEntries);
+    }
+    // keep load factor at or below one half
+    if ((size_t) (cache->countEntries + 1) * 2 > cache->capacitySlots) {
+        size_t capacity = cache->capacitySlots == 0 ? 32 :
+                cache->capacitySlots * 2;
+        CacheEntry** slots = calloc(capacity, sizeof(CacheEntry*));
+        for (int i = 0; i < cache->countEntries; ++i) {
+            place_entry(slots, capacity, cache->entries[i]);
+        }
+        free(cache->slots);
+        cache->slots = slots;
+        cache->capacitySlots = capacity;
+    }
+    CacheEntry* entry = malloc(sizeof(CacheEntry));
+    entry->key = malloc(sizeof(char) * strlen(key) + 1);
+    strcpy(entry->key, key);
+    entry->hash = hash_id(key, strlen(key));
+    entry->port = port;
+    entry->expires = expires;
+    entry->source = source;
+    place_entry(cache->slots, cache->capacitySlots, entry);
+    cache->entries[cache->countEntries++] = entry;
+    return entry;
+}
+
+/** Initializes a cache, loading the entries of its file which have not
+ * expired. A missing or unreadable file leaves the cache empty.
+ *
+ * @param cache Cache to initialize
+ * @param path File of "expires port mapper id" lines, or NULL to keep the
+ *        cache in memory only
+ * @param ttl Seconds a newly learnt port is trusted for
+ */
+void init_route_cache(RouteCache* cache, char* path, int ttl) {
+    cache->slots = NULL;
+    cache->capacitySlots = 0;
+    cache->entries = NULL;
+    cache->countEntries = 0;
+    cache->capacityEntries = 0;
+    cache->path = path;
+    cache->ttl = ttl;
+    cache->changed = false;
+    if (path == NULL) {
+        return;
+    }
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+    time_t now = time(NULL);
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &size, file)) != -1) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[length - 1] = '\0';
+        }
+        // the id comes last as it may hold spaces
+        char* rest;
+        long expires = strtol(line, &rest, 10);
+        if (*rest != ' ') {
+            continue;
+        }
+        char* key;
+        long port = strtol(rest + 1, &key, 10);
+        if (*key != ' ' || port <= 0 || port > 65535 || expires <= now) {
+            continue;
+        }
+        // lines from before ports were cached by mapper are dropped
+        key++;
+        char* id;
+        long mapper = strtol(key, &id, 10);
+        if (id == key || *id != ' ' || mapper <= 0 || mapper > 65535 ||
+                strlen(id + 1) == 0 || find_entry(cache, key) != NULL) {
+            continue;
+        }
+        add_entry(cache, key, (int) port, (time_t) expires, CACHE_LOADED);
+    }
+    free(line);
+    fclose(file);
+}
+
+/** Looks up the port a mapper gave for an id. Ports learnt in this run
+ * are trusted until it ends, so an id given twice is only asked for once.
+ *
+ * @param cache Cache to search
+ * @param mapper Port of the mapper shard which owns id
+ * @param id Airport id
+ * @return Port of the airport, CACHE_ASKING if it is being asked for
+ *         already, or 0 if it is not cached or has expired
+ */
+int cache_lookup(RouteCache* cache, int mapper, const char* id) {
+    char* key = cache_key(mapper, id);
+    CacheEntry* entry = find_entry(cache, key);
+    free(key);
+    if (entry == NULL) {
+        return 0;
+    }
+    if (entry->source == CACHE_ASKED) {
+        return CACHE_ASKING;
+    }
+    if (entry->source == CACHE_LOADED && entry->expires <= time(NULL)) {
+        return 0;
+    }
+    return entry->port;
+}
+
+/** Notes that an id is being asked of a mapper, so that cache_lookup
+ * tells the rest of the run to wait for the answer rather than ask again.
+ *
+ * @param cache Cache to note in
+ * @param mapper Port of the mapper shard which owns id
+ * @param id Airport id
+ */
+void cache_ask(RouteCache* cache, int mapper, const char* id) {
+    char* key = cache_key(mapper, id);
+    CacheEntry* entry = find_entry(cache, key);
+    if (entry == NULL) {
+        add_entry(cache, key, 0, 0, CACHE_ASKED);
+    } else {
+        entry->source = CACHE_ASKED;
+    }
+    free(key);
+}
+
+/** Records the port a mapper gave for an id.
+ *
+ * @param cache Cache to record in
+ * @param mapper Port of the mapper shard which gave the port
+ * @param id Airport id
+ * @param port Port of the airport
+ */
+void cache_store(RouteCache* cache, int mapper, const char* id, int port) {
+    time_t expires = time(NULL) + cache->ttl;
+    char* key = cache_key(mapper, id);
+    CacheEntry* entry = find_entry(cache, key);
+    if (entry == NULL) {
+        entry = add_entry(cache, key, port, expires, CACHE_LEARNT);
+    }
+    entry->port = port;
+    entry->expires = expires;
+    entry->source = CACHE_LEARNT;
+    free(key);
+    cache->changed = true;
+}
+
+/** Drops the port a mapper gave for an id, as when connecting to it
+ * failed, so that it is asked of the mapper next time.
+ *
+ * @param cache Cache to drop from
+ * @param mapper Port of the mapper shard which owns id
+ * @param id Airport id
+ * @return true if the port was read from the file rather than given by
+ *         the mapper in this run, so it may have moved since and is worth
+ *         asking for again
+ */
+bool cache_forget(RouteCache* cache, int mapper, const char* id) {
+    char* key = cache_key(mapper, id);
+    CacheEntry* entry = find_entry(cache, key);
+    free(key);
+    if (entry == NULL) {
+        return false;
+    }
+    if (entry->expires != 0) {
+        entry->expires = 0;
+        cache->changed = true;
+    }
+    return entry->source == CACHE_LOADED;
+}
+
+/** Writes the unexpired entries back to the cache's file if any have
+ * changed. The file is replaced whole, so that rocs running at the same
+ * time never read half of it.
+ *
+ * @param cache Cache to save
+ */
+void save_route_cache(RouteCache* cache) {
+    if (cache->path == NULL || !cache->changed) {
+        return;
+    }
+    size_t length = strlen(cache->path) + 32;
+    char* temporary = malloc(length);
+    snprintf(temporary, length, "%s.%d", cache->path, (int) getpid());
+    FILE* file = fopen(temporary, "w");
+    if (file == NULL) {
+        free(temporary);
+        return;
+    }
+    time_t now = time(NULL);
+    for (int i = 0; i < cache->countEntries; ++i) {
+        CacheEntry* entry = cache->entries[i];
+        if (entry->port != 0 && entry->expires > now) {
+            fprintf(file, "%ld %d %s\n", (long) entry->expires,
+                    entry->port, entry->key);
+        }
+    }
+    if (fclose(file) != 0 || rename(temporary, cache->path) != 0) {
+        unlink(temporary);
+    }
+    free(temporary);
+    cache->changed = false;
+}
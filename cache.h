@@ -0,0 +1,76 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <stdint.h>
+
+// seconds a cached port is trusted for unless told otherwise
+#define CACHE_DEFAULT_TTL 300
+
+// returned by cache_lookup for an id already being asked of the mapper
+#define CACHE_ASKING (-1)
+
+/** How a cached port came to be known. **/
+typedef enum CacheSource {
+    // read from the file, trusted until it expires
+    CACHE_LOADED,
+
+    // being asked of the mapper in this run, the port not yet known
+    CACHE_ASKED,
+
+    // given by the mapper in this run, trusted until the run ends
+    CACHE_LEARNT
+} CacheSource;
+
+/** A port learnt from the mapper. **/
+typedef struct CacheEntry {
+    // "mapper id", as the entry's line in the file ends
+    char* key;
+
+    // cached hash of key
+    uint64_t hash;
+
+    // port of the airport, 0 while it is being asked for
+    int port;
+
+    // time after which the port must be asked for again
+    time_t expires;
+
+    // how the port came to be known
+    CacheSource source;
+} CacheEntry;
+
+/** Ports a roc has learnt from the mapper, optionally kept in a file so
+ * that later runs can skip asking again.
+ */
+typedef struct RouteCache {
+    // open addressing index of entries by key, NULL when empty
+    CacheEntry** slots;
+
+    // number of slots, always zero or a power of two
+    size_t capacitySlots;
+
+    // every entry, expired ones included
+    CacheEntry** entries;
+    int countEntries;
+    int capacityEntries;
+
+    // file the cache is loaded from and saved to, NULL for none
+    char* path;
+
+    // seconds a newly learnt port is trusted for
+    int ttl;
+
+    // true if entries have changed since the cache was loaded
+    bool changed;
+} RouteCache;
+
+void init_route_cache(RouteCache* cache, char* path, int ttl);
+int cache_lookup(RouteCache* cache, int mapper, const char* id);
+void cache_store(RouteCache* cache, int mapper, const char* id, int port);
+void cache_ask(RouteCache* cache, int mapper, const char* id);
+bool cache_forget(RouteCache* cache, int mapper, const char* id);
+void save_route_cache(RouteCache* cache);
+
+#endif
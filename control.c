@@ -27,28 +27,37 @@ void check_control_args(int argc, char** argv) {
         }
     }
 
-    // invalid port
+    // invalid port in the list of mapper shards
     if (argc == 4) {
-        char* otherHalf;
-        int port = (int) strtol(argv[3], &otherHalf, 10);
-
-        if (strlen(otherHalf) != 0) {
-            control_exit(CTRL_INVALID_PORT);
-            return;
-        }
-
-        if (port <= 0 || port > 65535) {
+        MapperRing ring;
+        if (!parse_mapper_ring(&ring, argv[3])) {
             control_exit(CTRL_INVALID_PORT);
             return;
         }
+        free(ring.ports);
+        free(ring.points);
     }
 }
 
 /** Entry point to program. **/
 int main(int argc, char** argv) {
+    ServerOptions options;
+    int first = parse_server_options(argc, argv, &options);
+    if (first == -1 || options.stateDirectory != NULL ||
+            options.preloadPath != NULL) {
+        control_exit(CTRL_INCORRECT_NUM_ARGS);
+    }
+    // from here on arguments are as if no options were given
+    argc -= first - 1;
+    argv += first - 1;
+    
     check_control_args(argc, argv);
     ControlState* controlState = malloc(sizeof(ControlState));
-    controlState->countPlanes = 0;
+    init_plane_registry(&controlState->planes);
+    if (!plane_registry_retain(&controlState->planes, options.retainVisits,
+            options.spillPath, options.spillMax)) {
+        control_exit(CTRL_SPILL_ERROR);
+    }
 
     // set airport id
     controlState->airportId = (char*) malloc(sizeof(char) * 80);
@@ -58,15 +67,17 @@ int main(int argc, char** argv) {
     controlState->airportInfo = (char*) malloc(sizeof(char) * 80);
     controlState->airportInfo = argv[2];
 
-    // mapper port of -1 means none was given
-    controlState->mapperPort = -1;
+    // mapper shards of NULL means none were given
+    controlState->mappers = NULL;
 
-    // set mapper port if exists
+    // set mapper shards if given
     if (argc == 4) {
-        char* trash;
-        controlState->mapperPort = (int) strtol(argv[3], &trash, 10);
+        controlState->mappers = malloc(sizeof(MapperRing));
+        parse_mapper_ring(controlState->mappers, argv[3]);
+    }
+    if (!setup_sockets(0, controlState, &options)) {
+        control_exit(CTRL_LISTEN_ERROR);
     }
-    setup_sockets(0, controlState);
 
     return 0;
 }
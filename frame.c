@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "frame.h"
+
+/** Reads a 2 byte big endian field.
+ *
+ * @param data Field
+ * @return Value of the field
+ */
+uint16_t frame_u16(const char* data) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    return (uint16_t) (bytes[0] << 8 | bytes[1]);
+}
+
+/** Reads a 4 byte big endian field.
+ *
+ * @param data Field
+ * @return Value of the field
+ */
+uint32_t frame_u32(const char* data) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 |
+            (uint32_t) bytes[2] << 8 | (uint32_t) bytes[3];
+}
+
+/** Writes a 2 byte big endian field.
+ *
+ * @param data Where to write the field
+ * @param value Value of the field
+ */
+void frame_put_u16(char* data, uint16_t value) {
+    data[0] = (char) (value >> 8);
+    data[1] = (char) value;
+}
+
+/** Writes a 4 byte big endian field.
+ *
+ * @param data Where to write the field
+ * @param value Value of the field
+ */
+void frame_put_u32(char* data, uint32_t value) {
+    data[0] = (char) (value >> 24);
+    data[1] = (char) (value >> 16);
+    data[2] = (char) (value >> 8);
+    data[3] = (char) value;
+}
+
+/** Splits a frame's body into its fields. The payload is left in place.
+ *
+ * @param body Frame body, without its length
+ * @param length Number of bytes in body
+ * @param frame Where to store the fields
+ * @return false if the body is too short to hold a header
+ */
+bool parse_frame(char* body, size_t length, Frame* frame) {
+    if (length < FRAME_HEADER_BYTES) {
+        return false;
+    }
+    frame->requestId = frame_u32(body);
+    frame->code = (uint8_t) body[4];
+    frame->payload = body + FRAME_HEADER_BYTES;
+    frame->length = length - FRAME_HEADER_BYTES;
+    return true;
+}
+
+/** Encodes a frame's length and header.
+ *
+ * @param data Where to write them
+ * @param frame Frame whose length and header are written
+ */
+void encode_header(char* data, const Frame* frame) {
+    frame_put_u32(data, (uint32_t) (FRAME_HEADER_BYTES + frame->length));
+    frame_put_u32(data + FRAME_LENGTH_BYTES, frame->requestId);
+    data[FRAME_LENGTH_BYTES + 4] = (char) frame->code;
+}
+
+/** Starts a reply frame in an output buffer. Its payload is appended after
+ * and its length filled in by frame_end.
+ *
+ * @param output Buffer to write the reply to
+ * @param requestId Id of the request replied to
+ * @param code Status of the reply
+ * @return Offset of the frame in output
+ */
+size_t frame_begin(OutputBuffer* output, uint32_t requestId, uint8_t code) {
+    size_t start = output->length;
+    Frame frame = {requestId, code, NULL, 0};
+    char header[FRAME_LENGTH_BYTES + FRAME_HEADER_BYTES];
+    encode_header(header, &frame);
+    output_append(output, header, sizeof(header));
+    return start;
+}
+
+/** Finishes a reply frame by filling in its length.
+ *
+ * @param output Buffer holding the reply
+ * @param start Offset of the frame, as given by frame_begin
+ */
+void frame_end(OutputBuffer* output, size_t start) {
+    frame_put_u32(output->data + start,
+            (uint32_t) (output->length - start - FRAME_LENGTH_BYTES));
+}
+
+/** Encodes a whole frame, length included.
+ *
+ * @param data Where to write the frame, with room for its header and
+ *        payload
+ * @param frame Frame to encode
+ */
+void encode_frame(char* data, const Frame* frame) {
+    encode_header(data, frame);
+    memcpy(data + FRAME_LENGTH_BYTES + FRAME_HEADER_BYTES, frame->payload,
+            frame->length);
+}
+
+/** Writes a request frame to a stream.
+ *
+ * @param out Stream to the server
+ * @param frame Frame to write
+ * @return false if the frame could not be written
+ */
+bool write_frame(FILE* out, const Frame* frame) {
+    char header[FRAME_LENGTH_BYTES + FRAME_HEADER_BYTES];
+    encode_header(header, frame);
+    return fwrite(header, 1, sizeof(header), out) == sizeof(header) &&
+            fwrite(frame->payload, 1, frame->length, out) == frame->length;
+}
+
+/** Reads a reply frame from a stream.
+ *
+ * @param in Stream from the server
+ * @param frame Where to store the fields, its payload pointing into buffer
+ * @param buffer Buffer for the frame's body, grown as needed
+ * @param capacity Number of bytes buffer has room for
+ * @return false if the stream ended or the frame is malformed
+ */
+bool read_frame(FILE* in, Frame* frame, char** buffer, size_t* capacity) {
+    char prefix[FRAME_LENGTH_BYTES];
+    if (fread(prefix, 1, FRAME_LENGTH_BYTES, in) != FRAME_LENGTH_BYTES) {
+        return false;
+    }
+    size_t length = frame_u32(prefix);
+    if (length > INPUT_LINE_MAX) {
+        return false;
+    }
+    if (*capacity < length + 1) {
+        *capacity = length + 1;
+        *buffer = realloc(*buffer, *capacity);
+    }
+    if (fread(*buffer, 1, length, in) != length) {
+        return false;
+    }
+    (*buffer)[length] = '\0';
+    return parse_frame(*buffer, length, frame);
+}
+
+/** Asks the server on a new connection for frames and waits for it to
+ * agree. Only servers known to offer frames are asked, as one which does
+ * not never answers.
+ *
+ * @param fd Blocking socket connected to the server, nothing sent on it yet
+ * @return false if the server closed the connection or answered with
+ *         anything else
+ */
+bool request_frames(int fd) {
+    char handshake = (char) FRAME_HANDSHAKE;
+    if (send(fd, &handshake, 1, MSG_NOSIGNAL) != 1) {
+        return false;
+    }
+    char reply;
+    ssize_t got;
+    while ((got = recv(fd, &reply, 1, 0)) == -1 && errno == EINTR) {
+        // interrupted before the reply arrived, so wait again
+    }
+    return got == 1 && reply == handshake;
+}
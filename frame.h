@@ -0,0 +1,70 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "reactor.h"
+
+// bytes of the request id and code opening every frame body
+#define FRAME_HEADER_BYTES 5
+
+/** Commands a client may send in a frame. **/
+typedef enum FrameCommand {
+    // payload is a line of the text protocol; the reply's payload is what
+    // the line would have been answered with
+    FRAME_TEXT = 0,
+
+    // payload is an airport id; the reply's payload is its 2 byte port
+    FRAME_QUERY = 1,
+
+    // payload is a 2 byte port followed by an airport id; the reply has no
+    // payload
+    FRAME_REGISTER = 2,
+
+    // payload is a plane id; the reply's payload is control's info
+    FRAME_VISIT = 3
+} FrameCommand;
+
+/** Outcomes a server may reply with in a frame. **/
+typedef enum FrameStatus {
+    FRAME_OK = 0,
+
+    // no airport has the id queried
+    FRAME_NOT_FOUND = 1,
+
+    // the id or port given cannot be used, or the id is taken already
+    FRAME_REJECTED = 2,
+
+    // the command is not one the server handles
+    FRAME_UNKNOWN = 3
+} FrameStatus;
+
+/** A frame's body split into its fields. Every field is of fixed width and
+ * big endian.
+ */
+typedef struct Frame {
+    // id chosen by the client for a request and sent back in its reply
+    uint32_t requestId;
+
+    // FrameCommand of a request, FrameStatus of a reply
+    uint8_t code;
+
+    // bytes after the header, null terminated when read from a connection
+    char* payload;
+    size_t length;
+} Frame;
+
+uint16_t frame_u16(const char* data);
+uint32_t frame_u32(const char* data);
+void frame_put_u16(char* data, uint16_t value);
+bool parse_frame(char* body, size_t length, Frame* frame);
+size_t frame_begin(OutputBuffer* output, uint32_t requestId, uint8_t code);
+void frame_end(OutputBuffer* output, size_t start);
+bool write_frame(FILE* out, const Frame* frame);
+bool read_frame(FILE* in, Frame* frame, char** buffer, size_t* capacity);
+void encode_frame(char* data, const Frame* frame);
+bool request_frames(int fd);
+
+#endif
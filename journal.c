@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "networking.h"
+
+/** Builds the path of a file in the state directory.
+ *
+ * @param journal Journal whose directory holds the file
+ * @param name "snapshot", "snapshot.tmp" or "journal"
+ * @param generation Generation of a journal, ignored for snapshots
+ * @param path Buffer of JOURNAL_PATH_MAX characters to write the path to
+ */
+void journal_path(const Journal* journal, const char* name,
+        uint64_t generation, char* path) {
+    if (strcmp(name, "journal") == 0) {
+        snprintf(path, JOURNAL_PATH_MAX, "%s/journal.%" PRIu64,
+                journal->directory, generation);
+    } else {
+        snprintf(path, JOURNAL_PATH_MAX, "%s/%s", journal->directory, name);
+    }
+}
+
+/** Checks that a mapped file starts with a snapshot header matching its
+ * size.
+ *
+ * @param map Mapped file
+ * @param size Number of bytes in map
+ * @param header Where to copy the header
+ * @return false if the file is not a whole snapshot
+ */
+bool read_snapshot_header(const char* map, size_t size,
+        SnapshotHeader* header) {
+    if (size < sizeof(SnapshotHeader)) {
+        return false;
+    }
+    memcpy(header, map, sizeof(SnapshotHeader));
+    return memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0
+            && header->length == size - sizeof(SnapshotHeader) &&
+            header->count <= header->length / (2 * sizeof(uint32_t) + 1);
+}
+
+/** Reads one airport record of a mapped snapshot.
+ *
+ * @param map Mapped snapshot
+ * @param size Number of bytes in map
+ * @param offset Offset of the record, moved past it
+ * @param port Set to the airport's port
+ * @param length Set to the number of characters in the airport's id
+ * @return Airport's id, pointing into map, or NULL if the record runs
+ *         past the end of the snapshot
+ */
+char* read_snapshot_record(char* map, size_t size, size_t* offset,
+        int* port, size_t* length) {
+    uint32_t fields[2];
+    if (size - *offset < sizeof(fields)) {
+        return NULL;
+    }
+    memcpy(fields, map + *offset, sizeof(fields));
+    size_t start = *offset + sizeof(fields);
+    if (size - start <= fields[1] || map[start + fields[1]] != '\0') {
+        return NULL;
+    }
+    *port = (int) fields[0];
+    *length = fields[1];
+    *offset = start + fields[1] + 1;
+    return map + start;
+}
+
+/** Loads the snapshot into an empty world state. The snapshot stays mapped
+ * for good, as the restored ids point into it.
+ *
+ * @param journal Journal whose snapshot is loaded; its snapshot
+ *        generation is set
+ * @param worldState Empty mapper program state
+ * @return false if the snapshot exists but cannot be read
+ */
+bool restore_snapshot(Journal* journal, WorldState* worldState) {
+    char path[JOURNAL_PATH_MAX];
+    journal_path(journal, "snapshot", 0, path);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        // no snapshot has been written yet
+        journal->snapshotGeneration = 0;
+        return errno == ENOENT;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == -1 ||
+            (size_t) status.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t) status.st_size;
+    char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    SnapshotHeader header;
+    if (!read_snapshot_header(map, size, &header)) {
+        munmap(map, size);
+        return false;
+    }
+
+    // every airport of the snapshot lives in one block
+    size_t count = (size_t) header.count;
+    Airport* block = malloc(sizeof(Airport) * (count == 0 ? 1 : count));
+    Airport** airports = malloc(sizeof(Airport*) * (count == 0 ? 1 : count));
+    airport_table_reserve(&worldState->table, count);
+    size_t offset = sizeof(SnapshotHeader);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        Airport* airport = &block[i];
+        size_t length;
+        airport->id = read_snapshot_record(map, size, &offset,
+                &airport->port, &length);
+        if (airport->id == NULL) {
+            break;
+        }
+        airport->info = NULL;
+        airport->hash = hash_id(airport->id, length);
+
+        // the ordered index is built assuming strictly increasing ids
+        if (i > 0 && strcmp(airports[i - 1]->id, airport->id) >= 0) {
+            break;
+        }
+        airports[i] = airport;
+        airport_table_insert(&worldState->table, airport);
+    }
+    if (i != count || offset != size) {
+        // a record ran past the end or out of order, or bytes were left
+        free(block);
+        free(airports);
+        init_world_state(worldState);
+        munmap(map, size);
+        return false;
+    }
+    airport_list_build(&worldState->ordered, airports, count);
+
+    worldState->airports = airports;
+    worldState->countAirports = (int) count;
+    worldState->capacityAirports = (int) (count == 0 ? 1 : count);
+    worldState->restored = (int) count;
+    journal->snapshotGeneration = header.generation;
+    journal->covered = count;
+    return true;
+}
+
+/** Registers the airports listed in a journal which are not yet known.
+ *
+ * @param fd Journal open for reading
+ * @param worldState Mapper program state
+ * @param validLength Set to the number of bytes up to the end of the last
+ *        complete line, beyond which a write was cut short
+ * @return false if the journal cannot be read
+ */
+bool replay_journal(int fd, WorldState* worldState, size_t* validLength) {
+    struct stat status;
+    if (fstat(fd, &status) == -1) {
+        return false;
+    }
+    size_t size = (size_t) status.st_size;
+    char* data = malloc(size + 1);
+    size_t got = 0;
+    while (got < size) {
+        ssize_t count = read(fd, data + got, size - got);
+        if (count <= 0) {
+            free(data);
+            return false;
+        }
+        got += (size_t) count;
+    }
+
+    size_t start = 0;
+    char* newline;
+    while ((newline = memchr(data + start, '\n', size - start)) != NULL) {
+        *newline = '\0';
+        char* line = data + start;
+        char* colonLocation = strchr(line, ':');
+        if (colonLocation != NULL) {
+            *colonLocation = '\0';
+            if (get_airport(worldState, line) == NULL) {
+                add_airport(line, atoi(colonLocation + 1), worldState);
+            }
+        }
+        start = (size_t) (newline - data) + 1;
+    }
+    free(data);
+    *validLength = start;
+    return true;
+}
+
+/** Restores the mapper's airports from the state directory and opens the
+ * latest journal for further registrations.
+ *
+ * @param journal Journal to open
+ * @param directory State directory, created if missing
+ * @param worldState Empty mapper program state
+ * @return false if the state cannot be restored
+ */
+bool open_journal(Journal* journal, const char* directory,
+        WorldState* worldState) {
+    journal->directory = malloc(strlen(directory) + 1);
+    strcpy(journal->directory, directory);
+    journal->fd = -1;
+    journal->covered = 0;
+    journal->writing = false;
+    if (mkdir(directory, 0777) == -1 && errno != EEXIST) {
+        return false;
+    }
+    if (!restore_snapshot(journal, worldState)) {
+        return false;
+    }
+
+    // drop journals left behind by a snapshot which replaced them
+    char path[JOURNAL_PATH_MAX];
+    for (uint64_t i = journal->snapshotGeneration; i > 0; --i) {
+        journal_path(journal, "journal", i - 1, path);
+        if (unlink(path) == -1) {
+            break;
+        }
+    }
+
+    // replay journals in order, the last of which is appended to
+    uint64_t generation = journal->snapshotGeneration;
+    size_t validLength = 0;
+    while (true) {
+        journal_path(journal, "journal", generation, path);
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            break;
+        }
+        bool replayed = replay_journal(fd, worldState, &validLength);
+        close(fd);
+        if (!replayed) {
+            return false;
+        }
+        generation++;
+    }
+    if (generation > journal->snapshotGeneration) {
+        generation--;
+    }
+    journal->generation = generation;
+
+    journal_path(journal, "journal", generation, path);
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+            0666);
+    if (journal->fd == -1) {
+        return false;
+    }
+    // drop a line cut short by a crash so later lines start cleanly
+    return ftruncate(journal->fd, (off_t) validLength) == 0;
+}
+
+/** Writes a snapshot in the background, then retires the journals it
+ * replaces.
+ *
+ * @param arg SnapshotJob to carry out, freed once done
+ * @return NULL
+ */
+void* write_snapshot(void* arg) {
+    SnapshotJob* job = (SnapshotJob*) arg;
+    Journal* journal = job->journal;
+    char temporary[JOURNAL_PATH_MAX];
+    char path[JOURNAL_PATH_MAX];
+    journal_path(journal, "snapshot.tmp", 0, temporary);
+    journal_path(journal, "snapshot", 0, path);
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.generation = job->generation;
+    header.count = job->count;
+    header.length = 0;
+    for (size_t i = 0; i < job->count; ++i) {
+        header.length += 2 * sizeof(uint32_t) +
+                strlen(job->airports[i]->id) + 1;
+    }
+
+    bool written = false;
+    FILE* file = fopen(temporary, "w");
+    if (file != NULL) {
+        fwrite(&header, sizeof(SnapshotHeader), 1, file);
+        for (size_t i = 0; i < job->count; ++i) {
+            const Airport* airport = job->airports[i];
+            size_t length = strlen(airport->id);
+            uint32_t fields[2] = {(uint32_t) airport->port,
+                    (uint32_t) length};
+            fwrite(fields, sizeof(fields), 1, file);
+            fwrite(airport->id, 1, length + 1, file);
+        }
+        written = fflush(file) == 0 && !ferror(file) &&
+                fsync(fileno(file)) == 0;
+        written = fclose(file) == 0 && written;
+    }
+
+    // the snapshot only takes over once it is wholly on disk
+    if (written && rename(temporary, path) == 0) {
+        int directory = open(journal->directory, O_RDONLY);
+        if (directory != -1) {
+            fsync(directory);
+            close(directory);
+        }
+        for (uint64_t i = journal->snapshotGeneration; i < job->generation;
+                ++i) {
+            journal_path(journal, "journal", i, path);
+            unlink(path);
+        }
+        journal->snapshotGeneration = job->generation;
+    } else {
+        unlink(temporary);
+        fprintf(stderr, "Failed to write snapshot\n");
+    }
+
+    free(job->airports);
+    free(job);
+    __atomic_store_n(&journal->writing, false, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/** Starts a new journal and collects every airport registered before it
+ * for a snapshot. Called with the state lock held.
+ *
+ * @param journal Journal to compact
+ * @param worldState Mapper program state
+ * @return Snapshot to write, or NULL if the new journal could not be made
+ */
+SnapshotJob* collect_snapshot(Journal* journal, WorldState* worldState) {
+    char path[JOURNAL_PATH_MAX];
+    journal_path(journal, "journal", journal->generation + 1, path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+            0666);
+    if (fd == -1) {
+        return NULL;
+    }
+    close(journal->fd);
+    journal->fd = fd;
+    journal->generation++;
+
+    // airports are never changed or freed, so the thread may read them
+    // without the lock
+    SnapshotJob* job = malloc(sizeof(SnapshotJob));
+    job->journal = journal;
+    job->count = worldState->ordered.count;
+    job->generation = journal->generation;
+    job->airports = malloc(sizeof(Airport*) * (job->count + 1));
+    size_t i = 0;
+    for (AirportNode* node = worldState->ordered.head->next[0]; node != NULL;
+            node = node->next[0]) {
+        job->airports[i++] = node->airport;
+    }
+    journal->covered = job->count;
+    __atomic_store_n(&journal->writing, true, __ATOMIC_RELEASE);
+    return job;
+}
+
+/** Starts a new journal and has a background thread write a snapshot of
+ * every airport registered before it. Called with the state lock held;
+ * only collecting the airports happens under it.
+ *
+ * @param journal Journal to compact
+ * @param worldState Mapper program state
+ */
+void start_snapshot(Journal* journal, WorldState* worldState) {
+    SnapshotJob* job = collect_snapshot(journal, worldState);
+    if (job == NULL) {
+        return;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, write_snapshot, job) != 0) {
+        free(job->airports);
+        free(job);
+        __atomic_store_n(&journal->writing, false, __ATOMIC_RELEASE);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+/** Starts a new journal and writes a snapshot of every airport registered
+ * before it, returning once the snapshot is on disk.
+ *
+ * @param journal Journal to compact
+ * @param worldState Mapper program state
+ * @return false if the snapshot could not be written, so the airports are
+ *         kept nowhere
+ */
+bool take_snapshot(Journal* journal, WorldState* worldState) {
+    SnapshotJob* job = collect_snapshot(journal, worldState);
+    if (job == NULL) {
+        return false;
+    }
+    uint64_t generation = job->generation;
+    write_snapshot(job);
+    return journal->snapshotGeneration == generation;
+}
+
+/** Records a newly added airport in the journal, and starts a snapshot once
+ * the journals since the last one have grown long. Called with the state
+ * lock held, so that entries are written in the order they were added.
+ *
+ * @param journal Journal to append to
+ * @param worldState Mapper program state holding airport
+ * @param airport Airport just added
+ */
+void journal_append(Journal* journal, WorldState* worldState,
+        const Airport* airport) {
+    char port[PORT_MAX_CHARS + 2];
+    int portLength = snprintf(port, sizeof(port), ":%d\n", airport->port);
+    struct iovec parts[2] = {
+        {airport->id, strlen(airport->id)},
+        {port, (size_t) portLength}
+    };
+    // the write completes the line in one go under O_APPEND, and a line
+    // cut short by a crash is dropped when the journal is next opened
+    ssize_t length = (ssize_t) (parts[0].iov_len + parts[1].iov_len);
+    if (writev(journal->fd, parts, 2) != length) {
+        fprintf(stderr, "Failed to write journal\n");
+    }
+
+    // snapshot once the journals hold half as many entries as the last
+    // snapshot, so each airport is rewritten a bounded number of times
+    size_t pending = (size_t) worldState->countAirports - journal->covered;
+    size_t threshold = journal->covered / 2;
+    if (threshold < JOURNAL_MIN_ENTRIES) {
+        threshold = JOURNAL_MIN_ENTRIES;
+    }
+    if (pending >= threshold &&
+            !__atomic_load_n(&journal->writing, __ATOMIC_ACQUIRE)) {
+        start_snapshot(journal, worldState);
+    }
+}
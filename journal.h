@@ -0,0 +1,92 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "airports.h"
+
+// journal entries beyond which a snapshot is always worth writing
+#define JOURNAL_MIN_ENTRIES 65536
+
+// longest path of a file in the state directory
+#define JOURNAL_PATH_MAX 4096
+
+// first bytes of a snapshot file
+#define SNAPSHOT_MAGIC "MAPSNAP1"
+
+struct WorldState;
+
+/** Start of a snapshot file. It is followed by one record per airport in
+ * id order, each being the port and id length as 32 bit numbers and then
+ * the id with its '\0', so that restored ids can point into the mapped
+ * file.
+ */
+typedef struct SnapshotHeader {
+    // SNAPSHOT_MAGIC without its '\0'
+    char magic[8];
+
+    // generation of the journal which follows the snapshot
+    uint64_t generation;
+
+    // number of airports
+    uint64_t count;
+
+    // number of bytes of records after the header
+    uint64_t length;
+} SnapshotHeader;
+
+/** Durable record of a mapper's registrations. The state directory holds
+ * a snapshot of every airport up to some generation, and one journal per
+ * generation from there on listing later registrations as "id:port" lines.
+ */
+typedef struct Journal {
+    // directory holding the snapshot and journals
+    char* directory;
+
+    // journal currently appended to
+    int fd;
+
+    // generation of the journal currently appended to
+    uint64_t generation;
+
+    // generation of the snapshot on disk, whose journals are still kept
+    uint64_t snapshotGeneration;
+
+    // number of airports covered by the snapshot being written or last
+    // written
+    size_t covered;
+
+    // true while a snapshot is being written, updated atomically
+    bool writing;
+} Journal;
+
+/** Airports to be written to a snapshot by a background thread. **/
+typedef struct SnapshotJob {
+    // journal the snapshot belongs to
+    Journal* journal;
+
+    // airports in id order
+    Airport** airports;
+
+    // number of airports
+    size_t count;
+
+    // generation of the snapshot, whose journal starts empty
+    uint64_t generation;
+} SnapshotJob;
+
+bool open_journal(Journal* journal, const char* directory,
+        struct WorldState* worldState);
+void journal_append(Journal* journal, struct WorldState* worldState,
+        const Airport* airport);
+SnapshotJob* collect_snapshot(Journal* journal,
+        struct WorldState* worldState);
+void start_snapshot(Journal* journal, struct WorldState* worldState);
+bool take_snapshot(Journal* journal, struct WorldState* worldState);
+bool read_snapshot_header(const char* map, size_t size,
+        SnapshotHeader* header);
+char* read_snapshot_record(char* map, size_t size, size_t* offset,
+        int* port, size_t* length);
+
+#endif
@@ -3,8 +3,37 @@
 
 /** Entry point to program. **/
 int main(int argc, char** argv) {
+    ServerOptions options;
+    if (parse_server_options(argc, argv, &options) != argc ||
+            options.retainVisits != 0 || options.spillPath != NULL ||
+            options.spillMax != 0 ||
+            options.framed) {
+        fprintf(stderr, "Usage: mapper2310 [-i idle] [-c connections] "
+                "[-t threads] [-d directory] [-u directory] [-p file]\n");
+        return 1;
+    }
     WorldState* worldState = malloc(sizeof(WorldState));
-    worldState->countAirports = 0;
-    setup_sockets(worldState, 0);
+    init_world_state(worldState);
+    
+    // restore registrations kept from earlier runs
+    if (options.stateDirectory != NULL) {
+        worldState->journal = malloc(sizeof(Journal));
+        if (!open_journal(worldState->journal, options.stateDirectory,
+                worldState)) {
+            fprintf(stderr, "Can not restore state\n");
+            return 2;
+        }
+    }
+    
+    // the port is only given out once the preloaded index is built
+    if (options.preloadPath != NULL &&
+            !preload_mappings(worldState, options.preloadPath)) {
+        fprintf(stderr, "Can not preload mappings\n");
+        return 3;
+    }
+    if (!setup_sockets(worldState, 0, &options)) {
+        fprintf(stderr, "Can not listen\n");
+        return 4;
+    }
     return 0;
 }
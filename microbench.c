@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include "mapper.h"
+
+// characters in each generated id, and the room each takes in the id block
+#define ID_LENGTH 12
+#define ID_STRIDE (ID_LENGTH + 1)
+
+// fewest entries measured; each size after is ten times the last
+#define MICRO_MIN_ENTRIES 1000
+
+// number of allocations made by the program, counted by the wrappers below
+long countAllocations = 0;
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* data, size_t size);
+
+/** Counts an allocation and passes it on to the C library. **/
+void* malloc(size_t size) {
+    countAllocations++;
+    return __libc_malloc(size);
+}
+
+/** Counts an allocation and passes it on to the C library. **/
+void* calloc(size_t count, size_t size) {
+    countAllocations++;
+    return __libc_calloc(count, size);
+}
+
+/** Counts an allocation and passes it on to the C library. **/
+void* realloc(void* data, size_t size) {
+    countAllocations++;
+    return __libc_realloc(data, size);
+}
+
+/** Generates ids, either at random or already in id order.
+ *
+ * @param count Number of ids
+ * @param sorted True for ids in ascending order
+ * @return Block of count null terminated ids, ID_STRIDE apart
+ */
+char* generate_ids(long count, bool sorted) {
+    const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    char* ids = malloc((size_t) count * ID_STRIDE);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (long i = 0; i < count; ++i) {
+        char* id = ids + i * ID_STRIDE;
+        if (sorted) {
+            // "a" then i in decimal, zero padded
+            id[0] = 'a';
+            long value = i;
+            for (int j = ID_LENGTH - 1; j > 0; --j) {
+                id[j] = (char) ('0' + value % 10);
+                value /= 10;
+            }
+            id[ID_LENGTH] = '\0';
+            continue;
+        }
+        for (int j = 0; j < ID_LENGTH; ++j) {
+            // xorshift64
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            id[j] = alphabet[state % (sizeof(alphabet) - 1)];
+        }
+        id[ID_LENGTH] = '\0';
+    }
+    return ids;
+}
+
+/** Picks the entry looked up by the n-th lookup: entries in turn for
+ * sorted ids, scattered over all of them for random ones.
+ *
+ * @param n Number of the lookup
+ * @param count Number of entries
+ * @param sorted True if the ids are sorted
+ * @return Index of the entry
+ */
+long lookup_index(long n, long count, bool sorted) {
+    if (sorted) {
+        return n % count;
+    }
+    return (long) (((uint64_t) n * 2654435761ULL) % (uint64_t) count);
+}
+
+/** Prints one measurement as a line of name=value fields.
+ *
+ * @param op Operation measured
+ * @param sorted True if the ids were sorted
+ * @param entries Number of entries held
+ * @param ops Number of operations timed
+ * @param elapsedNs Time they took
+ * @param allocations Allocations they made
+ */
+void print_measurement(const char* op, bool sorted, long entries, long ops,
+        long elapsedNs, long allocations) {
+    printf("op=%s order=%s entries=%ld ops=%ld ns_per_op=%.1f "
+            "allocs_per_op=%.2f\n", op, sorted ? "sorted" : "random",
+            entries, ops, (double) elapsedNs / ops,
+            (double) allocations / ops);
+    fflush(stdout);
+}
+
+/** Times the mapper's operations on a world of the given size: building
+ * it with add_mapping, then get_airport and do_mapper_query lookups, then
+ * print_mappings into /dev/null.
+ *
+ * @param ids Ids of the entries
+ * @param count Number of entries
+ * @param sorted True if the ids are sorted
+ * @param lookups Number of lookups to time
+ */
+void measure_mapper(char* ids, long count, bool sorted, long lookups) {
+    WorldState* worldState = malloc(sizeof(WorldState));
+    init_world_state(worldState);
+    OutputBuffer output;
+    memset(&output, 0, sizeof(OutputBuffer));
+    char line[ID_STRIDE + PORT_MAX_CHARS + 2];
+
+    long allocations = countAllocations;
+    long start = now_ns();
+    for (long i = 0; i < count; ++i) {
+        // add_mapping splits its input in place, so each needs a fresh line
+        line[0] = '!';
+        memcpy(line + 1, ids + i * ID_STRIDE, ID_LENGTH);
+        memcpy(line + 1 + ID_LENGTH, ":2310", sizeof(":2310"));
+        add_mapping(line, worldState);
+    }
+    print_measurement("add_mapping", sorted, count, count, now_ns() - start,
+            countAllocations - allocations);
+
+    allocations = countAllocations;
+    start = now_ns();
+    for (long i = 0; i < lookups; ++i) {
+        char* id = ids + lookup_index(i, count, sorted) * ID_STRIDE;
+        get_airport(worldState, id);
+    }
+    print_measurement("get_airport", sorted, count, lookups,
+            now_ns() - start, countAllocations - allocations);
+
+    allocations = countAllocations;
+    start = now_ns();
+    for (long i = 0; i < lookups; ++i) {
+        line[0] = '?';
+        memcpy(line + 1, ids + lookup_index(i, count, sorted) * ID_STRIDE,
+                ID_STRIDE);
+        do_mapper_query(line, worldState, &output);
+        output.length = 0;
+    }
+    print_measurement("do_mapper_query", sorted, count, lookups,
+            now_ns() - start, countAllocations - allocations);
+
+    // dump at least once, and as often as the lookups for small worlds
+    int sink = open("/dev/null", O_WRONLY);
+    long dumps = lookups / count > 0 ? lookups / count : 1;
+    allocations = countAllocations;
+    start = now_ns();
+    for (long i = 0; i < dumps; ++i) {
+        print_mappings(worldState, &output);
+        output_send(&output, sink);
+    }
+    print_measurement("print_mappings", sorted, count, dumps,
+            now_ns() - start, countAllocations - allocations);
+    close(sink);
+}
+
+/** Times control's handling of visits, lock and reply included, for as
+ * many distinct planes as there are entries.
+ *
+ * @param ids Ids of the planes
+ * @param count Number of planes
+ * @param sorted True if the ids are sorted
+ */
+void measure_control(char* ids, long count, bool sorted) {
+    ControlState* controlState = malloc(sizeof(ControlState));
+    init_plane_registry(&controlState->planes);
+    controlState->mappers = NULL;
+    controlState->airportId = "micro";
+    controlState->airportInfo = "info";
+    Server* server = calloc(1, sizeof(Server));
+    server->controlState = controlState;
+    init_lock(&server->lock);
+    server->stats = calloc(1, sizeof(ServerStats));
+    OutputBuffer output;
+    memset(&output, 0, sizeof(OutputBuffer));
+
+    long allocations = countAllocations;
+    long start = now_ns();
+    for (long i = 0; i < count; ++i) {
+        check_control_string(ids + i * ID_STRIDE, server, &output);
+        output.length = 0;
+    }
+    print_measurement("control_visit", sorted, count, count,
+            now_ns() - start, countAllocations - allocations);
+}
+
+/** Runs one set of measurements in a process of its own, so that each
+ * starts from a fresh heap and the memory of large sizes is given back.
+ *
+ * @param count Number of entries
+ * @param sorted True for sorted ids
+ * @param control True to measure control rather than the mapper
+ * @param lookups Number of lookups to time
+ * @return false if the measurements could not be made
+ */
+bool run_measurement(long count, bool sorted, bool control, long lookups) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        char* ids = generate_ids(count, sorted);
+        if (control) {
+            measure_control(ids, count, sorted);
+        } else {
+            measure_mapper(ids, count, sorted, lookups);
+        }
+        _exit(0);
+    }
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s entries=%ld order=%s failed\n",
+                control ? "control" : "mapper", count,
+                sorted ? "sorted" : "random");
+        return false;
+    }
+    return true;
+}
+
+/** Parses the microbenchmark's options.
+ *
+ * @param argc Program argument count
+ * @param argv Program arguments
+ * @param maxEntries Set to the most entries measured
+ * @param lookups Set to the number of lookups timed at each size
+ * @return false if the options are invalid or arguments follow them
+ * @options
+ *    -n count - most entries measured, from 1000 up by tens
+ *    -o count - number of lookups timed at each size
+ */
+bool parse_micro_options(int argc, char** argv, long* maxEntries,
+        long* lookups) {
+    *maxEntries = 10000000;
+    *lookups = 1000000;
+    opterr = 0;
+    int option;
+    while ((option = getopt(argc, argv, "n:o:")) != -1) {
+        if (option != 'n' && option != 'o') {
+            return false;
+        }
+        char* rest;
+        long value = strtol(optarg, &rest, 10);
+        if (strlen(rest) != 0 || strlen(optarg) == 0 || value <= 0 ||
+                value > 1L << 30) {
+            return false;
+        }
+        if (option == 'n') {
+            *maxEntries = value;
+        } else {
+            *lookups = value;
+        }
+    }
+    return optind == argc && *maxEntries >= MICRO_MIN_ENTRIES;
+}
+
+/** Entry point to the microbenchmark. Each measurement is printed as a
+ * line of name=value fields.
+ * @exit
+ *   1 - Invalid options
+ *   2 - A measurement failed
+ */
+int main(int argc, char** argv) {
+    long maxEntries;
+    long lookups;
+    if (!parse_micro_options(argc, argv, &maxEntries, &lookups)) {
+        fprintf(stderr, "Usage: microbench2310 [-n entries] [-o lookups]\n");
+        return 1;
+    }
+    bool succeeded = true;
+    for (long count = MICRO_MIN_ENTRIES; count <= maxEntries; count *= 10) {
+        for (int sorted = 0; sorted < 2; ++sorted) {
+            succeeded = run_measurement(count, sorted, false, lookups) &&
+                    succeeded;
+            succeeded = run_measurement(count, sorted, true, lookups) &&
+                    succeeded;
+        }
+    }
+    return succeeded ? 0 : 2;
+}
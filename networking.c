@@ -1,28 +1,97 @@
+#define _GNU_SOURCE
+#include <sys/un.h>
 #include "networking.h"
 
+// how this program connects to the others
+Transport transport = {
+    .socketDirectory = NULL,
+    .resolved = PTHREAD_ONCE_INIT
+};
 
-/** Initializes semaphore.
+
+/** Initializes reader/writer lock. Waiting writers are served before new
+ * readers so that a stream of queries cannot starve registrations.
+ *
+ * @param l Lock
+ */
+void init_lock(pthread_rwlock_t* l) {
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    pthread_rwlockattr_setkind_np(&attributes,
+            PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(l, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+}
+
+/** Takes exclusive control of lock. The clock is only read if the lock
+ * is taken already.
+ *
+ * @param l Lock
+ * @return Time spent waiting for the lock in ns
+ */
+long take_lock(pthread_rwlock_t* l) {
+    if (pthread_rwlock_trywrlock(l) == 0) {
+        return 0;
+    }
+    long start = now_ns();
+    pthread_rwlock_wrlock(l);
+    return now_ns() - start;
+}
+
+/** Reads the clock as a command starts, if the command is one of those
+ * timed.
+ *
+ * @return Time in ns, or 0 if the command is not timed
+ */
+long start_command(void) {
+    return sample_command() ? now_ns() : 0;
+}
+
+/** Finds the time a command took, if it was timed.
+ *
+ * @param start Time given by start_command
+ * @return Time taken in ns, or -1 if the command is not timed
+ */
+long command_latency(long start) {
+    return start == 0 ? -1 : now_ns() - start;
+}
+
+/** Takes shared control of lock, for use by code which only reads.
  *
- * @param l Semaphore
+ * @param l Lock
+ * @return Time spent waiting for the lock in ns
  */
-void init_lock(sem_t* l) {
-    sem_init(l, 0, 1);
+long take_read_lock(pthread_rwlock_t* l) {
+    if (pthread_rwlock_tryrdlock(l) == 0) {
+        return 0;
+    }
+    long start = now_ns();
+    pthread_rwlock_rdlock(l);
+    return now_ns() - start;
 }
 
-/** Takes control of semaphore.
+/** Unlocks lock.
  *
- * @param l Semaphore
+ * @param l Lock
  */
-void take_lock(sem_t* l) {
-    sem_wait(l);
+void release_lock(pthread_rwlock_t* l) {
+    pthread_rwlock_unlock(l);
 }
 
-/** Unlocks semaphore.
+/** Initializes an empty mapper or roc program state.
  *
- * @param l Semaphore
+ * @param worldState Program state to initialize
  */
-void release_lock(sem_t* l) {
-    sem_post(l);
+void init_world_state(WorldState* worldState) {
+    worldState->airports = NULL;
+    worldState->countAirports = 0;
+    worldState->capacityAirports = 0;
+    worldState->restored = 0;
+    worldState->epoch = 0;
+    init_airport_table(&worldState->table);
+    init_airport_list(&worldState->ordered);
+    worldState->journal = NULL;
+    worldState->watchers = NULL;
 }
 
 /** Dynamically allocates airports.
@@ -30,14 +99,15 @@ void release_lock(sem_t* l) {
  * @param worldState Mapper program state
  */
 void allocate_airports(WorldState* worldState) {
-    if (worldState->countAirports == 0) {
-        worldState->airports = malloc(sizeof(Airport*));
-        worldState->airports[0] = malloc(sizeof(Airport));
-    } else {
+    // grow geometrically so that adding n airports costs O(n) copying
+    if (worldState->countAirports == worldState->capacityAirports) {
+        int capacity = worldState->capacityAirports == 0 ? 8 :
+                worldState->capacityAirports * 2;
         worldState->airports = realloc(worldState->airports,
-                sizeof(Airport*) * (worldState->countAirports + 1));
-        worldState->airports[worldState->countAirports] = malloc(
+                sizeof(Airport*) * capacity);
+        worldState->capacityAirports = capacity;
     }
+    worldState->airports[worldState->countAirports] = malloc(sizeof(Airport));
 }
 
 /** Adds an Airport identified by id and port.
@@ -50,10 +120,15 @@ void add_airport(char* id, int port, WorldState* worldState) {
     // reallocate airport array
     allocate_airports(worldState);
     
-    worldState->airports[worldState->countAirports]->port = port;
-    worldState->airports[worldState->countAirports]->id = (char *) malloc(
-            sizeof(char) * strlen(id) + 1);
-    strcpy(worldState->airports[worldState->countAirports]->id, id);
+    Airport* airport = worldState->airports[worldState->countAirports];
+    airport->port = port;
+    airport->id = (char *) malloc(sizeof(char) * strlen(id) + 1);
+    strcpy(airport->id, id);
+    airport->hash = hash_id(id, strlen(id));
+    
+    // the indexes refer to the airport's copy of id
+    airport_table_insert(&worldState->table, airport);
+    airport_list_insert(&worldState->ordered, airport);
     
     worldState->countAirports++;
 }
@@ -62,18 +137,46 @@ void add_airport(char* id, int port, WorldState* worldState) {
  *
  * @param worldState The mapper program state
  * @param id The id of the airport to be searched for
- * @return Pointer to airport known by id
+ * @return Pointer to airport known by id, or NULL if there is none
  */
 Airport* get_airport(WorldState* worldState, char* id) {
-    for (int i = 0; i < worldState->countAirports; ++i) {
-        if (strcmp(worldState->airports[i]->id, id) == 0) {
-            return worldState->airports[i];
-        }
+    return find_mapping(worldState, id, strlen(id));
+}
+
+/** Finds the airport an id given in a query names. Queries in lines and
+ * in frames both come through here.
+ *
+ * @param worldState The mapper program state
+ * @param id Airport id, need not be null terminated
+ * @param length Number of characters in id
+ * @return Pointer to airport known by id, or NULL if there is none, as
+ *         for an id holding '\0', which no airport's can
+ */
+Airport* find_mapping(WorldState* worldState, const char* id,
+        size_t length) {
+    if (memchr(id, '\0', length) != NULL) {
+        return NULL;
     }
+    return airport_table_find(&worldState->table, id, length,
+            hash_id(id, length));
+}
 
-    
-    // if we get here, there is no airport with given id
-    return 0;
+/** Checks a mapping as a registration would, whether it came in a line, a
+ * frame or a preload file.
+ *
+ * @param id Airport id, need not be null terminated
+ * @param length Number of characters in id
+ * @param port Airport port
+ * @return false if id holds ':', '\n' or '\0', which a line could not
+ *         carry in an id, or port is not a strictly positive number < 65536
+ */
+bool valid_mapping(const char* id, size_t length, int port) {
+    for (size_t i = 0; i < length; ++i) {
+        if (id[i] == ':' || id[i] == '\n' || id[i] == '\0') {
+            return false;
+        }
+    }
+    return port > 0 && port <= 65535;
 }
 
 /** Exits control program with given error code.
@@ -84,6 +187,7 @@ Airport* get_airport(WorldState* worldState, char* id) {
  *   2 - Invalid characters in ID or info
  *   3 - Port specified but not a strictly positive number < 65536
  *   4 - Could not conenct to mapper
+ *   5 - Could not create the spill file
  */
 void control_exit(ControlErrorCodes errorCode) {
     switch (errorCode) {
@@ -99,6 +203,12 @@ void control_exit(ControlErrorCodes errorCode) {
         case CTRL_MAP_CONNECTION_ERROR:
             fprintf(stderr, "Can not connect to map");
             break;
+        case CTRL_SPILL_ERROR:
+            fprintf(stderr, "Can not create spill file");
+            break;
+        case CTRL_LISTEN_ERROR:
+            fprintf(stderr, "Can not listen");
+            break;
     }
     
     fprintf(stderr, "\n");
@@ -148,266 +258,757 @@ void roc_exit(RocErrorCodes errorCode) {
     exit(errorCode);
 }
 
-/** Lexicographical qsort comparison func.
+/** Prints names and their corresponding ports in lexicographical order.
  *
- * @param a Airport one
- * @param b Airpor two
- * @return < 1 if Airport one goes before Airport two, 0 if equal, else > 1
+ * @param worldState The mapper program state
+ * @param output Buffer to write replies to
  */
-int cmp_func(const void* a, const void* b) {
-    Airport* first = *(Airport**) a;
-    Airport* second = *(Airport**) b;
-    
-    return strcmp(first->id, second->id);
+void print_mappings(WorldState* worldState, OutputBuffer* output) {
+    print_prefix_mappings(worldState, "", output);
 }
 
-/** Prints names and their corresponding ports in lexicographical order.
+/** Prints, in lexicographical order, names starting with prefix and their
+ * corresponding ports.
  *
  * @param worldState The mapper program state
- * @param writeStream Filestream to write to
+ * @param prefix Prefix of names to print
+ * @param output Buffer to write replies to
  */
-void print_mappings(WorldState* worldState, FILE* writeStream) {
-    int countAirports = worldState->countAirports;
+void print_prefix_mappings(WorldState* worldState, char* prefix,
+        OutputBuffer* output) {
+    size_t length = strlen(prefix);
     
-    if (countAirports == 0) {
+    // walk the slice of the ordered index holding the prefix
+    AirportNode* node = airport_list_seek(&worldState->ordered, prefix,
+            length);
+    for (; node != NULL; node = node->next[0]) {
+        Airport* airport = node->airport;
+        if (strncmp(airport->id, prefix, length) != 0) {
+            break;
+        }
+        output_printf(output, "%s:%d\n", airport->id, airport->port);
+    }
+}
+
+/** Sends back the mapper's version as "epoch.version", then the name and
+ * port of each airport added after the version given, in the order they
+ * were added, then ".". Catching up with the returned version so costs
+ * only the new airports. "0" asks for every airport. A version from
+ * another run of the mapper, whose list may differ even where it is as
+ * long, one this run never gave out, or a bare number as versions were
+ * before they had an epoch, is answered with "resync" and then as "0"
+ * would be.
+ *
+ * @param worldState The mapper program state
+ * @param cursor Version already seen as given by the mapper, or "0"
+ * @param output Buffer to write replies to
+ */
+void print_mappings_since(WorldState* worldState, char* cursor,
+        OutputBuffer* output) {
+    char* rest;
+    unsigned long epoch = strtoul(cursor, &rest, 16);
+    bool valid = rest != cursor;
+    bool dotted = valid && *rest == '.';
+    long since = 0;
+    if (dotted) {
+        char* number = rest + 1;
+        since = strtol(number, &rest, 10);
+        valid = rest != number && since >= 0;
+    }
+    if (!valid || strlen(rest) != 0) {
+        output_printf(output, ".\n");
         return;
     }
-    int dog = worldState->countAirports;
-    
-    // sort lexiocographically
-    qsort(&worldState->airports[0], countAirports, sizeof(Airport*), cmp_func);
-    
-    for (int i = 0; i < countAirports; ++i) {
-        fprintf(writeStream, "%s:%d\n", worldState->airports[i]->id,
-                worldState->airports[i]->port);
-        fflush(writeStream);
+    bool fresh = strcmp(cursor, "0") == 0;
+    long version = worldState->countAirports;
+    if (!fresh && (!dotted || epoch != worldState->epoch ||
+            since < worldState->restored || since > version)) {
+        output_printf(output, "resync\n");
+        fresh = true;
+    }
+    output_printf(output, "%lx.%ld\n", worldState->epoch, version);
+    if (fresh) {
+        since = 0;
     }
+    for (long i = since; i < version; ++i) {
+        Airport* airport = worldState->airports[i];
+        output_printf(output, "%s:%d\n", airport->id, airport->port);
+    }
+    output_printf(output, ".\n");
 }
 
-/** Checks input received by the mapper.
+/** Checks input received by the mapper. Queries share the lock with one
+ * another and only registrations take it exclusively.
  *
- * @param input
- * @param lock
- * @return 0 if a ? was seen
- *         1 if a ! was seen
- *         2 if a @ was seen
- *         -1 otherwise.
+ * @param input Line received, without its '\n'
+ * @param server Mapper server
+ * @param output Buffer to write replies to
  */
-void check_string(char* input, sem_t* lock, WorldState* worldState,
-        FILE* writeStream) {
-    take_lock(lock);
-   
-    // clean '\n'
-    int lenInput = (int) strlen(input);
-    input[lenInput - 1] = '\0';
+void check_string(char* input, Server* server, OutputBuffer* output) {
+    pthread_rwlock_t* lock = &server->lock;
+    WorldState* worldState = server->worldState;
+    long start = start_command();
+    long waited = 0;
+    CommandKind kind;
+    
     /** Send the port number for the airport called ID **/
     if (strncmp(input, "?", 1) == 0) {
-        do_mapper_query(input, worldState, writeStream);
+        waited = take_read_lock(lock);
+        do_mapper_query(input, worldState, output);
         release_lock(lock);
-        return;
-    }
+        kind = COMMAND_QUERY;
     /** Add airport called ID with PORT as the port number **/
-    if (strncmp(input, "!", 1) == 0) {
+    } else if (strncmp(input, "!", 1) == 0) {
         // ensure correct format
         char* colonLocation = strchr(input, ':');
         if (colonLocation == NULL) {
-            release_lock(lock);
             return;
         }
         
+        waited = take_lock(lock);
         add_mapping(input, worldState);
         release_lock(lock);
-        return;
-    }
+        kind = COMMAND_REGISTER;
+    /** Send back all names starting with ID and their ports **/
+    } else if (strncmp(input, "^", 1) == 0) {
+        waited = take_read_lock(lock);
+        print_prefix_mappings(worldState, input + 1, output);
+        release_lock(lock);
+        kind = COMMAND_PREFIX;
+    /** Send back the version, then names and ports added since V **/
+    } else if (strncmp(input, "@since ", 7) == 0) {
+        waited = take_read_lock(lock);
+        print_mappings_since(worldState, input + 7, output);
+        release_lock(lock);
+        kind = COMMAND_DUMP_SINCE;
     /** Send back all names and their corresponding ports **/
-    if (strncmp(input, "@", 1) == 0) {
+    } else if (strncmp(input, "@", 1) == 0) {
         if (strlen(input) != 2) {
-            print_mappings(worldState, writeStream);
-            
+            waited = take_read_lock(lock);
+            print_mappings(worldState, output);
+            release_lock(lock);
+        }
+        kind = COMMAND_DUMP;
+    /** Send back all names and ports, then each one added from now on **/
+    } else if (strcmp(input, "watch") == 0) {
+        // no registration can come between the snapshot and subscribing
+        waited = take_read_lock(lock);
+        if (reactor_subscribe(worldState->watchers)) {
+            print_mappings(worldState, output);
+            output_printf(output, ".\n");
         }
         release_lock(lock);
+        kind = COMMAND_WATCH;
+    /** Send back what the mapper has been doing **/
+    } else if (strcmp(input, ":stats") == 0) {
+        print_stats(server, output);
+        return;
+    } else {
         return;
     }
-    
-    release_lock(lock);
+    record_command(server->stats, kind, command_latency(start), waited);
+}
+
+/** Checks a port given in text as a registration would.
+ *
+ * @param port Port in text
+ * @param value Set to the port's value
+ * @return false if port is empty, too long or not a number
+ */
+bool parse_port(const char* port, int* value) {
+    char* trash;
+    *value = (int) strtol(port, &trash, 10);
+    return strlen(trash) == 0 && strlen(port) != 0 &&
+            strlen(port) < PORT_MAX_CHARS;
 }
 
-/** Adds a mapping of id: portnumber to the mapper.
+/** Adds a mapping of id: portnumber to the mapper. Several mappings may be
+ * given at once as id:port pairs separated by ':', which cannot appear in
+ * an id, so that a bulk load takes the lock once rather than per line.
+ * Each pair is checked and added on its own, in the order given. A line
+ * whose fields do not pair up, such as "!A:1:2", is rejected whole, as it
+ * was before several pairs were accepted.
  *
- * @param input String containing id: portnumber to be decoded
+ * @param input String containing !id:portnumber to be decoded; it is
+ *        split in place
  * @param worldState The mapper program state
- * @param colonLocation Location of the colon in the input string
  */
 void add_mapping(char* input, WorldState* worldState) {
-    char* colonLocation = strchr(input, ':');
-    int indexOfDelim = colonLocation - input;
-    int indexOfPort = indexOfDelim + 1;
-    
-    // get id
-    char id[80];
-    snprintf(id, indexOfDelim, "%s", input + 1);
-    
-    // get the port number
-    char port[6];
-    snprintf(port, PORT_MAX_CHARS, "%s", input + indexOfPort);
-    
-    char* trash;
-    int portNum = (int) strtol(port, &trash, 10);
-    
-    // if ! used for an ID which already has entry
-    for (int i = 0; i < worldState->countAirports; ++i) {
-        Airport* airport = worldState->airports[i];
-       
-        // dont add mapping if id previously used
-        if (strcmp(airport->id, id) == 0) {
+    size_t fields = 1;
+    for (char* colon = strchr(input, ':'); colon != NULL;
+            colon = strchr(colon + 1, ':')) {
+        fields++;
+    }
+    if (fields % 2 != 0) {
+        return;
+    }
+
+    // pairs are split in place
+    char* id = input + 1;
+    while (id != NULL) {
+        char* colonLocation = strchr(id, ':');
+        if (colonLocation == NULL) {
             return;
         }
+        *colonLocation = '\0';
+        
+        // get the port number, which ends at the next pair
+        char* port = colonLocation + 1;
+        char* next = strchr(port, ':');
+        if (next != NULL) {
+            *next = '\0';
+        }
+        int portNum;
+        
+        // if the port is valid
+        if (parse_port(port, &portNum) &&
+                valid_mapping(id, strlen(id), portNum)) {
+            register_airport(worldState, id, portNum);
+        }
+        id = next == NULL ? NULL : next + 1;
+    }
+}
+
+/** Adds an airport unless its id is used already, keeping it in the
+ * journal if the mapper's state is kept and telling any watchers of it.
+ * Registrations in lines and in frames both come through here.
+ *
+ * @param worldState The mapper program state
+ * @param id Airport id, copied
+ * @param port Airport port
+ * @return false if the id was used already
+ */
+bool register_airport(WorldState* worldState, char* id, int port) {
+    // dont add mapping if id previously used
+    if (get_airport(worldState, id) != NULL) {
+        return false;
+    }
+    add_airport(id, port, worldState);
+    if (worldState->journal != NULL) {
+        journal_append(worldState->journal, worldState,
+                worldState->airports[worldState->countAirports - 1]);
     }
-    // if the port is valid
-    if (strlen(trash) == 0 && strlen(port) != 0) {
-        add_airport(id, portNum, worldState);
+    
+    // published under the lock, so watchers see airports in the order
+    // they were added and none from before their snapshot
+    if (worldState->watchers != NULL &&
+            __atomic_load_n(&worldState->watchers->count,
+            __ATOMIC_RELAXED) > 0) {
+        OutputBuffer message;
+        memset(&message, 0, sizeof(OutputBuffer));
+        output_printf(&message, "%s:%d\n", id, port);
+        broadcast_publish(worldState->watchers, message.data,
+                message.length);
+        free(message.data);
     }
+    return true;
 }
 
-/** Checks input received and performs ? query
+/** Checks input received and performs ? query. The query may name several
+ * ids separated by ':', which cannot appear in an id; the port of each is
+ * sent back on its own line, in the order the ids were given.
  *
- * @param input String input which was received
+ * @param input String input which was received; it is split in place
  * @param worldState The mapper program stat
- * @param writeStream Filestream to write to
+ * @param output Buffer to write replies to
  */
-void do_mapper_query(char* input, WorldState* worldState, FILE* writeStream) {
-    // extract id from input
-    char id[80];
-    snprintf(id, 80, "%s", input + 1);
-    
-    // Send back the port number for the airport called id
-    Airport* airport = get_airport(worldState, id);
-    
-    // if there is no mapping
-    if (airport == NULL) {
-        fprintf(writeStream, ";\n");
-    } else {
-        // if there is an entry corresponding to that ID
-        int portNumber = airport->port;
-        fprintf(writeStream, "%d\n", portNumber);
+void do_mapper_query(char* input, WorldState* worldState,
+        OutputBuffer* output) {
+    // ids are split in place
+    char* id = input + 1;
+    while (id != NULL) {
+        char* colonLocation = strchr(id, ':');
+        if (colonLocation != NULL) {
+            *colonLocation = '\0';
+        }
+        
+        // Send back the port number for the airport called id
+        Airport* airport = find_mapping(worldState, id, strlen(id));
+        
+        // if there is no mapping
+        if (airport == NULL) {
+            output_printf(output, ";\n");
+        } else {
+            // if there is an entry corresponding to that ID
+            int portNumber = airport->port;
+            output_printf(output, "%d\n", portNumber);
+        }
+        id = colonLocation == NULL ? NULL : colonLocation + 1;
     }
-    
-    fflush(writeStream);
 }
 
-/** For control qsort.
+/** Starts the reply to a log-since: the sequence number of the latest
+ * visit, then the id of each plane which visited after the cursor given,
+ * in visit order, then ".". Polling with the returned cursor so costs
+ * only the new visits. Visits already evicted are read back from the
+ * spill segment, or left out if there is none. Called under control's
+ * lock, which finish_visits_since does not need.
  *
- * @param a Plane one
- * @param b Plane two
- * @return < 1 if first goes before second. 0 if equal. > 1 otherwise.
+ * @param registry Planes which have visited control
+ * @param cursor Sequence number of the last visit already seen, as text
+ * @param output Buffer to write replies to
+ * @param visits Where to keep what is left of the reply
  */
-int control_cmp_func(const void* a, const void* b) {
-    Plane* first = *(Plane**) a;
-    Plane* second = *(Plane**) b;
+void start_visits_since(PlaneRegistry* registry, char* cursor,
+        OutputBuffer* output, VisitsSince* visits) {
+    memset(visits, 0, sizeof(VisitsSince));
+    char* rest;
+    visits->since = strtol(cursor, &rest, 10);
+    if (strlen(cursor) == 0 || strlen(rest) != 0 || visits->since < 0) {
+        visits->since = -1;
+        return;
+    }
+    output_printf(output, "%ld\n", registry->visits);
+    long since = visits->since;
+    visits->spilled = since + 1 < registry->oldest &&
+            registry->spilled > 0 &&
+            open_spill_reader(registry, &visits->reader, since);
     
-    return strcmp(first->id, second->id);
+    // visits in memory are overwritten once the lock is released
+    long first = since + 1 > registry->oldest ? since + 1 : registry->oldest;
+    for (long i = first; i <= registry->visits; ++i) {
+        const char* id = plane_registry_visitor(registry, i)->id;
+        output_append(&visits->recent, id, strlen(id));
+        output_append(&visits->recent, "\n", 1);
+    }
 }
 
-/** Checks input received by control.
+/** Finishes the reply to a log-since with the visits read back from the
+ * spill segment, then those which were held in memory.
  *
- * @param input String to be checked
- * @param lock Semaphore
- * @param controlState Control program state
- * @param writeStream Filestream to write to
- */
-void check_control_string(char* input, sem_t* lock, ControlState* controlState,
-        FILE* writeStream) {
-    take_lock(lock);
-    int countPlanes = controlState->countPlanes;
-    // send back lexiographic order of rocs
-    if (strncmp(input, "log", 3) == 0) {
-        // sort lexiocographically
-        qsort(&controlState->planes[0], countPlanes,
-              sizeof(Plane*), control_cmp_func);
-        
-        for (int i = 0; i < countPlanes; ++i) {
-            fprintf(writeStream, "%s\n", controlState->planes[i]->id);
-            fflush(writeStream);
-        }
-        fprintf(writeStream, ".\n");
-        fflush(writeStream);
-        
-        fclose(writeStream);
+ * @param visits Reply started by start_visits_since
+ * @param output Buffer to write replies to
+ */
+void finish_visits_since(VisitsSince* visits, OutputBuffer* output) {
+    if (visits->since == -1) {
+        output_printf(output, ".\n");
         return;
     }
+    if (visits->spilled) {
+        SpillReader* reader = &visits->reader;
+        int code;
+        while ((code = spill_next(reader)) != -1) {
+            if (reader->sequence > visits->since) {
+                output_append(output, reader->ids[code],
+                        strlen(reader->ids[code]));
+                output_append(output, "\n", 1);
+            }
+        }
+        close_spill_reader(reader);
+    }
+    output_append(output, visits->recent.data, visits->recent.length);
+    free(visits->recent.data);
+    output_printf(output, ".\n");
+}
+
+/** Checks input received by control.
+ *
+ * @param input String to be checked, without its '\n'
+ * @param server Control server
+ * @param output Buffer to write replies to
+ * @return false if the connection is finished with (after a log, :counts
+ *         or :log-since)
+ */
+bool check_control_string(char* input, Server* server,
+        OutputBuffer* output) {
+    // send back what control has been doing
+    if (strcmp(input, ":stats") == 0) {
+        print_stats(server, output);
+        return true;
+    }
+    pthread_rwlock_t* lock = &server->lock;
+    ControlState* controlState = server->controlState;
+    long start = start_command();
+    long waited = take_lock(lock);
+    PlaneRegistry* registry = &controlState->planes;
+    CommandKind kind;
+    // the spill segment is read once the lock is released, so that visits
+    // are not held up by it
+    PlaneTally tally;
+    VisitsSince visits;
     
+    // send back lexiographic order of rocs, a line per visit
+    if (strcmp(input, "log") == 0) {
+        plane_registry_tally(registry, &tally);
+        kind = COMMAND_LOG;
+    // send back lexiographic order of rocs with their number of visits
+    } else if (strcmp(input, ":counts") == 0) {
+        plane_registry_tally(registry, &tally);
+        kind = COMMAND_COUNTS;
+    // send back the cursor and the visits made after the one given
+    } else if (strncmp(input, ":log-since ", 11) == 0) {
+        start_visits_since(registry, input + 11, output, &visits);
+        kind = COMMAND_LOG_SINCE;
     // consider the text to be the plane's id - send back control's info
-    fprintf(writeStream, "%s\n", controlState->airportInfo);
-    fflush(writeStream);
+    } else {
+        output_printf(output, "%s\n", controlState->airportInfo);
+        plane_registry_visit(registry, input, strlen(input));
+        kind = COMMAND_VISIT;
+    }
+    release_lock(lock);
     
-    int lenInput = (int) strlen(input);
-    input[lenInput - 1] = '\0';
+    if (kind == COMMAND_LOG || kind == COMMAND_COUNTS) {
+        finish_plane_tally(&tally);
+        for (int i = 0; i < tally.countEntries; ++i) {
+            if (kind == COMMAND_COUNTS) {
+                output_printf(output, "%s %ld\n", tally.entries[i].id,
+                        tally.entries[i].count);
+                continue;
+            }
+            size_t length = strlen(tally.entries[i].id);
+            for (long j = 0; j < tally.entries[i].count; ++j) {
+                output_append(output, tally.entries[i].id, length);
+                output_append(output, "\n", 1);
+            }
+        }
+        output_printf(output, ".\n");
+        free_plane_tally(&tally);
+    } else if (kind == COMMAND_LOG_SINCE) {
+        finish_visits_since(&visits, output);
+    }
+    record_command(server->stats, kind, command_latency(start), waited);
+    return kind == COMMAND_VISIT;
+}
+
+/** Reads how much memory the program has resident.
+ *
+ * @return Resident set size in bytes, or 0 if it cannot be read
+ */
+long resident_bytes(void) {
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    long pages = 0;
+    long resident = 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/** Sends back the server's connection counts, entry counts, memory, and
+ * for each kind of command handled, its count, lock waits, the number of
+ * commands timed and, if any were, their latency percentiles, then ".".
+ *
+ * @param server Mapper or control server
+ * @param output Buffer to write replies to
+ */
+void print_stats(Server* server, OutputBuffer* output) {
+    Reactor* reactor = &server->reactor;
+    output_printf(output, "connections live=%ld total=%ld refused=%ld "
+            "expired=%ld\n",
+            __atomic_load_n(&reactor->live, __ATOMIC_RELAXED),
+            __atomic_load_n(&reactor->total, __ATOMIC_RELAXED),
+            __atomic_load_n(&reactor->refused, __ATOMIC_RELAXED),
+            __atomic_load_n(&reactor->expired, __ATOMIC_RELAXED));
     
-    // add plane to list
-    if (controlState->countPlanes == 0) {
-        controlState->planes = malloc(sizeof(Plane*));
-        controlState->planes[0] = malloc(sizeof(Plane));
+    take_read_lock(&server->lock);
+    if (server->worldState != NULL) {
+        Broadcast* watchers = server->worldState->watchers;
+        output_printf(output, "entries airports=%d watchers=%ld "
+                "dropped=%ld\n", server->worldState->countAirports,
+                __atomic_load_n(&watchers->count, __ATOMIC_RELAXED),
+                __atomic_load_n(&watchers->dropped, __ATOMIC_RELAXED));
     } else {
-        controlState->planes = realloc(controlState->planes,
-                sizeof(Plane*) * (controlState->countPlanes + 1));
-        controlState->planes[controlState->countPlanes] =
-                malloc(sizeof(Plane));
+        PlaneRegistry* registry = &server->controlState->planes;
+        output_printf(output, "entries planes=%d visits=%ld retained=%ld "
+                "spilled=%ld\n", registry->livePlanes, registry->visits,
+                registry->visits - registry->oldest + 1, registry->spilled);
     }
+    release_lock(&server->lock);
+    output_printf(output, "memory resident=%ld\n", resident_bytes());
     
-    controlState->planes[controlState->countPlanes]->id = malloc(
-            sizeof(char) * 80);
-    strcpy(controlState->planes[controlState->countPlanes]->id, input);
-    controlState->countPlanes++;
-    
-    release_lock(lock);
+    CommandStats* command = malloc(sizeof(CommandStats));
+    for (int i = 0; i < COMMAND_KINDS; ++i) {
+        gather_command(server->stats, i, command);
+        if (command->count == 0) {
+            continue;
+        }
+        long samples = histogram_count(&command->latency);
+        output_printf(output, "command %s count=%ld lock_waits=%ld "
+                "lock_wait_ns=%ld samples=%ld", command_name(i),
+                command->count, command->lockWaits, command->lockWaitNs,
+                samples);
+        // with nothing timed there are no percentiles, rather than 0s
+        if (samples > 0) {
+            output_printf(output, " p50_ns=%ld p99_ns=%ld p999_ns=%ld",
+                    histogram_percentile(&command->latency, 0.5),
+                    histogram_percentile(&command->latency, 0.99),
+                    histogram_percentile(&command->latency, 0.999));
+        }
+        output_printf(output, "\n");
+    }
+    free(command);
+    output_printf(output, ".\n");
 }
 
-/** Control thread doer
- *
- * @param v Thread parameters
- * @return need for thread function
- */
-void* control_doer(void* v) {
-    // TODO change name
-    struct ControlParam* p = (struct ControlParam*) v;
-    take_lock(p->guard);
-    ControlState* controlState = p->controlState;
-    int fd2 = dup(*p->fileDescriptor);
-    FILE* writeStream = fdopen(*p->fileDescriptor, "w");
-    FILE* readStream = fdopen(fd2, "r");
-    release_lock(p->guard);
-    while (true) {
-        char input[80];
-        if (fgets(input, 80, readStream) != NULL) {
-            // check string values
-            check_control_string(input, p->guard, controlState, writeStream);
-        }
+/** Sends back the number of connections the server has open.
+ *
+ * @param server Mapper or control server
+ * @param output Buffer to write replies to
+ */
+void print_connection_count(Server* server, OutputBuffer* output) {
+    output_printf(output, "%ld\n",
+            __atomic_load_n(&server->reactor.live, __ATOMIC_RELAXED));
+}
+
+/** Sends back how long connections have waited between being accepted
+ * and their first byte arriving, as the number of connections measured
+ * followed by the mean and maximum wait in microseconds.
+ *
+ * @param server Mapper or control server
+ * @param output Buffer to write replies to
+ */
+void print_first_byte_latency(Server* server, OutputBuffer* output) {
+    Reactor* reactor = &server->reactor;
+    long count = __atomic_load_n(&reactor->firstByteCount, __ATOMIC_RELAXED);
+    long total = __atomic_load_n(&reactor->firstByteTotalNs,
+            __ATOMIC_RELAXED);
+    long max = __atomic_load_n(&reactor->firstByteMaxNs, __ATOMIC_RELAXED);
+    output_printf(output, "%ld %ld %ld\n", count,
+            count == 0 ? 0 : total / count / 1000, max / 1000);
+}
+
+/** Handles a line received by control. Commands other than log start
+ * with ':', which a roc does not send as a plane id, so that none of them
+ * hides a plane of the same name.
+ *
+ * @param line Line received
+ * @param length Number of characters in line
+ * @param output Buffer to write replies to
+ * @param v Control server
+ * @return false if the connection should be closed
+ */
+bool control_doer(char* line, size_t length, OutputBuffer* output,
+        void* v) {
+    // lines hold no '\0', so are read as strings
+    (void) length;
+    Server* server = (Server*) v;
+    if (strcmp(line, ":conns") == 0) {
+        print_connection_count(server, output);
+        return true;
+    }
+    if (strcmp(line, ":latency") == 0) {
+        print_first_byte_latency(server, output);
+        return true;
+    }
+    return check_control_string(line, server, output);
+}
+
+/** Handles a line received by the mapper. Its commands other than watch
+ * start with a character an id can not, as control's do.
+ *
+ * @param line Line received
+ * @param length Number of characters in line
+ * @param output Buffer to write replies to
+ * @param v Mapper server
+ * @return true, mapper connections stay open until the peer closes them
+ */
+bool mapper_doer(char* line, size_t length, OutputBuffer* output,
+        void* v) {
+    // lines hold no '\0', so are read as strings
+    (void) length;
+    Server* server = (Server*) v;
+    if (strcmp(line, ":conns") == 0) {
+        print_connection_count(server, output);
+        return true;
     }
+    if (strcmp(line, ":latency") == 0) {
+        print_first_byte_latency(server, output);
+        return true;
+    }
+    check_string(line, server, output);
+    return true;
 }
 
-/** Handles a connection to a process.
+/** Handles a frame received by the mapper. Queries and registrations are
+ * read from and answered with fixed width fields, and checked as their
+ * lines would be; any other command is handled as the line it carries.
  *
- * @param v Struct of thread parameters
- * @return need for thread function
+ * @param body Frame body, without its length
+ * @param length Number of bytes in body
+ * @param output Buffer to write replies to
+ * @param v Mapper server
+ * @return false if the connection should be closed
  */
-void* mapper_doer(void* v) {
-    // TODO change name
-    struct Param* p = (struct Param*) v;
-    WorldState* worldState = p->worldState;
-    take_lock(p->guard);
-    int fd2 = dup(*p->fileDescriptor);
-    FILE* writeStream = fdopen(*p->fileDescriptor, "w");
-    FILE* readStream = fdopen(fd2, "r");
-    release_lock(p->guard);
-    while (true) {
-        char input[80];
-        if (fgets(input, 80, readStream) != NULL) {
-            // check string values
-            check_string(input, p->guard, worldState, writeStream);
+bool mapper_frame_doer(char* body, size_t length, OutputBuffer* output,
+        void* v) {
+    Server* server = (Server*) v;
+    WorldState* worldState = server->worldState;
+    Frame frame;
+    if (!parse_frame(body, length, &frame)) {
+        return false;
+    }
+    if (frame.code == FRAME_TEXT) {
+        size_t reply = frame_begin(output, frame.requestId, FRAME_OK);
+        bool open = mapper_doer(frame.payload, frame.length, output, v);
+        frame_end(output, reply);
+        return open;
+    }
+    long start = start_command();
+    long waited = 0;
+    CommandKind kind;
+    
+    /** Send the port number for the airport called ID **/
+    if (frame.code == FRAME_QUERY) {
+        waited = take_read_lock(&server->lock);
+        Airport* airport = find_mapping(worldState, frame.payload,
+                frame.length);
+        int port = airport == NULL ? 0 : airport->port;
+        release_lock(&server->lock);
+        
+        size_t reply = frame_begin(output, frame.requestId,
+                airport == NULL ? FRAME_NOT_FOUND : FRAME_OK);
+        if (airport != NULL) {
+            char field[2];
+            frame_put_u16(field, (uint16_t) port);
+            output_append(output, field, sizeof(field));
+        }
+        frame_end(output, reply);
+        kind = COMMAND_QUERY;
+    /** Add airport called ID with PORT as the port number **/
+    } else if (frame.code == FRAME_REGISTER) {
+        bool added = false;
+        char* id = frame.payload + 2;
+        if (frame.length >= 2 && valid_mapping(id, frame.length - 2,
+                frame_u16(frame.payload))) {
+            waited = take_lock(&server->lock);
+            added = register_airport(worldState, id,
+                    frame_u16(frame.payload));
+            release_lock(&server->lock);
         }
+        frame_end(output, frame_begin(output, frame.requestId,
+                added ? FRAME_OK : FRAME_REJECTED));
+        kind = COMMAND_REGISTER;
+    } else {
+        frame_end(output, frame_begin(output, frame.requestId,
+                FRAME_UNKNOWN));
+        return true;
+    }
+    record_command(server->stats, kind, command_latency(start), waited);
+    return true;
+}
+
+/** Handles a frame received by control. Visits are answered with
+ * control's info alone; any other command is handled as the line it
+ * carries.
+ *
+ * @param body Frame body, without its length
+ * @param length Number of bytes in body
+ * @param output Buffer to write replies to
+ * @param v Control server
+ * @return false if the connection should be closed
+ */
+bool control_frame_doer(char* body, size_t length, OutputBuffer* output,
+        void* v) {
+    Server* server = (Server*) v;
+    ControlState* controlState = server->controlState;
+    Frame frame;
+    if (!parse_frame(body, length, &frame)) {
+        return false;
+    }
+    if (frame.code == FRAME_TEXT) {
+        size_t reply = frame_begin(output, frame.requestId, FRAME_OK);
+        bool open = control_doer(frame.payload, frame.length, output, v);
+        frame_end(output, reply);
+        return open;
+    }
+    // plane ids hold nothing a line could not
+    if (frame.code != FRAME_VISIT ||
+            strcspn(frame.payload, "\n") != frame.length) {
+        frame_end(output, frame_begin(output, frame.requestId,
+                frame.code == FRAME_VISIT ? FRAME_REJECTED : FRAME_UNKNOWN));
+        return true;
+    }
+    long start = start_command();
+    long waited = take_lock(&server->lock);
+    plane_registry_visit(&controlState->planes, frame.payload, frame.length);
+    release_lock(&server->lock);
+    
+    size_t reply = frame_begin(output, frame.requestId, FRAME_OK);
+    output_append(output, controlState->airportInfo,
+            strlen(controlState->airportInfo));
+    frame_end(output, reply);
+    record_command(server->stats, COMMAND_VISIT, command_latency(start),
+            waited);
+    return true;
+}
+
+/** Chooses how connections are made for the rest of the program.
+ *
+ * @param socketDirectory Directory holding a "<port>.sock" Unix domain
+ *        socket for each port, or NULL to use TCP on loopback
+ * @return false if the directory's socket paths would be too long
+ */
+bool init_transport(char* socketDirectory) {
+    struct sockaddr_un address;
+    if (socketDirectory != NULL &&
+            strlen(socketDirectory) + sizeof("/65535.sock") >
+            sizeof(address.sun_path)) {
+        return false;
+    }
+    transport.socketDirectory = socketDirectory;
+    return true;
+}
+
+/** Has this program ask every server it connects to for frames. Servers
+ * which do not offer them are not fallen back from, so this is only asked
+ * for, with -b, where every server is known to offer them.
+ */
+void use_frames(void) {
+    transport.framed = true;
+}
+
+/** Tells whether this program asks servers for frames.
+ *
+ * @return true if use_frames was called
+ */
+bool using_frames(void) {
+    return transport.framed;
+}
+
+/** Resolves the loopback address, once for the whole program. **/
+void resolve_loopback(void) {
+    struct addrinfo* ai = 0;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    memset(&transport.loopback, 0, sizeof(struct sockaddr_in));
+    if (getaddrinfo("localhost", 0, &hints, &ai) == 0) {
+        memcpy(&transport.loopback, ai->ai_addr, sizeof(struct sockaddr_in));
+        freeaddrinfo(ai);
+    } else {
+        transport.loopback.sin_family = AF_INET;
+        transport.loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
     }
 }
 
+/** Fills in the address at which a port is reached.
+ *
+ * @param port Port to reach, 0 to let a listening TCP socket pick one
+ * @param address Where to store the address
+ * @return Length of the address stored
+ */
+socklen_t port_address(int port, struct sockaddr_storage* address) {
+    memset(address, 0, sizeof(struct sockaddr_storage));
+    if (transport.socketDirectory != NULL && port != 0) {
+        struct sockaddr_un* local = (struct sockaddr_un*) address;
+        local->sun_family = AF_UNIX;
+        snprintf(local->sun_path, sizeof(local->sun_path), "%s/%d.sock",
+                transport.socketDirectory, port);
+        return sizeof(struct sockaddr_un);
+    }
+    pthread_once(&transport.resolved, resolve_loopback);
+    struct sockaddr_in* inet = (struct sockaddr_in*) address;
+    memcpy(inet, &transport.loopback, sizeof(struct sockaddr_in));
+    inet->sin_port = htons((uint16_t) port);
+    return sizeof(struct sockaddr_in);
+}
+
 /** Makes socket and returns file descriptor to communicate on.
  *
  * @param mapperPort Port to make socket on
@@ -419,55 +1020,195 @@ int outbound_socket_maker(int mapperPort) {
         return 0;
     }
     
-    int client = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_storage address;
+    socklen_t length = port_address(mapperPort, &address);
+    int client = socket(address.ss_family, SOCK_STREAM, 0);
     if (client == -1) {
         return -1;
     }
     
-    struct addrinfo* ai = 0;
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    
-    char port[6];
-    sprintf(port, "%d", mapperPort);
+    // error connecting
+    if (connect(client, (struct sockaddr*) &address, length) < 0) {
+        close(client);
+        return -1;
+    }
     
-    // error resolving host
-    if (getaddrinfo("localhost", port, &hints, &ai)) {
+    return client;
+}
+
+/** Starts connecting a non-blocking socket to a port on localhost, for
+ * callers which wait on many connections at once.
+ *
+ * @param port Port to connect to
+ * @return File descriptor whose connection is in progress or complete, or
+ *         -1 if the connection could not be started
+ */
+int outbound_socket_start(int port) {
+    struct sockaddr_storage address;
+    socklen_t length = port_address(port, &address);
+    int client = socket(address.ss_family, SOCK_STREAM, 0);
+    if (client == -1) {
         return -1;
     }
     
+    // a Unix domain connect never waits unless the backlog is full, where
+    // a non-blocking one would fail rather than wait
+    if (address.ss_family == AF_INET) {
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+    }
+    int result = connect(client, (struct sockaddr*) &address, length);
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+    
     // error connecting
-    if (connect(client, (struct sockaddr*) ai->ai_addr,
-            sizeof(struct sockaddr)) < 0) {
+    if (result < 0 && errno != EINPROGRESS) {
+        close(client);
+        return -1;
+    }
+    return client;
+}
+
+/** Connects to a port, asking the server for frames if this program was
+ * told to use them.
+ *
+ * @param port Port to connect to
+ * @return File descriptor to communicate on, or -1 if the connection
+ *         could not be made or the server did not agree to frames
+ */
+int outbound_socket_framed(int port) {
+    int client = outbound_socket_maker(port);
+    if (client != -1 && transport.framed && !request_frames(client)) {
+        close(client);
         return -1;
     }
-    
     return client;
 }
 
-/** Sets up sockets.
+/** Parses the options which may come before a server's arguments.
+ *
+ * @param argc Program argument count
+ * @param argv Program arguments
+ * @param options Where to store the options, defaults if not given
+ * @return Index of the first argument after the options, or -1 if the
+ *         options are invalid
+ * @options
+ *    -i seconds - close connections idle for this long
+ *    -c count - most connections to serve at once
+ *    -t count - number of worker threads serving connections
+ *    -d directory - keep the mapper's state in this directory
+ *    -u directory - connect through Unix domain sockets in this directory
+ *    -r count - most visits control holds in memory
+ *    -s file - write visits evicted by control to this file, which is
+ *              emptied at start and grows by a few bytes a visit while
+ *              control runs
+ *    -m kilobytes - most the spill file grows to before its older half is
+ *                   dropped, 256MB unless given
+ *    -p file - load the mapper's mappings from this file before serving
+ *    -b - speak to the mapper in frames, which it must offer
+ */
+int parse_server_options(int argc, char** argv, ServerOptions* options) {
+    options->idleTimeout = 0;
+    options->maxConnections = 0;
+    options->threads = 0;
+    options->stateDirectory = NULL;
+    options->socketDirectory = NULL;
+    options->retainVisits = 0;
+    options->spillPath = NULL;
+    options->spillMax = 0;
+    options->preloadPath = NULL;
+    options->framed = false;
+    
+    // '+' stops at the first argument so ids and info may start with '-'
+    opterr = 0;
+    int option;
+    while ((option = getopt(argc, argv, "+i:c:t:d:u:r:s:m:p:b")) != -1) {
+        if (option == 'd' && strlen(optarg) != 0) {
+            options->stateDirectory = optarg;
+            continue;
+        }
+        if (option == 'u' && strlen(optarg) != 0) {
+            options->socketDirectory = optarg;
+            continue;
+        }
+        if (option == 's' && strlen(optarg) != 0) {
+            options->spillPath = optarg;
+            continue;
+        }
+        if (option == 'p' && strlen(optarg) != 0) {
+            options->preloadPath = optarg;
+            continue;
+        }
+        if (option == 'b') {
+            options->framed = true;
+            use_frames();
+            continue;
+        }
+        if (option != 'i' && option != 'c' && option != 't' &&
+                option != 'r' && option != 'm') {
+            return -1;
+        }
+        char* rest;
+        long value = strtol(optarg, &rest, 10);
+        if (strlen(rest) != 0 || strlen(optarg) == 0 || value <= 0 ||
+                value > 1 << 24) {
+            return -1;
+        }
+        if (option == 'i') {
+            options->idleTimeout = (int) value;
+        } else if (option == 'c') {
+            options->maxConnections = (int) value;
+        } else if (option == 'r') {
+            options->retainVisits = value;
+        } else if (option == 'm') {
+            options->spillMax = value * 1024;
+        } else {
+            options->threads = (int) value;
+        }
+    }
+    if (!init_transport(options->socketDirectory)) {
+        return -1;
+    }
+    return optind;
+}
+
+/** Checks whether a server still answers at a Unix domain socket path.
+ *
+ * @param address Address of the path
+ * @param length Length of address
+ * @return true if something accepted a connection at the path, false if
+ *         there is no file there or it is left from a server which has gone
+ */
+bool socket_path_in_use(const struct sockaddr_storage* address,
+        socklen_t length) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return false;
+    }
+    bool answered = connect(fd, (const struct sockaddr*) address,
+            length) == 0 || (errno != ECONNREFUSED && errno != ENOENT);
+    close(fd);
+    return answered;
+}
+
+/** Sets up sockets and serves connections on them until the program ends.
  *
  * @param worldState The mapper program state
  * @param controlState The control program state
+ * @param options Command line options of the program
+ * @return false if the program's port or its socket path could not be
+ *         taken, as when another server is still reached at the path
  */
-void setup_sockets(WorldState* worldState, ControlState* controlState) {
+bool setup_sockets(WorldState* worldState, ControlState* controlState,
+        const ServerOptions* options) {
     bool hasWorldState = true;
     bool hasControlState = true;
    
-    // setup socket
-    struct addrinfo* ai = 0;
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-    getaddrinfo("localhost", 0, &hints, &ai);
-    
     // create socket and bind to port
+    struct sockaddr_storage address;
+    socklen_t length = port_address(0, &address);
     int serv = socket(AF_INET, SOCK_STREAM, 0);
-    bind(serv, (struct sockaddr*) ai->ai_addr, sizeof(struct sockaddr));
+    if (serv == -1 || bind(serv, (struct sockaddr*) &address, length) != 0) {
+        return false;
+    }
     
     // which port did we get
     struct sockaddr_in ad;
@@ -476,22 +1217,42 @@ void setup_sockets(WorldState* worldState, ControlState* controlState) {
     getsockname(serv, (struct sockaddr*) &ad, &len);
     int port = ntohs(ad.sin_port);
     
+    if (transport.socketDirectory != NULL) {
+        // serv is reused for the Unix socket, but the TCP fd it held stays
+        // open, never listened on or closed, so that no other program takes
+        // the port while this one is reached at the port's path instead
+        length = port_address(port, &address);
+        
+        // a file left at the path is from a program which held the port
+        // before and has gone, unless a server still answers there
+        if (socket_path_in_use(&address, length)) {
+            return false;
+        }
+        unlink(((struct sockaddr_un*) &address)->sun_path);
+        serv = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (serv == -1 ||
+                bind(serv, (struct sockaddr*) &address, length) != 0) {
+            return false;
+        }
+    }
+    
     if (worldState == NULL) {
         hasWorldState = false;
     }
     if (controlState == NULL) {
         hasControlState = false;
     } else {
-        if (controlState->mapperPort != -1) {
+        if (controlState->mappers != NULL) {
             connect_to_mapper(controlState, port);
         }
     }
     
-    // allow up to 10 requests to queue
-    listen(serv, 10);
+    // let bursts of connections queue while the reactor catches up
+    listen(serv, SOMAXCONN);
     
     thread_listener(worldState, controlState, hasWorldState, hasControlState,
-                    serv, port);
+                    serv, port, options);
+    return true;
 }
 
 /** Initialises socket and listens for incoming connections.
@@ -502,104 +1263,60 @@ void setup_sockets(WorldState* worldState, ControlState* controlState) {
  * @param hasControlState True if program is control. False if mapper
  * @param server The current server (localhost)
  * @param port Ephemeral port to listen on
+ * @param options Command line options of the program
  */
 void thread_listener(WorldState* worldState, ControlState* controlState,
-        bool hasWorldState, bool hasControlState, int server, int port) {
-    int connectionFd;
-    sem_t lock;
-    init_lock(&lock);
-    printf("%u\n", port);
-    fflush(stdout);
-    // listen for connections
-    int countMapParams = 0;
-    int countControlParams = 0;
-    struct Param* par = malloc(sizeof(struct Param));
-    struct ControlParam* controlParam = malloc(sizeof(struct ControlParam));
-    while (connectionFd = accept(server, 0, 0), connectionFd >= 0) {
-        if (hasWorldState) {
-            start_map_thread(worldState, &connectionFd, countMapParams, par,
-                    &lock);
-        } else if (hasControlState) {
-            start_control_thread(controlState, &connectionFd,
-                    countControlParams, controlParam, &lock);
-        }
-    }
-}
-
-/** Starts a thread for the control program.
- *
- * @param controlState The state of the control program
- * @param connectionFd File descriptor to communicate on
- * @param countControlParams Number of control threads
- * @param controlParam Array of thread parameters to pass to thread
- * @param lock Semaphore
- */
-void start_control_thread(ControlState* controlState, int* connectionFd,
-        int countControlParams,
-        struct ControlParam* controlParam, sem_t* lock) {
-    take_lock(lock);
-    pthread_t threadId;
-    if (countControlParams != 0) {
-        controlParam = realloc(controlParam, sizeof(struct ControlParam) *
-                (countControlParams + 1));
-    }
-    controlParam[countControlParams].controlState = malloc(
-            sizeof(WorldState*));
-    controlParam[countControlParams].controlState = controlState;
-    
-    controlParam[countControlParams].fileDescriptor = malloc(sizeof(int*));
-    controlParam[countControlParams].fileDescriptor = connectionFd;
-    
-    controlParam[countControlParams].guard = malloc(sizeof(sem_t*));
-    controlParam[countControlParams].guard = lock;
-    countControlParams++;
-    release_lock(lock);
-    pthread_create(&threadId, 0, control_doer,
-            &controlParam[countControlParams - 1]);
-}
-
-/** Starts a thread for a connection to the mapper program.
- *
- * @param worldState The Mapper state
- * @param connectionFd File descriptor to communicate with
- * @param countMapParams Thread index
- * @param par Thread parameter
- * @param lock Semaphore
- */
-void start_map_thread(WorldState* worldState, int* connectionFd,
-        int countMapParams, struct Param* par, sem_t* lock) {
-    take_lock(lock);
+        bool hasWorldState, bool hasControlState, int server, int port,
+        const ServerOptions* options) {
+    Server* state = malloc(sizeof(Server));
+    state->worldState = worldState;
+    state->controlState = controlState;
+    init_lock(&state->lock);
+    state->stats = calloc(1, sizeof(ServerStats));
     
-    pthread_t threadId;
-    
-    if (countMapParams != 0) {
-        par = realloc(par,
-                sizeof(struct Param) * (countMapParams + 1));
+    if (hasWorldState) {
+        // the start time and process id tell this run from every other
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        worldState->epoch = ((unsigned long) now.tv_sec * 1000000000UL +
+                (unsigned long) now.tv_nsec) ^
+                ((unsigned long) getpid() << 44);
+        worldState->watchers = malloc(sizeof(Broadcast));
+        init_broadcast(worldState->watchers);
+        init_reactor(&state->reactor, mapper_doer, state);
+        state->reactor.frameHandler = mapper_frame_doer;
+    } else if (hasControlState) {
+        init_reactor(&state->reactor, control_doer, state);
+        state->reactor.frameHandler = control_frame_doer;
     }
-    par[countMapParams].fileDescriptor = malloc(sizeof(int*));
-    par[countMapParams].fileDescriptor = connectionFd;
-    
-    par[countMapParams].guard = malloc(sizeof(sem_t*));
-    par[countMapParams].guard = lock;
+    state->reactor.idleTimeout = options->idleTimeout;
+    if (options->maxConnections > 0) {
+        state->reactor.maxConnections = options->maxConnections;
+    }
+    if (options->threads > 0) {
+        state->reactor.countWorkers = options->threads;
+    }
+    printf("%u\n", port);
+    fflush(stdout);
     
-    par[countMapParams].worldState = malloc(sizeof(WorldState*));
-    par[countMapParams].worldState = worldState;
-    countMapParams++;
-    release_lock(lock);
-    pthread_create(&threadId, 0, mapper_doer, &par[countMapParams - 1]);
+    // accept here and serve connections from the worker pool
+    run_reactor(&state->reactor, server);
 }
 
-/** Connects to mapper and sends id with port.
+/** Connects to the mapper shard owning the airport's id and sends id with
+ * port.
  *
  * @param controlState The state of the control program
  * @param port The port to connect to
  * @exit
- *    CTRL_MAP_CONNECTION_ERROR - Error connecting to mapper
+ *    CTRL_MAP_CONNECTION_ERROR - Error connecting to mapper, or a mapper
+ *    spoken to in frames did not take the port
  */
 void connect_to_mapper(const ControlState* controlState, int port) {
-    char message[100];
-    snprintf(message, 100, "!%s:%d\n", controlState->airportId, port);
-    int client = outbound_socket_maker(controlState->mapperPort);
+    // register with the shard owning the airport's id
+    bool framed = using_frames();
+    int client = outbound_socket_framed(ring_port(controlState->mappers,
+            controlState->airportId));
     
     // connection error
     if (client == -1) {
@@ -607,8 +1324,33 @@ void connect_to_mapper(const ControlState* controlState, int port) {
     }
     // write to server
     FILE* writer = fdopen(client, "w");
-    fprintf(writer, "%s", message);
-    fflush(writer);
+    if (framed) {
+        // wait for the reply so that the mapper knows the port before
+        // anyone is told it
+        size_t length = strlen(controlState->airportId) + 2;
+        char* payload = malloc(length);
+        frame_put_u16(payload, (uint16_t) port);
+        memcpy(payload + 2, controlState->airportId, length - 2);
+        Frame frame = {0, FRAME_REGISTER, payload, length};
+        bool sent = write_frame(writer, &frame) && fflush(writer) == 0;
+        
+        FILE* reader = fdopen(dup(client), "r");
+        char* buffer = NULL;
+        size_t capacity = 0;
+        bool registered = sent &&
+                read_frame(reader, &frame, &buffer, &capacity) &&
+                frame.code == FRAME_OK;
+        fclose(reader);
+        free(buffer);
+        free(payload);
+        // a mapper which did not take the port must not be relied on
+        if (!registered) {
+            control_exit(CTRL_MAP_CONNECTION_ERROR);
+        }
+    } else {
+        fprintf(writer, "!%s:%d\n", controlState->airportId, port);
+        fflush(writer);
+    }
     
     fclose(writer);
 }
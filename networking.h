@@ -9,9 +9,25 @@
 #include <stdlib.h>
 #include <semaphore.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "airports.h"
+#include "journal.h"
+#include "ring.h"
+#include "cache.h"
+#include "pool.h"
+#include "planes.h"
+#include "stats.h"
+#include "frame.h"
+#include "preload.h"
+#include "reactor.h"
 
 #define PORT_MAX_CHARS 6 // incl '\0'
 
+// most characters of a destination's info line a roc keeps, as
+// fgets(input, 80, ...) would
+#define VISIT_INFO_MAX 79
+
 /** Error codes for Roc. **/
 typedef enum RocErrorCodes {
     NORMAL_END = 0,
@@ -29,46 +45,100 @@ typedef enum ControlErrorCodes {
     CTRL_INVALID_CHARS = 2,
     CTRL_INVALID_PORT = 3,
     CTRL_MAP_CONNECTION_ERROR = 4,
+    CTRL_SPILL_ERROR = 5,
+    CTRL_LISTEN_ERROR = 6,
 } ControlErrorCodes;
 
-/** Representation of an Airport. **/
-typedef struct Airport {
-    // Airport ID
-    char* id;
+/** Progress of a roc's visit to one destination. **/
+typedef enum VisitStage {
+    VISIT_CONNECTING = 0,
+    VISIT_READING = 1,
+    VISIT_DONE = 2,
+    VISIT_FAILED = 3,
+    VISIT_HANDSHAKE = 4,
+    VISIT_SENDING = 5
+} VisitStage;
+
+/** A roc's visit to one destination, made alongside the others. **/
+typedef struct Visit {
+    // socket connected to the destination
+    int fd;
+
+    // how far the visit has got
+    VisitStage stage;
+
+    // true if the visit asks for, and speaks in, frames
+    bool framed;
 
-    // Airport info
-    char* info;
+    // number of bytes of the request sent so far
+    size_t sent;
 
-    // port which Airport is on
-    int port;
-} Airport;
+    // info line received from the destination, after the frame's length
+    // and header when framed
+    char reply[VISIT_INFO_MAX + 1 + FRAME_LENGTH_BYTES + FRAME_HEADER_BYTES];
 
-/** Representation of a plane for Roc. **/
-typedef struct Plane {
-    // plane id
-    char* id;
-} Plane;
+    // number of bytes in reply
+    size_t replyLength;
+} Visit;
 
 /** State of a mapper program **/
 typedef struct WorldState {
-    // List of known airports
+    // List of known airports, in the order they were added; an airport's
+    // place in the list, counting from 1, is its version
     Airport** airports;
 
-    // number of airports
+    // number of airports, which is also the mapper's version
     int countAirports;
 
+    // run of the mapper which versions belong to, as they are only
+    // comparable within one run
+    unsigned long epoch;
+
+    // number of airports at the front of the list restored from a
+    // snapshot, which are in id order rather than the order they were
+    // added
+    int restored;
+
+    // number of airports which the list has room for
+    int capacityAirports;
+
+    // index of airports by id
+    AirportTable table;
+
+    // airports in id order
+    AirportList ordered;
+
+    // durable record of registrations, NULL if the state is not kept
+    Journal* journal;
+
+    // connections told of each airport added, NULL if none may watch
+    Broadcast* watchers;
 } WorldState;
 
+/** A reply to a log-since, gathered under control's lock apart from the
+ * visits in the spill segment.
+ */
+typedef struct VisitsSince {
+    // sequence number of the last visit already seen, -1 if the cursor
+    // given was invalid
+    long since;
+
+    // ids of the visits after since held in memory, a line each, which
+    // follow the spilled ones
+    OutputBuffer recent;
+
+    // reader of the spilled visits, valid while spilled is true
+    SpillReader reader;
+    bool spilled;
+} VisitsSince;
+
 /** State of a control program **/
 typedef struct ControlState {
     // planes which controller has seen
-    Plane** planes;
-
-    // number of planes which controller has seen
-    int countPlanes;
+    PlaneRegistry planes;
 
-    // mapper port given in arg
-    int mapperPort;
+    // mapper shards given in arg, NULL if none were
+    MapperRing* mappers;
 
     // airport ID
     char* airportId;
@@ -77,49 +147,114 @@ typedef struct ControlState {
     char* airportInfo;
 } ControlState;
 
-/** Thread parameters for new mapper connection **/
-struct Param {
-    // file descriptor for new thread
-    int* fileDescriptor;
-    
-    // Mapper program state
+/** Options given on the command line of a mapper or control **/
+typedef struct ServerOptions {
+    // seconds a connection may be idle before it is closed, 0 for never
+    int idleTimeout;
+
+    // most connections served at once, 0 for as many as files allow
+    int maxConnections;
+
+    // number of worker threads, 0 for one per CPU
+    int threads;
+
+    // directory keeping the mapper's state across restarts, NULL for none
+    char* stateDirectory;
+
+    // directory of Unix domain sockets to connect through, NULL for TCP
+    char* socketDirectory;
+
+    // most visits control holds in memory, 0 for no limit
+    long retainVisits;
+
+    // file control writes evicted visits to, NULL to drop them
+    char* spillPath;
+
+    // most bytes the spill file grows to, 0 for SPILL_DEFAULT_MAX
+    long spillMax;
+
+    // file of mappings the mapper loads before serving, NULL for none
+    char* preloadPath;
+
+    // true if control speaks to the mapper in frames
+    bool framed;
+} ServerOptions;
+
+/** How the programs connect to one another. **/
+typedef struct Transport {
+    // directory holding a "<port>.sock" Unix domain socket for each port,
+    // NULL for TCP on loopback
+    char* socketDirectory;
+
+    // guards resolving loopback only once
+    pthread_once_t resolved;
+
+    // loopback address reused for every TCP connection
+    struct sockaddr_in loopback;
+
+    // true if servers are asked for frames rather than spoken to in lines
+    bool framed;
+} Transport;
+
+/** State shared by every connection to a mapper or control server **/
+typedef struct Server {
+    // Mapper program state, NULL for control
     WorldState* worldState;
-    
-    // Semaphore
-    sem_t* guard;
-};
-
-/** Thread parameters for new control connection **/
-struct ControlParam {
-    // File descriptor for new thread
-    int* fileDescriptor;
-    
-    // Control program state
+
+    // Control program state, NULL for mapper
     ControlState* controlState;
-    
-    // Semaphore
-    sem_t* guard;
-};
 
-void connect_to_mapper(const ControlState* controlState, int port);
+    // Lock guarding program state
+    pthread_rwlock_t lock;
 
-void start_map_thread(WorldState* worldState, int* connectionFd,
-        int countMapParams, struct Param* par, sem_t* lock);
+    // Event loop serving connections
+    Reactor reactor;
 
-void start_control_thread(ControlState* controlState, int* connectionFd,
-        int countControlParams, struct ControlParam* controlParam,
-        sem_t* lock);
+    // counters of commands handled
+    ServerStats* stats;
+} Server;
+
+void connect_to_mapper(const ControlState* controlState, int port);
 
 void thread_listener(WorldState* worldState, ControlState* controlState,
-        bool hasWorldState, bool hasControlState, int server, int port);
+        bool hasWorldState, bool hasControlState, int server, int port,
+        const ServerOptions* options);
 
-void do_mapper_query(char* input, WorldState* worldState, FILE* writeStream);
+void init_lock(pthread_rwlock_t* l);
+void do_mapper_query(char* input, WorldState* worldState,
+        OutputBuffer* output);
+bool check_control_string(char* input, Server* server,
+        OutputBuffer* output);
 
 void add_mapping(char* input, WorldState* worldState);
+bool parse_port(const char* port, int* value);
+bool register_airport(WorldState* worldState, char* id, int port);
+void init_world_state(WorldState* worldState);
+void add_airport(char* id, int port, WorldState* worldState);
+Airport* get_airport(WorldState* worldState, char* id);
+Airport* find_mapping(WorldState* worldState, const char* id,
+        size_t length);
+bool valid_mapping(const char* id, size_t length, int port);
+void print_mappings(WorldState* worldState, OutputBuffer* output);
+void print_prefix_mappings(WorldState* worldState, char* prefix,
+        OutputBuffer* output);
+void print_mappings_since(WorldState* worldState, char* cursor,
+        OutputBuffer* output);
+void print_stats(Server* server, OutputBuffer* output);
 void control_exit(ControlErrorCodes errorCode);
 void roc_exit(RocErrorCodes errorCode);
-void setup_sockets(WorldState* worldState, ControlState* controlState);
+bool socket_path_in_use(const struct sockaddr_storage* address,
+        socklen_t length);
+bool setup_sockets(WorldState* worldState, ControlState* controlState,
+        const ServerOptions* options);
+int parse_server_options(int argc, char** argv, ServerOptions* options);
+bool init_transport(char* socketDirectory);
+void use_frames(void);
+bool using_frames(void);
+socklen_t port_address(int port, struct sockaddr_storage* address);
 int outbound_socket_maker(int mapperPort);
+int outbound_socket_start(int port);
+int outbound_socket_framed(int port);
 void allocate_airports(WorldState* worldState);
 
 #endif
\ No newline at end of file
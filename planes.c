@@ -0,0 +1,649 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "airports.h"
+#include "planes.h"
+
+// smallest number of slots allocated for a registry's index
+#define REGISTRY_MIN_SLOTS 64
+
+/** Initializes an empty plane registry which keeps every visit.
+ *
+ * @param registry Registry to initialize
+ */
+void init_plane_registry(PlaneRegistry* registry) {
+    registry->planes = NULL;
+    registry->countPlanes = 0;
+    registry->capacityPlanes = 0;
+    registry->livePlanes = 0;
+    registry->slots = NULL;
+    registry->capacitySlots = 0;
+    registry->ordered = NULL;
+    registry->sorted = true;
+    registry->visits = 0;
+    registry->oldest = 1;
+    registry->retain = 0;
+    registry->history = NULL;
+    registry->capacityHistory = 0;
+    init_string_pool(&registry->ids);
+    registry->spill = NULL;
+    registry->spillPath = NULL;
+    registry->spilled = 0;
+    registry->spillDropped = 0;
+    registry->spillMax = SPILL_DEFAULT_MAX;
+    registry->spillBlocks = NULL;
+    registry->countSpillBlocks = 0;
+    registry->capacitySpillBlocks = 0;
+    registry->spillCodes = 0;
+}
+
+/** Limits the visits a registry holds in memory. Must be called before the
+ * first visit.
+ *
+ * @param registry Registry to limit
+ * @param retain Most visits held in memory, 0 for no limit
+ * @param spillPath File to write evicted visits to, replacing any earlier
+ *        contents, or NULL to drop them
+ * @param spillMax Most bytes the spill file grows to before its older half
+ *        is dropped, 0 for SPILL_DEFAULT_MAX
+ * @return false if the spill file cannot be created
+ */
+bool plane_registry_retain(PlaneRegistry* registry, long retain,
+        char* spillPath, long spillMax) {
+    registry->retain = retain;
+    if (spillMax > 0) {
+        registry->spillMax = spillMax;
+    }
+    if (retain > 0) {
+        // the ring never grows, so it is allocated whole
+        registry->history = malloc(sizeof(int) * retain);
+        registry->capacityHistory = retain;
+    }
+    if (spillPath != NULL) {
+        registry->spill = fopen(spillPath, "w");
+        registry->spillPath = spillPath;
+        return registry->spill != NULL;
+    }
+    return true;
+}
+
+/** Moves the registry's planes into an index of the given size.
+ *
+ * @param registry Registry to reindex
+ * @param capacity New number of slots, a power of two with room for more
+ *        than the registry's planes
+ */
+void resize_plane_slots(PlaneRegistry* registry, size_t capacity) {
+    int* slots = calloc(capacity, sizeof(int));
+    size_t mask = capacity - 1;
+    for (int i = 0; i < registry->countPlanes; ++i) {
+        size_t index = (size_t) registry->planes[i].hash & mask;
+        while (slots[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        slots[index] = i + 1;
+    }
+    free(registry->slots);
+    registry->slots = slots;
+    registry->capacitySlots = capacity;
+}
+
+/** Writes a number to a spill segment, seven bits to a byte.
+ *
+ * @param file Segment to write to
+ * @param value Number to write
+ */
+void write_varint(FILE* file, unsigned long value) {
+    while (value >= 0x80) {
+        putc((int) (value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    putc((int) value, file);
+}
+
+/** Reads a number written by write_varint.
+ *
+ * @param file Segment to read from
+ * @param value Where to store the number
+ * @return false at the end of the segment
+ */
+bool read_varint(FILE* file, unsigned long* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = getc(file);
+        if (byte == EOF) {
+            return false;
+        }
+        *value |= (unsigned long) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Drops the older half of the spill segment's blocks by copying the rest
+ * to a new file which takes its place. Readers which opened the segment
+ * before go on reading the old file. Half of what was written is copied
+ * each time the segment reaches spillMax, so each byte is copied a
+ * bounded number of times.
+ *
+ * @param registry Registry whose spill segment has reached spillMax bytes
+ * @return Size of the segment in bytes, trimmed unless copying failed
+ */
+long trim_spill(PlaneRegistry* registry) {
+    long size = ftell(registry->spill);
+    int drop = registry->countSpillBlocks / 2;
+    long from = registry->spillBlocks[drop];
+    size_t length = strlen(registry->spillPath) + 8;
+    char* temporary = malloc(length);
+    snprintf(temporary, length, "%s.trim", registry->spillPath);
+    fflush(registry->spill);
+    FILE* source = fopen(registry->spillPath, "r");
+    FILE* copy = fopen(temporary, "w");
+    bool copied = source != NULL && copy != NULL &&
+            fseek(source, from, SEEK_SET) == 0;
+    char buffer[16 * 1024];
+    size_t got;
+    while (copied && (got = fread(buffer, 1, sizeof(buffer), source)) > 0) {
+        copied = fwrite(buffer, 1, got, copy) == got;
+    }
+    copied = copied && ferror(source) == 0;
+    if (source != NULL) {
+        fclose(source);
+    }
+    if (copy != NULL && fclose(copy) != 0) {
+        copied = false;
+    }
+    // opened before it is renamed, so that the stream follows the file
+    FILE* trimmed = copied ? fopen(temporary, "a") : NULL;
+    if (trimmed == NULL || rename(temporary, registry->spillPath) != 0) {
+        if (trimmed != NULL) {
+            fclose(trimmed);
+        }
+        unlink(temporary);
+        free(temporary);
+        return size;
+    }
+    free(temporary);
+    fclose(registry->spill);
+    registry->spill = trimmed;
+    fseek(registry->spill, 0, SEEK_END);
+
+    registry->countSpillBlocks -= drop;
+    for (int i = 0; i < registry->countSpillBlocks; ++i) {
+        registry->spillBlocks[i] = registry->spillBlocks[i + drop] - from;
+    }
+    registry->spillDropped += (long) drop * SPILL_BLOCK_VISITS;
+    return size - from;
+}
+
+/** Starts a block of the spill segment, which gives out its codes afresh,
+ * trimming the segment first if it has reached spillMax bytes.
+ *
+ * @param registry Registry with a spill segment
+ */
+void start_spill_block(PlaneRegistry* registry) {
+    long offset = ftell(registry->spill);
+    if (offset >= registry->spillMax && registry->countSpillBlocks > 1) {
+        offset = trim_spill(registry);
+    }
+    if (registry->countSpillBlocks == registry->capacitySpillBlocks) {
+        registry->capacitySpillBlocks = registry->capacitySpillBlocks == 0 ?
+                64 : registry->capacitySpillBlocks * 2;
+        registry->spillBlocks = realloc(registry->spillBlocks,
+                sizeof(long) * registry->capacitySpillBlocks);
+    }
+    registry->spillBlocks[registry->countSpillBlocks++] = offset;
+    registry->spillCodes = 0;
+}
+
+/** Evicts the oldest visit held in memory, spilling it if the registry has
+ * a spill segment. A plane's first spilled visit in a block is written as
+ * 0, the length of its id and the id, which gives the plane the block's
+ * next code; later ones in the block are written as the code plus one.
+ *
+ * @param registry Registry whose memory is full
+ */
+void evict_oldest(PlaneRegistry* registry) {
+    long slot = (registry->oldest - 1) % registry->capacityHistory;
+    Plane* plane = &registry->planes[registry->history[slot]];
+    if (registry->spill != NULL) {
+        if (registry->spilled % SPILL_BLOCK_VISITS == 0) {
+            start_spill_block(registry);
+        }
+        long block = registry->spilled / SPILL_BLOCK_VISITS;
+        if (plane->spillCode == -1 || plane->spillBlock != block) {
+            size_t length = strlen(plane->id);
+            plane->spillCode = registry->spillCodes++;
+            plane->spillBlock = block;
+            write_varint(registry->spill, 0);
+            write_varint(registry->spill, length);
+            fwrite(plane->id, 1, length, registry->spill);
+        } else {
+            write_varint(registry->spill, (unsigned long) plane->spillCode + 1);
+        }
+        registry->spilled++;
+    }
+    plane->count--;
+    if (plane->count == 0) {
+        registry->livePlanes--;
+    }
+    registry->oldest++;
+}
+
+/** Drops the planes left with no visits in memory, along with their ids.
+ *
+ * @param registry Registry to compact
+ */
+void compact_planes(PlaneRegistry* registry) {
+    int* remap = malloc(sizeof(int) * registry->countPlanes);
+    int capacity = registry->livePlanes * 2 < 64 ? 64 :
+            registry->livePlanes * 2;
+    Plane* planes = malloc(sizeof(Plane) * capacity);
+    StringPool ids;
+    init_string_pool(&ids);
+
+    int live = 0;
+    for (int i = 0; i < registry->countPlanes; ++i) {
+        Plane* plane = &registry->planes[i];
+        if (plane->count == 0) {
+            remap[i] = -1;
+            continue;
+        }
+        planes[live] = *plane;
+        planes[live].id = pool_copy(&ids, plane->id, strlen(plane->id));
+        remap[i] = live++;
+    }
+    free(registry->planes);
+    free_string_pool(&registry->ids);
+    registry->planes = planes;
+    registry->countPlanes = live;
+    registry->capacityPlanes = capacity;
+    registry->ids = ids;
+
+    size_t capacitySlots = REGISTRY_MIN_SLOTS;
+    while ((size_t) (live + 1) * 2 > capacitySlots) {
+        capacitySlots *= 2;
+    }
+    free(registry->slots);
+    registry->slots = NULL;
+    registry->capacitySlots = 0;
+    resize_plane_slots(registry, capacitySlots);
+
+    for (long i = registry->oldest; i <= registry->visits; ++i) {
+        long slot = (i - 1) % registry->capacityHistory;
+        registry->history[slot] = remap[registry->history[slot]];
+    }
+    free(remap);
+    registry->sorted = false;
+}
+
+/** Records a visit by a plane, adding the plane if it has not visited
+ * before.
+ *
+ * @param registry Registry to record in
+ * @param id Plane id, need not be null terminated
+ * @param length Number of characters in id
+ */
+void plane_registry_visit(PlaneRegistry* registry, const char* id,
+        size_t length) {
+    long sequence = ++registry->visits;
+    if (registry->retain > 0 &&
+            registry->visits - registry->oldest + 1 > registry->retain) {
+        evict_oldest(registry);
+    } else if (registry->visits > registry->capacityHistory) {
+        // with no limit nothing is evicted, so the ring never wraps
+        registry->capacityHistory = registry->capacityHistory == 0 ? 1024 :
+                registry->capacityHistory * 2;
+        registry->history = realloc(registry->history,
+                sizeof(int) * registry->capacityHistory);
+    }
+    long slot = (sequence - 1) % registry->capacityHistory;
+
+    // keep load factor at or below one half
+    if ((size_t) (registry->countPlanes + 1) * 2 > registry->capacitySlots) {
+        resize_plane_slots(registry, registry->capacitySlots == 0 ?
+                REGISTRY_MIN_SLOTS : registry->capacitySlots * 2);
+    }
+    uint64_t hash = hash_id(id, length);
+    size_t mask = registry->capacitySlots - 1;
+    size_t index = (size_t) hash & mask;
+    while (registry->slots[index] != 0) {
+        Plane* plane = &registry->planes[registry->slots[index] - 1];
+        if (plane->hash == hash && strncmp(plane->id, id, length) == 0 &&
+                plane->id[length] == '\0') {
+            if (plane->count == 0) {
+                registry->livePlanes++;
+            }
+            plane->count++;
+            plane->lastSeen = sequence;
+            registry->history[slot] = registry->slots[index] - 1;
+            return;
+        }
+        index = (index + 1) & mask;
+    }
+
+    // a plane not seen before, grown geometrically
+    if (registry->countPlanes == registry->capacityPlanes) {
+        registry->capacityPlanes = registry->capacityPlanes == 0 ? 64 :
+                registry->capacityPlanes * 2;
+        registry->planes = realloc(registry->planes,
+                sizeof(Plane) * registry->capacityPlanes);
+    }
+    Plane* plane = &registry->planes[registry->countPlanes];
+    plane->id = pool_copy(&registry->ids, id, length);
+    plane->hash = hash;
+    plane->count = 1;
+    plane->firstSeen = sequence;
+    plane->lastSeen = sequence;
+    plane->spillCode = -1;
+    plane->spillBlock = -1;
+    registry->history[slot] = registry->countPlanes;
+    registry->countPlanes++;
+    registry->livePlanes++;
+    registry->slots[index] = registry->countPlanes;
+    registry->sorted = false;
+
+    // drop planes once they outnumber the live ones, so that each is
+    // copied a bounded number of times
+    int dead = registry->countPlanes - registry->livePlanes;
+    if (dead > registry->livePlanes && dead >= REGISTRY_MIN_SLOTS) {
+        compact_planes(registry);
+    }
+}
+
+/** For plane qsort.
+ *
+ * @param a Plane one
+ * @param b Plane two
+ * @return < 0 if first goes before second, 0 if equal, > 0 otherwise
+ */
+int plane_cmp_func(const void* a, const void* b) {
+    const Plane* first = *(Plane* const*) a;
+    const Plane* second = *(Plane* const*) b;
+    return strcmp(first->id, second->id);
+}
+
+/** Lists the registry's planes in id order, including those with no visits
+ * in memory. The order is only worked out again once a new plane has
+ * visited.
+ *
+ * @param registry Registry to list
+ * @return countPlanes planes in id order, valid until the next visit
+ */
+Plane** plane_registry_sorted(PlaneRegistry* registry) {
+    if (!registry->sorted) {
+        free(registry->ordered);
+        registry->ordered = malloc(sizeof(Plane*) *
+                (registry->countPlanes + 1));
+        for (int i = 0; i < registry->countPlanes; ++i) {
+            registry->ordered[i] = &registry->planes[i];
+        }
+        qsort(registry->ordered, registry->countPlanes, sizeof(Plane*),
+                plane_cmp_func);
+        registry->sorted = true;
+    }
+    return registry->ordered;
+}
+
+/** Finds the plane which made a visit held in memory.
+ *
+ * @param registry Registry to search
+ * @param sequence Sequence number of the visit, from oldest to visits
+ * @return Plane which made the visit
+ */
+const Plane* plane_registry_visitor(const PlaneRegistry* registry,
+        long sequence) {
+    long slot = (sequence - 1) % registry->capacityHistory;
+    return &registry->planes[registry->history[slot]];
+}
+
+/** Starts reading back the registry's spill segment at the block holding
+ * the first visit after a cursor, or at its first block if that visit has
+ * been dropped. Called under the registry's lock; the visits spilled so
+ * far may then be read without it, as the file opened is only ever
+ * appended to, and a trimmed segment is a new file.
+ *
+ * @param registry Registry with a spill segment
+ * @param reader Reader to start
+ * @param since Sequence number of the last visit not wanted, 0 for all
+ * @return false if the segment cannot be read
+ */
+bool open_spill_reader(PlaneRegistry* registry, SpillReader* reader,
+        long since) {
+    fflush(registry->spill);
+    reader->file = fopen(registry->spillPath, "r");
+    reader->ids = NULL;
+    reader->countIds = 0;
+    reader->capacityIds = 0;
+    init_string_pool(&reader->pool);
+    reader->defined = false;
+
+    // the blocks before the one holding the cursor are skipped unread
+    long block = 0;
+    if (since > registry->spillDropped) {
+        block = (since - registry->spillDropped) / SPILL_BLOCK_VISITS;
+    }
+    if (block >= registry->countSpillBlocks) {
+        block = registry->countSpillBlocks > 0 ?
+                registry->countSpillBlocks - 1 : 0;
+    }
+    reader->sequence = registry->spillDropped + block * SPILL_BLOCK_VISITS;
+    reader->remaining = registry->spilled - reader->sequence;
+    return reader->file != NULL && (registry->countSpillBlocks == 0 ||
+            fseek(reader->file, registry->spillBlocks[block],
+            SEEK_SET) == 0);
+}
+
+/** Reads the next visit from a spill segment.
+ *
+ * @param reader Reader of the segment
+ * @return Code of the plane which made the visit, whose id is
+ *         reader->ids[code] until the block ends, or -1 once every visit
+ *         has been read
+ */
+int spill_next(SpillReader* reader) {
+    if (reader->remaining == 0) {
+        return -1;
+    }
+    // each block gives out its codes afresh
+    if (reader->sequence % SPILL_BLOCK_VISITS == 0) {
+        reader->countIds = 0;
+        free_string_pool(&reader->pool);
+    }
+    unsigned long value;
+    if (!read_varint(reader->file, &value)) {
+        return -1;
+    }
+    reader->remaining--;
+    reader->sequence++;
+    reader->defined = value == 0;
+    if (value > 0) {
+        return value <= (unsigned long) reader->countIds ? (int) value - 1 :
+                -1;
+    }
+
+    // a plane's first visit carries its id
+    unsigned long length;
+    if (!read_varint(reader->file, &length)) {
+        return -1;
+    }
+    if (reader->countIds == reader->capacityIds) {
+        reader->capacityIds = reader->capacityIds == 0 ? 64 :
+                reader->capacityIds * 2;
+        reader->ids = realloc(reader->ids,
+                sizeof(char*) * reader->capacityIds);
+    }
+    char* id = malloc(length + 1);
+    if (fread(id, 1, length, reader->file) != length) {
+        free(id);
+        return -1;
+    }
+    reader->ids[reader->countIds] = pool_copy(&reader->pool, id, length);
+    free(id);
+    return reader->countIds++;
+}
+
+/** Finishes reading a spill segment.
+ *
+ * @param reader Reader to close
+ */
+void close_spill_reader(SpillReader* reader) {
+    if (reader->file != NULL) {
+        fclose(reader->file);
+    }
+    free(reader->ids);
+    free_string_pool(&reader->pool);
+}
+
+/** For tally qsort.
+ *
+ * @param a Entry one
+ * @param b Entry two
+ * @return < 0 if first goes before second, 0 if equal, > 0 otherwise
+ */
+int tally_cmp_func(const void* a, const void* b) {
+    return strcmp(((const TallyEntry*) a)->id, ((const TallyEntry*) b)->id);
+}
+
+/** Counts the visits each plane has held in memory, and starts reading
+ * back those in the spill segment. Called under the registry's lock.
+ *
+ * @param registry Registry to count
+ * @param tally Where to store the counts, to be finished by
+ *        finish_plane_tally once the lock is released
+ */
+void plane_registry_tally(PlaneRegistry* registry, PlaneTally* tally) {
+    Plane** ordered = plane_registry_sorted(registry);
+    init_string_pool(&tally->ids);
+    tally->capacityEntries = registry->livePlanes + 1;
+    tally->entries = malloc(sizeof(TallyEntry) * tally->capacityEntries);
+    tally->countEntries = 0;
+    for (int i = 0; i < registry->countPlanes; ++i) {
+        if (ordered[i]->count > 0) {
+            // planes may be dropped as soon as the lock is released
+            TallyEntry* entry = &tally->entries[tally->countEntries++];
+            entry->id = pool_copy(&tally->ids, ordered[i]->id,
+                    strlen(ordered[i]->id));
+            entry->count = ordered[i]->count;
+        }
+    }
+    tally->spilled = registry->spilled > 0 &&
+            open_spill_reader(registry, &tally->reader, 0);
+}
+
+/** Indexes a tally's entries by id in a slot array of the given size.
+ *
+ * @param tally Tally to index
+ * @param slots Slots to fill, holding index + 1 of each entry, 0 when
+ *        empty
+ * @param capacity Number of slots, a power of two with room for more than
+ *        the tally's entries
+ */
+void index_tally(const PlaneTally* tally, int* slots, size_t capacity) {
+    size_t mask = capacity - 1;
+    memset(slots, 0, sizeof(int) * capacity);
+    for (int i = 0; i < tally->countEntries; ++i) {
+        const char* id = tally->entries[i].id;
+        size_t index = (size_t) hash_id(id, strlen(id)) & mask;
+        while (slots[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        slots[index] = i + 1;
+    }
+}
+
+/** Finds a plane's entry in a tally, adding one with no visits if it has
+ * none.
+ *
+ * @param tally Tally to search
+ * @param slots Index of the tally's entries, grown as needed
+ * @param capacity Number of slots
+ * @param id Plane id
+ * @return Index of the plane's entry
+ */
+int tally_entry(PlaneTally* tally, int** slots, size_t* capacity,
+        const char* id) {
+    size_t length = strlen(id);
+    uint64_t hash = hash_id(id, length);
+    size_t mask = *capacity - 1;
+    size_t index = (size_t) hash & mask;
+    while ((*slots)[index] != 0) {
+        if (strcmp(tally->entries[(*slots)[index] - 1].id, id) == 0) {
+            return (*slots)[index] - 1;
+        }
+        index = (index + 1) & mask;
+    }
+    if (tally->countEntries == tally->capacityEntries) {
+        tally->capacityEntries *= 2;
+        tally->entries = realloc(tally->entries,
+                sizeof(TallyEntry) * tally->capacityEntries);
+    }
+    TallyEntry* entry = &tally->entries[tally->countEntries];
+    entry->id = pool_copy(&tally->ids, id, length);
+    entry->count = 0;
+    (*slots)[index] = ++tally->countEntries;
+
+    // keep load factor at or below one half
+    if ((size_t) tally->countEntries * 2 > *capacity) {
+        *capacity *= 2;
+        *slots = realloc(*slots, sizeof(int) * *capacity);
+        index_tally(tally, *slots, *capacity);
+    }
+    return tally->countEntries - 1;
+}
+
+/** Adds the visits in the spill segment to a tally. Called without the
+ * registry's lock.
+ *
+ * @param tally Tally started by plane_registry_tally
+ */
+void finish_plane_tally(PlaneTally* tally) {
+    if (!tally->spilled) {
+        return;
+    }
+    tally->spilled = false;
+    SpillReader* reader = &tally->reader;
+
+    // codes are given out afresh in each block, so each code is matched to
+    // its plane's entry by id when it is given out
+    size_t capacity = 64;
+    while ((size_t) (tally->countEntries + 1) * 2 > capacity) {
+        capacity *= 2;
+    }
+    int* slots = malloc(sizeof(int) * capacity);
+    index_tally(tally, slots, capacity);
+    int* entryOf = NULL;
+    int capacityEntryOf = 0;
+    int code;
+    while ((code = spill_next(reader)) != -1) {
+        if (reader->defined) {
+            if (code >= capacityEntryOf) {
+                capacityEntryOf = capacityEntryOf == 0 ? 64 :
+                        capacityEntryOf * 2;
+                entryOf = realloc(entryOf, sizeof(int) * capacityEntryOf);
+            }
+            entryOf[code] = tally_entry(tally, &slots, &capacity,
+                    reader->ids[code]);
+        }
+        tally->entries[entryOf[code]].count++;
+    }
+    free(entryOf);
+    free(slots);
+    close_spill_reader(reader);
+    qsort(tally->entries, tally->countEntries, sizeof(TallyEntry),
+            tally_cmp_func);
+}
+
+/** Frees a tally.
+ *
+ * @param tally Tally to free
+ */
+void free_plane_tally(PlaneTally* tally) {
+    if (tally->spilled) {
+        close_spill_reader(&tally->reader);
+    }
+    free(tally->entries);
+    free_string_pool(&tally->ids);
+}
@@ -0,0 +1,175 @@
+#ifndef PLANES_H
+#define PLANES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pool.h"
+
+// visits in each block of a spill segment; a block gives out its own codes,
+// so reading may start at any block
+#define SPILL_BLOCK_VISITS 4096
+
+// most bytes a spill segment grows to unless told otherwise
+#define SPILL_DEFAULT_MAX (256L * 1024 * 1024)
+
+/** A plane which has visited control. **/
+typedef struct Plane {
+    // plane id
+    char* id;
+
+    // cached hash of id
+    uint64_t hash;
+
+    // number of the plane's visits still held in memory
+    long count;
+
+    // sequence numbers of the plane's first and latest visits
+    long firstSeen;
+    long lastSeen;
+
+    // code standing for the plane in the spill segment's block spillBlock,
+    // -1 if it has none
+    int spillCode;
+    long spillBlock;
+} Plane;
+
+/** Distinct planes which have visited control, indexed by id. Once more
+ * visits have been made than are retained, the oldest is evicted for
+ * each new one, and written to the spill segment if there is one. Planes
+ * left with no visits in memory are dropped in batches.
+ */
+typedef struct PlaneRegistry {
+    // planes in order of first visit
+    Plane* planes;
+
+    // number of planes
+    int countPlanes;
+
+    // number of planes which the list has room for
+    int capacityPlanes;
+
+    // number of planes with visits still held in memory
+    int livePlanes;
+
+    // open addressing index of planes by id, holding index + 1 of each
+    // plane, 0 when empty
+    int* slots;
+
+    // number of slots, always zero or a power of two
+    size_t capacitySlots;
+
+    // planes in id order, valid while sorted is true
+    Plane** ordered;
+    bool sorted;
+
+    // number of visits ever, the sequence number of the latest
+    long visits;
+
+    // sequence number of the oldest visit held in memory
+    long oldest;
+
+    // most visits held in memory, 0 for no limit
+    long retain;
+
+    // index of the plane making each visit held in memory, as a ring, so
+    // that visit n is history[(n - 1) % capacityHistory]
+    int* history;
+    long capacityHistory;
+
+    // storage for plane ids
+    StringPool ids;
+
+    // dictionary coded record of evicted visits, NULL if they are dropped;
+    // it is appended to, one to three bytes a visit plus each plane's id
+    // once a block, and read back without the lock
+    FILE* spill;
+    char* spillPath;
+
+    // number of visits ever written to the spill segment, always
+    // oldest - 1 when there is one
+    long spilled;
+
+    // number of visits dropped from the front of the segment to keep it
+    // under spillMax bytes, a whole number of blocks
+    long spillDropped;
+    long spillMax;
+
+    // byte offset in the segment of each block still in it, oldest first
+    long* spillBlocks;
+    int countSpillBlocks;
+    int capacitySpillBlocks;
+
+    // number of codes given out in the block being written
+    int spillCodes;
+} PlaneRegistry;
+
+/** Reads back the visits of a spill segment in the order they were made. **/
+typedef struct SpillReader {
+    // segment being read
+    FILE* file;
+
+    // id of each code met so far
+    char** ids;
+    int countIds;
+    int capacityIds;
+
+    // storage for ids
+    StringPool pool;
+
+    // number of visits still to be read
+    long remaining;
+
+    // sequence number of the visit last read
+    long sequence;
+
+    // true if the visit last read gave its plane a new code
+    bool defined;
+} SpillReader;
+
+/** Number of visits made by one plane. **/
+typedef struct TallyEntry {
+    // plane id
+    const char* id;
+
+    // number of visits
+    long count;
+} TallyEntry;
+
+/** Visits made by each plane, whether held in memory or spilled. The
+ * visits in memory are counted under the registry's lock and the spilled
+ * ones after it is released.
+ */
+typedef struct PlaneTally {
+    // planes in id order
+    TallyEntry* entries;
+    int countEntries;
+    int capacityEntries;
+
+    // storage for ids
+    StringPool ids;
+
+    // reader of the spilled visits still to be counted, valid while
+    // spilled is true
+    SpillReader reader;
+    bool spilled;
+} PlaneTally;
+
+void init_plane_registry(PlaneRegistry* registry);
+bool plane_registry_retain(PlaneRegistry* registry, long retain,
+        char* spillPath, long spillMax);
+void plane_registry_visit(PlaneRegistry* registry, const char* id,
+        size_t length);
+Plane** plane_registry_sorted(PlaneRegistry* registry);
+const Plane* plane_registry_visitor(const PlaneRegistry* registry,
+        long sequence);
+bool open_spill_reader(PlaneRegistry* registry, SpillReader* reader,
+        long since);
+int spill_next(SpillReader* reader);
+void close_spill_reader(SpillReader* reader);
+void plane_registry_tally(PlaneRegistry* registry, PlaneTally* tally);
+void finish_plane_tally(PlaneTally* tally);
+void free_plane_tally(PlaneTally* tally);
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+/** Initializes an empty string pool.
+ *
+ * @param pool Pool to initialize
+ */
+void init_string_pool(StringPool* pool) {
+    pool->current = NULL;
+    pool->reserved = 0;
+}
+
+/** Copies a string into the pool.
+ *
+ * @param pool Pool to copy into
+ * @param string String to copy, need not be null terminated
+ * @param length Number of characters in string
+ * @return Null terminated copy, valid for as long as the pool
+ */
+char* pool_copy(StringPool* pool, const char* string, size_t length) {
+    PoolBlock* block = pool->current;
+    if (block == NULL || block->capacity - block->used < length + 1) {
+        size_t capacity = length + 1 > POOL_BLOCK_SIZE ? length + 1 :
+                POOL_BLOCK_SIZE;
+        block = malloc(sizeof(PoolBlock) + capacity);
+        block->used = 0;
+        block->capacity = capacity;
+        pool->reserved += capacity;
+
+        // a string longer than a block gets a block to itself, kept behind
+        // the current one so that its free space is not abandoned
+        if (capacity > POOL_BLOCK_SIZE && pool->current != NULL) {
+            block->previous = pool->current->previous;
+            pool->current->previous = block;
+        } else {
+            block->previous = pool->current;
+            pool->current = block;
+        }
+    }
+    char* copy = block->data + block->used;
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    block->used += length + 1;
+    return copy;
+}
+
+/** Frees every string of the pool, leaving it empty.
+ *
+ * @param pool Pool to free
+ */
+void free_string_pool(StringPool* pool) {
+    while (pool->current != NULL) {
+        PoolBlock* previous = pool->current->previous;
+        free(pool->current);
+        pool->current = previous;
+    }
+    pool->reserved = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// smallest block carved up by a string pool
+#define POOL_BLOCK_SIZE (64 * 1024)
+
+/** A block of a string pool. **/
+typedef struct PoolBlock {
+    // block allocated before this one
+    struct PoolBlock* previous;
+
+    // number of bytes of data handed out
+    size_t used;
+
+    // number of bytes data has room for
+    size_t capacity;
+
+    // strings, packed one after another
+    char data[];
+} PoolBlock;
+
+/** Bump allocator for strings which are freed all together. Strings are
+ * copied in end to end, so they carry no allocator header of their own.
+ */
+typedef struct StringPool {
+    // block strings are currently copied into, NULL before the first
+    PoolBlock* current;
+
+    // number of bytes of every block together
+    size_t reserved;
+} StringPool;
+
+void init_string_pool(StringPool* pool);
+char* pool_copy(StringPool* pool, const char* string, size_t length);
+void free_string_pool(StringPool* pool);
+
+#endif
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "networking.h"
+
+/** Compares airports by id, for qsort.
+ *
+ * @param a Pointer to the first airport
+ * @param b Pointer to the second airport
+ * @return < 0, 0 or > 0 as the first id goes before, equals or goes after
+ *         the second
+ */
+int compare_airport_ids(const void* a, const void* b) {
+    return strcmp((*(Airport* const*) a)->id, (*(Airport* const*) b)->id);
+}
+
+/** Adds an airport read from a mappings file to the index by id, unless
+ * its id is known already, as registering it would.
+ *
+ * @param worldState Mapper program state
+ * @param batch Airports read so far
+ * @param id Airport id, null terminated, kept by the airport
+ * @param length Number of characters in id
+ * @param port Airport port
+ * @return false if the id was known already
+ */
+bool preload_airport(WorldState* worldState, PreloadBatch* batch, char* id,
+        size_t length, int port) {
+    uint64_t hash = hash_id(id, length);
+    if (airport_table_find(&worldState->table, id, length, hash) != NULL) {
+        return false;
+    }
+    Airport* airport = &batch->block[batch->count];
+    airport->id = id;
+    airport->info = NULL;
+    airport->port = port;
+    airport->hash = hash;
+    airport_table_insert(&worldState->table, airport);
+    batch->added[batch->count++] = airport;
+    return true;
+}
+
+/** Reads "id:port" lines, as found in a journal. Lines which a
+ * registration would not accept, as checked by valid_mapping, are skipped.
+ *
+ * @param worldState Mapper program state
+ * @param batch Airports read so far
+ * @param map Mapped file, split into ids in place
+ * @param size Number of bytes in map
+ */
+void preload_lines(WorldState* worldState, PreloadBatch* batch, char* map,
+        size_t size) {
+    size_t start = 0;
+    while (start < size) {
+        char* line = map + start;
+        char* newline = memchr(line, '\n', size - start);
+        size_t length = newline == NULL ? size - start :
+                (size_t) (newline - line);
+        start += length + 1;
+        if (newline != NULL) {
+            *newline = '\0';
+        } else {
+            // the last line has no '\n' to end it in place
+            line = malloc(length + 1);
+            memcpy(line, map + start - length - 1, length);
+            line[length] = '\0';
+        }
+
+        char* colonLocation = memchr(line, ':', length);
+        int port;
+        bool added = false;
+        if (colonLocation != NULL) {
+            *colonLocation = '\0';
+            added = parse_port(colonLocation + 1, &port) &&
+                    valid_mapping(line, (size_t) (colonLocation - line),
+                    port) && preload_airport(worldState, batch, line,
+                    (size_t) (colonLocation - line), port);
+        }
+        if (newline == NULL && !added) {
+            free(line);
+        }
+    }
+}
+
+/** Reads the records of a file laid out as a snapshot. Unlike a snapshot
+ * they may come in any order, and repeated ids are skipped. Records are
+ * checked as a registration would be; as they cannot have been written by
+ * a mapper, one failing rejects the whole file.
+ *
+ * @param worldState Mapper program state
+ * @param batch Airports read so far
+ * @param map Mapped file
+ * @param size Number of bytes in map
+ * @param count Number of records, as given by the file's header
+ * @return false if a record runs past the end, a registration would not
+ *         accept it, or bytes are left over
+ */
+bool preload_records(WorldState* worldState, PreloadBatch* batch, char* map,
+        size_t size, size_t count) {
+    size_t offset = sizeof(SnapshotHeader);
+    for (size_t i = 0; i < count; ++i) {
+        int port;
+        size_t length;
+        char* id = read_snapshot_record(map, size, &offset, &port, &length);
+        if (id == NULL || !valid_mapping(id, length, port)) {
+            return false;
+        }
+        preload_airport(worldState, batch, id, length, port);
+    }
+    return offset == size;
+}
+
+/** Adds the airports read to the list of airports and to the ordered
+ * index, and writes them to a snapshot if the state is kept.
+ *
+ * @param worldState Mapper program state
+ * @param batch Airports read, already in the index by id
+ * @return false if the snapshot could not be written
+ */
+bool finish_preload(WorldState* worldState, PreloadBatch* batch) {
+    // the list of airports keeps the order they were read in
+    int total = worldState->countAirports + (int) batch->count;
+    if (total > worldState->capacityAirports) {
+        worldState->airports = realloc(worldState->airports,
+                sizeof(Airport*) * total);
+        worldState->capacityAirports = total;
+    }
+    memcpy(worldState->airports + worldState->countAirports, batch->added,
+            sizeof(Airport*) * batch->count);
+    worldState->countAirports = total;
+
+    // an empty ordered index is built in one go from the sorted airports
+    if (worldState->ordered.count == 0) {
+        qsort(batch->added, batch->count, sizeof(Airport*),
+                compare_airport_ids);
+        airport_list_build(&worldState->ordered, batch->added, batch->count);
+    } else {
+        for (size_t i = 0; i < batch->count; ++i) {
+            airport_list_insert(&worldState->ordered, batch->added[i]);
+        }
+    }
+
+    // one snapshot keeps them rather than a journal line each, on disk
+    // before the port is given out so that no registration is acked
+    // while they are kept nowhere
+    return worldState->journal == NULL ||
+            take_snapshot(worldState->journal, worldState);
+}
+
+/** Loads the mappings in a file, before the mapper serves anyone. The file
+ * holds either "id:port" lines, or records laid out as in a snapshot.
+ * Ids already known, whether restored or earlier in the file, are skipped
+ * as a registration would skip them. The file stays mapped for good, as
+ * the loaded ids point into it.
+ *
+ * @param worldState Mapper program state
+ * @param path File of mappings
+ * @return false if the file cannot be read, holds records which are
+ *         cut short, left over or not valid mappings, or its airports
+ *         could not be written to a snapshot; the world state must then
+ *         not be served
+ */
+bool preload_mappings(WorldState* worldState, const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if (fd == -1 || fstat(fd, &status) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    size_t size = (size_t) status.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    // private pages so that lines can be split in place
+    char* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    // a file opening as a snapshot does must be a whole one
+    SnapshotHeader header;
+    bool records = size >= strlen(SNAPSHOT_MAGIC) &&
+            memcmp(map, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC)) == 0;
+    if (records && !read_snapshot_header(map, size, &header)) {
+        munmap(map, size);
+        return false;
+    }
+    size_t count = records ? (size_t) header.count : 1;
+    if (!records) {
+        // one entry per line, the last perhaps without its '\n'
+        char* newline = map;
+        while ((newline = memchr(newline, '\n',
+                size - (size_t) (newline - map))) != NULL) {
+            count++;
+            newline++;
+        }
+    }
+
+    // room for every entry, so the index by id is never rehashed
+    PreloadBatch batch;
+    batch.block = malloc(sizeof(Airport) * (count == 0 ? 1 : count));
+    batch.added = malloc(sizeof(Airport*) * (count == 0 ? 1 : count));
+    batch.count = 0;
+    airport_table_reserve(&worldState->table,
+            worldState->table.count + count);
+
+    bool loaded = true;
+    if (records) {
+        loaded = preload_records(worldState, &batch, map, size, count);
+    } else {
+        preload_lines(worldState, &batch, map, size);
+    }
+    if (loaded && batch.count > 0) {
+        loaded = finish_preload(worldState, &batch);
+    }
+    free(batch.added);
+    if (batch.count == 0) {
+        free(batch.block);
+        munmap(map, size);
+    }
+    return loaded;
+}
@@ -0,0 +1,26 @@
+#ifndef PRELOAD_H
+#define PRELOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "airports.h"
+
+struct WorldState;
+
+/** Airports read from a mappings file, held apart from the world's list
+ * until the whole file has been read.
+ */
+typedef struct PreloadBatch {
+    // room for every airport the file may hold, in one block
+    Airport* block;
+
+    // airports added so far, in the order they were read
+    Airport** added;
+
+    // number of airports added
+    size_t count;
+} PreloadBatch;
+
+bool preload_mappings(struct WorldState* worldState, const char* path);
+
+#endif
@@ -0,0 +1,861 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "reactor.h"
+
+// descriptors kept back from the connection cap for files and listeners
+#define RESERVED_FILES 32
+
+// largest output buffer kept by a connection once its output is sent
+#define OUTPUT_KEEP (64 * 1024)
+
+// connection whose input the calling thread is handling, NULL if none
+__thread Connection* servedConnection = NULL;
+
+/** Gets the current monotonic time.
+ *
+ * @return Monotonic time in ns
+ */
+long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/** Makes room for more bytes at the end of an output buffer, first
+ * reclaiming space taken by bytes already sent.
+ *
+ * @param output Buffer to make room in
+ * @param more Number of bytes to make room for
+ */
+void output_reserve(OutputBuffer* output, size_t more) {
+    if (output->length + more <= output->capacity) {
+        return;
+    }
+    if (output->sent > 0) {
+        memmove(output->data, output->data + output->sent,
+                output->length - output->sent);
+        output->length -= output->sent;
+        output->sent = 0;
+    }
+    if (output->length + more <= output->capacity) {
+        return;
+    }
+    size_t capacity = output->capacity == 0 ? 256 : output->capacity;
+    while (capacity < output->length + more) {
+        capacity *= 2;
+    }
+    output->data = realloc(output->data, capacity);
+    output->capacity = capacity;
+}
+
+/** Appends bytes to an output buffer.
+ *
+ * @param output Buffer to append to
+ * @param data Bytes to append
+ * @param length Number of bytes to append
+ */
+void output_append(OutputBuffer* output, const char* data, size_t length) {
+    output_reserve(output, length);
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+}
+
+/** Appends formatted text to an output buffer, as fprintf would.
+ *
+ * @param output Buffer to append to
+ * @param format printf style format
+ */
+void output_printf(OutputBuffer* output, const char* format, ...) {
+    // format in place, growing the buffer only if the text does not fit
+    va_list arguments;
+    va_start(arguments, format);
+    size_t room = output->capacity - output->length;
+    int needed = vsnprintf(output->data == NULL ? NULL :
+            output->data + output->length, room, format, arguments);
+    va_end(arguments);
+    if (needed < 0) {
+        return;
+    }
+    if ((size_t) needed >= room) {
+        output_reserve(output, needed + 1);
+        va_start(arguments, format);
+        vsnprintf(output->data + output->length, needed + 1, format,
+                arguments);
+        va_end(arguments);
+    }
+    output->length += needed;
+}
+
+/** Writes as much of an output buffer to a non-blocking descriptor as it
+ * will take. A buffer which is completely sent is emptied, and released
+ * if it has grown large.
+ *
+ * @param output Buffer to send
+ * @param fd Descriptor to write to
+ * @return false if writing failed
+ */
+bool output_send(OutputBuffer* output, int fd) {
+    while (output->sent < output->length) {
+        ssize_t wrote = write(fd, output->data + output->sent,
+                output->length - output->sent);
+        if (wrote > 0) {
+            output->sent += wrote;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+    output->length = 0;
+    output->sent = 0;
+    if (output->capacity > OUTPUT_KEEP) {
+        free(output->data);
+        output->data = NULL;
+        output->capacity = 0;
+    }
+    return true;
+}
+
+/** Raises the open file limit as far as allowed so that the reactor can
+ * hold many thousands of connections.
+ *
+ * @return The open file limit in force
+ */
+int raise_file_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 1024;
+    }
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return limit.rlim_cur > 1 << 20 ? 1 << 20 : (int) limit.rlim_cur;
+}
+
+/** Initializes a reactor with one worker per CPU, no idle timeout and a
+ * connection cap given by the open file limit.
+ *
+ * @param reactor Reactor to initialize
+ * @param handler Handler for lines received on connections
+ * @param context Program state for handler
+ */
+void init_reactor(Reactor* reactor, LineHandler handler, void* context) {
+    memset(reactor, 0, sizeof(Reactor));
+    reactor->server = -1;
+    reactor->handler = handler;
+    reactor->context = context;
+    reactor->maxConnections = raise_file_limit() - RESERVED_FILES;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    reactor->countWorkers = cpus > 0 ? (int) cpus : 1;
+}
+
+/** Unlinks a connection from its worker's activity list.
+ *
+ * @param worker Worker holding connection
+ * @param connection Connection to unlink
+ */
+void unlink_connection(Worker* worker, Connection* connection) {
+    if (connection->previous != NULL) {
+        connection->previous->next = connection->next;
+    } else {
+        worker->oldest = connection->next;
+    }
+    if (connection->next != NULL) {
+        connection->next->previous = connection->previous;
+    } else {
+        worker->newest = connection->previous;
+    }
+}
+
+/** Links a connection in at the newest end of its worker's activity list.
+ *
+ * @param worker Worker holding connection
+ * @param connection Connection to link
+ */
+void link_connection(Worker* worker, Connection* connection) {
+    connection->lastActive = now_ns() / 1000000;
+    connection->previous = worker->newest;
+    connection->next = NULL;
+    if (worker->newest != NULL) {
+        worker->newest->next = connection;
+    } else {
+        worker->oldest = connection;
+    }
+    worker->newest = connection;
+}
+
+/** Ends a connection's subscription, if it has one. Once it is off the
+ * broadcast's list no publisher can reach it, so it is then taken off its
+ * worker's ready list and freed.
+ *
+ * @param worker Worker holding connection
+ * @param connection Connection being closed
+ */
+void unsubscribe(Worker* worker, Connection* connection) {
+    Subscriber* subscriber = connection->subscriber;
+    if (subscriber == NULL) {
+        return;
+    }
+    Broadcast* broadcast = subscriber->broadcast;
+    pthread_mutex_lock(&broadcast->lock);
+    if (subscriber->previous != NULL) {
+        subscriber->previous->next = subscriber->next;
+    } else {
+        broadcast->subscribers = subscriber->next;
+    }
+    if (subscriber->next != NULL) {
+        subscriber->next->previous = subscriber->previous;
+    }
+    __atomic_fetch_sub(&broadcast->count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&broadcast->lock);
+
+    pthread_mutex_lock(&worker->queueLock);
+    for (Subscriber** link = &worker->ready; *link != NULL;
+            link = &(*link)->nextReady) {
+        if (*link == subscriber) {
+            *link = subscriber->nextReady;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&worker->queueLock);
+
+    pthread_mutex_destroy(&subscriber->lock);
+    free(subscriber->queue.data);
+    free(subscriber);
+    connection->subscriber = NULL;
+}
+
+/** Closes a connection and releases everything it holds.
+ *
+ * @param worker Worker holding connection
+ * @param connection Connection to close
+ */
+void close_connection(Worker* worker, Connection* connection) {
+    unsubscribe(worker, connection);
+    epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+    unlink_connection(worker, connection);
+    __atomic_fetch_sub(&worker->reactor->live, 1, __ATOMIC_RELAXED);
+    close(connection->fd);
+    free(connection->input.data);
+    free(connection->output.data);
+    free(connection);
+}
+
+/** Registers every connection waiting in the worker's queue.
+ *
+ * @param worker Worker whose queue is drained
+ */
+void take_connections(Worker* worker) {
+    uint64_t signals;
+    if (read(worker->wakeFd, &signals, sizeof(signals)) < 0) {
+        // nothing was signalled, but the queue is checked regardless
+    }
+    Handoff taken[WORK_QUEUE_SIZE];
+    pthread_mutex_lock(&worker->queueLock);
+    int count = worker->queueCount;
+    for (int i = 0; i < count; ++i) {
+        taken[i] = worker->queue[(worker->queueHead + i) % WORK_QUEUE_SIZE];
+    }
+    worker->queueHead = (worker->queueHead + count) % WORK_QUEUE_SIZE;
+    worker->queueCount = 0;
+    pthread_mutex_unlock(&worker->queueLock);
+
+    for (int i = 0; i < count; ++i) {
+        Connection* connection = calloc(1, sizeof(Connection));
+        connection->fd = taken[i].fd;
+        fcntl(connection->fd, F_SETFL,
+                fcntl(connection->fd, F_GETFL) | O_NONBLOCK);
+        connection->acceptedAt = taken[i].acceptedAt;
+        connection->worker = worker;
+        link_connection(worker, connection);
+
+        struct epoll_event event;
+        // writability is watched too, for replies which did not fit in
+        // the socket's buffer
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = connection;
+        epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, connection->fd, &event);
+    }
+}
+
+/** Queues an accepted connection for a worker, waking the worker.
+ *
+ * @param worker Worker to hand the connection to
+ * @param handoff Accepted connection
+ * @return false if the worker's queue is full
+ */
+bool hand_off(Worker* worker, Handoff handoff) {
+    pthread_mutex_lock(&worker->queueLock);
+    if (worker->queueCount == WORK_QUEUE_SIZE) {
+        pthread_mutex_unlock(&worker->queueLock);
+        return false;
+    }
+    worker->queue[(worker->queueHead + worker->queueCount) %
+            WORK_QUEUE_SIZE] = handoff;
+    worker->queueCount++;
+    pthread_mutex_unlock(&worker->queueLock);
+
+    uint64_t signal = 1;
+    if (write(worker->wakeFd, &signal, sizeof(signal)) < 0) {
+        // the eventfd counter is already non zero, so the worker will wake
+    }
+    return true;
+}
+
+/** Records how long a connection waited for its first byte.
+ *
+ * @param reactor Reactor holding connection
+ * @param connection Connection whose first byte has just arrived
+ */
+void record_first_byte(Reactor* reactor, Connection* connection) {
+    long waited = now_ns() - connection->acceptedAt;
+    connection->acceptedAt = 0;
+    __atomic_fetch_add(&reactor->firstByteCount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&reactor->firstByteTotalNs, waited, __ATOMIC_RELAXED);
+
+    long max = __atomic_load_n(&reactor->firstByteMaxNs, __ATOMIC_RELAXED);
+    while (waited > max && !__atomic_compare_exchange_n(
+            &reactor->firstByteMaxNs, &max, waited, false, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED)) {
+        // max now holds the latest value, so try again
+    }
+}
+
+/** Switches a connection to frames if its first byte asks for them and
+ * the reactor offers them, agreeing by sending the byte back.
+ *
+ * @param reactor Reactor holding connection
+ * @param connection Connection whose first bytes have just arrived
+ */
+void accept_frames(Reactor* reactor, Connection* connection) {
+    InputBuffer* input = &connection->input;
+    if (reactor->frameHandler == NULL ||
+            (unsigned char) input->data[input->start] != FRAME_HANDSHAKE) {
+        return;
+    }
+    char handshake = (char) FRAME_HANDSHAKE;
+    output_append(&connection->output, &handshake, 1);
+    input->start++;
+    input->scanned = input->start;
+    connection->framed = true;
+}
+
+/** Makes room for a read at the end of a connection's input, moving the
+ * unhandled tail to the front or growing the buffer as needed.
+ *
+ * @param input Input to make room in
+ * @return false if a line has grown beyond INPUT_LINE_MAX
+ */
+bool input_reserve(InputBuffer* input) {
+    if (input->capacity - input->length >= INPUT_READ_MIN) {
+        return true;
+    }
+    if (input->start > 0) {
+        memmove(input->data, input->data + input->start,
+                input->length - input->start);
+        input->length -= input->start;
+        input->scanned -= input->start;
+        input->start = 0;
+    }
+    if (input->capacity - input->length >= INPUT_READ_MIN) {
+        return true;
+    }
+    if (input->length > INPUT_LINE_MAX) {
+        return false;
+    }
+    // grown no further than a read past the limit, so a line too long is
+    // seen as soon as it passes it rather than once the buffer doubles
+    input->capacity = input->capacity == 0 ? 4 * INPUT_READ_MIN :
+            input->capacity * 2;
+    if (input->capacity > INPUT_LINE_MAX + INPUT_READ_MIN + 1) {
+        input->capacity = INPUT_LINE_MAX + INPUT_READ_MIN + 1;
+    }
+    input->data = realloc(input->data, input->capacity);
+    return true;
+}
+
+/** Reuses a connection's input buffer from the front once everything in
+ * it has been handled, giving back any room taken by a long line.
+ *
+ * @param input Input to recycle
+ */
+void recycle_input(InputBuffer* input) {
+    if (input->start != input->length) {
+        return;
+    }
+    input->start = 0;
+    input->length = 0;
+    input->scanned = 0;
+    if (input->capacity > 4 * INPUT_READ_MIN) {
+        free(input->data);
+        input->data = NULL;
+        input->capacity = 0;
+    }
+}
+
+/** Hands each full line in the connection's input to the handler in
+ * place, leaving any trailing partial line unhandled.
+ *
+ * @param connection Connection whose input is framed
+ * @param handler Handler for received lines
+ * @param context Program state for handler
+ * @return false if the handler asked for the connection to be closed
+ */
+bool frame_lines(Connection* connection, LineHandler handler,
+        void* context) {
+    InputBuffer* input = &connection->input;
+    while (input->scanned < input->length) {
+        char* newline = memchr(input->data + input->scanned, '\n',
+                input->length - input->scanned);
+        if (newline == NULL) {
+            input->scanned = input->length;
+            break;
+        }
+        char* line = input->data + input->start;
+        *newline = '\0';
+        input->start = newline + 1 - input->data;
+        input->scanned = input->start;
+        if (!handler(line, newline - line, &connection->output, context)) {
+            return false;
+        }
+    }
+    recycle_input(input);
+    return true;
+}
+
+/** Hands the body of each full frame in the connection's input to the
+ * handler in place, leaving any trailing partial frame unhandled. The
+ * byte after each body is the start of the next frame, so it is put back
+ * once the body has been handled.
+ *
+ * @param connection Connection whose input is framed
+ * @param handler Handler for received frames
+ * @param context Program state for handler
+ * @return false if the handler asked for the connection to be closed, or
+ *         a frame is longer than INPUT_LINE_MAX
+ */
+bool frame_messages(Connection* connection, LineHandler handler,
+        void* context) {
+    InputBuffer* input = &connection->input;
+    while (input->length - input->start >= FRAME_LENGTH_BYTES) {
+        unsigned char* prefix = (unsigned char*) input->data + input->start;
+        size_t length = (size_t) prefix[0] << 24 | (size_t) prefix[1] << 16 |
+                (size_t) prefix[2] << 8 | (size_t) prefix[3];
+        if (length > INPUT_LINE_MAX) {
+            return false;
+        }
+        if (input->length - input->start - FRAME_LENGTH_BYTES < length) {
+            break;
+        }
+        char* body = input->data + input->start + FRAME_LENGTH_BYTES;
+        char next = body[length];
+        body[length] = '\0';
+        input->start += FRAME_LENGTH_BYTES + length;
+        // frames are not scanned for newlines, but the input is moved
+        // down by start
+        input->scanned = input->start;
+        bool open = handler(body, length, &connection->output, context);
+        body[length] = next;
+        if (!open) {
+            return false;
+        }
+    }
+    recycle_input(input);
+    return true;
+}
+
+/** Gets the number of bytes a connection has yet to send.
+ *
+ * @param connection Connection to check
+ * @return Number of bytes of output pending
+ */
+size_t pending_output(const Connection* connection) {
+    return connection->output.length - connection->output.sent;
+}
+
+/** Reads what is available on a connection and handles each line,
+ * stopping early if the connection's replies are piling up unsent.
+ *
+ * @param reactor Reactor holding connection
+ * @param connection Connection which is readable
+ * @return false if the connection wants no more input, because the peer
+ *         closed it, it failed or the handler asked for it to be closed
+ */
+bool read_connection(Reactor* reactor, Connection* connection) {
+    InputBuffer* input = &connection->input;
+    while (pending_output(connection) < OUTPUT_HIGH_WATER) {
+        // reads always leave room to terminate a final partial line
+        if (!input_reserve(input)) {
+            return false;
+        }
+        ssize_t got = recv(connection->fd, input->data + input->length,
+                input->capacity - input->length - 1, MSG_DONTWAIT);
+        if (got > 0) {
+            input->length += got;
+            if (connection->acceptedAt != 0) {
+                record_first_byte(reactor, connection);
+                accept_frames(reactor, connection);
+            }
+            bool open = connection->framed ?
+                    frame_messages(connection, reactor->frameHandler,
+                    reactor->context) :
+                    frame_lines(connection, reactor->handler,
+                    reactor->context);
+            if (!open) {
+                return false;
+            }
+        } else if (got == 0) {
+            // peer is done sending, so handle what is left of its input; a
+            // partial frame is of no use
+            if (input->length > input->start && !connection->framed) {
+                input->data[input->length] = '\0';
+                reactor->handler(input->data + input->start,
+                        input->length - input->start, &connection->output,
+                        reactor->context);
+            }
+            return false;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Moves messages queued for a connection's subscription to its output,
+ * unless its replies are piling up unsent already; they are then left
+ * queued, where the subscriber's bound applies to them.
+ *
+ * @param connection Connection whose subscription is drained
+ * @return false if the subscriber was dropped for falling behind, so the
+ *         connection should be closed now
+ */
+bool drain_subscription(Connection* connection) {
+    Subscriber* subscriber = connection->subscriber;
+    if (subscriber == NULL) {
+        return true;
+    }
+    pthread_mutex_lock(&subscriber->lock);
+    bool lost = subscriber->lost;
+    OutputBuffer* queue = &subscriber->queue;
+    if (!lost && pending_output(connection) < OUTPUT_HIGH_WATER) {
+        output_append(&connection->output, queue->data, queue->length);
+        queue->length = 0;
+        if (queue->capacity > OUTPUT_KEEP) {
+            free(queue->data);
+            queue->data = NULL;
+            queue->capacity = 0;
+        }
+    }
+    pthread_mutex_unlock(&subscriber->lock);
+    return !lost;
+}
+
+/** Moves a connection on after an event: sends pending replies, handles
+ * new input while replies are not piling up, and sends what that
+ * produced. Replies to everything pipelined go out in as few writes as
+ * the socket allows.
+ *
+ * @param reactor Reactor holding connection
+ * @param connection Connection with an event
+ * @return false if the connection should be closed now
+ */
+bool serve_connection(Reactor* reactor, Connection* connection) {
+    while (true) {
+        if (!drain_subscription(connection) ||
+                !output_send(&connection->output, connection->fd)) {
+            return false;
+        }
+        size_t pending = pending_output(connection);
+        if (connection->closing) {
+            return pending > 0;
+        }
+        // the socket is full, so wait for it to become writable
+        if (pending >= OUTPUT_HIGH_WATER) {
+            return true;
+        }
+        // handlers may subscribe the connection they are handling
+        servedConnection = connection;
+        bool open = read_connection(reactor, connection);
+        servedConnection = NULL;
+        if (!open) {
+            connection->closing = true;
+        } else if (pending_output(connection) < OUTPUT_HIGH_WATER) {
+            // input is drained, so only the replies are left to send
+            return output_send(&connection->output, connection->fd);
+        }
+    }
+}
+
+/** Closes every connection of a worker which has been idle for longer
+ * than the reactor's idle timeout.
+ *
+ * @param worker Worker whose connections are checked
+ * @return ms until the next connection could time out, or -1 if none can
+ */
+int expire_connections(Worker* worker) {
+    Reactor* reactor = worker->reactor;
+    if (reactor->idleTimeout <= 0) {
+        return -1;
+    }
+    long timeout = reactor->idleTimeout * 1000L;
+    long now = now_ns() / 1000000;
+
+    // the activity list is ordered, so only its head can have expired
+    while (worker->oldest != NULL &&
+            now - worker->oldest->lastActive >= timeout) {
+        __atomic_fetch_add(&reactor->expired, 1, __ATOMIC_RELAXED);
+        close_connection(worker, worker->oldest);
+    }
+    if (worker->oldest == NULL) {
+        return -1;
+    }
+    return (int) (worker->oldest->lastActive + timeout - now);
+}
+
+/** Sends the messages queued for each of the worker's subscribers which
+ * publishers have marked ready. Sending a message counts as activity on
+ * the connection. Called once the events of a batch are handled, as it
+ * may close connections.
+ *
+ * @param worker Worker whose ready list is drained
+ */
+void take_ready(Worker* worker) {
+    pthread_mutex_lock(&worker->queueLock);
+    Subscriber* ready = worker->ready;
+    worker->ready = NULL;
+    pthread_mutex_unlock(&worker->queueLock);
+
+    while (ready != NULL) {
+        Subscriber* subscriber = ready;
+        ready = subscriber->nextReady;
+
+        // messages published from here on mark the subscriber ready again
+        pthread_mutex_lock(&subscriber->lock);
+        subscriber->ready = false;
+        pthread_mutex_unlock(&subscriber->lock);
+
+        Connection* connection = subscriber->connection;
+        unlink_connection(worker, connection);
+        link_connection(worker, connection);
+        if (!serve_connection(worker->reactor, connection)) {
+            close_connection(worker, connection);
+        }
+    }
+}
+
+/** Runs a worker's edge-triggered event loop. Never returns.
+ *
+ * @param v Worker to run
+ * @return need for thread function
+ */
+void* run_worker(void* v) {
+    Worker* worker = (Worker*) v;
+    Reactor* reactor = worker->reactor;
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    int wait = -1;
+    while (true) {
+        int count = epoll_wait(worker->epollFd, events, REACTOR_MAX_EVENTS,
+                wait);
+        bool woken = false;
+        for (int i = 0; i < count; ++i) {
+            Connection* connection = events[i].data.ptr;
+            // the wakeup eventfd is the only registration without one
+            if (connection == NULL) {
+                take_connections(worker);
+                woken = true;
+                continue;
+            }
+            unlink_connection(worker, connection);
+            link_connection(worker, connection);
+            if (!serve_connection(reactor, connection)) {
+                close_connection(worker, connection);
+            }
+        }
+        // subscribers are only served once no event of the batch is left
+        // to refer to a connection they may close
+        if (woken) {
+            take_ready(worker);
+        }
+        wait = expire_connections(worker);
+    }
+}
+
+/** Sets up and starts a worker thread.
+ *
+ * @param reactor Reactor the worker belongs to
+ * @param worker Worker to start
+ */
+void start_worker(Reactor* reactor, Worker* worker) {
+    worker->reactor = reactor;
+    worker->epollFd = epoll_create1(0);
+    worker->wakeFd = eventfd(0, EFD_NONBLOCK);
+    pthread_mutex_init(&worker->queueLock, NULL);
+    worker->queueHead = 0;
+    worker->queueCount = 0;
+    worker->ready = NULL;
+    worker->oldest = NULL;
+    worker->newest = NULL;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->wakeFd, &event);
+
+    pthread_t threadId;
+    pthread_create(&threadId, 0, run_worker, worker);
+    pthread_detach(threadId);
+}
+
+/** Accepts connections made to server on the calling thread and hands
+ * them round robin to a pool of worker threads. Connections beyond the
+ * connection cap, or which no worker has room to queue, are closed at
+ * once. Never returns.
+ *
+ * @param reactor Initialized reactor
+ * @param server Listening socket
+ */
+void run_reactor(Reactor* reactor, int server) {
+    // a peer closing early must not kill the whole server
+    signal(SIGPIPE, SIG_IGN);
+
+    reactor->server = server;
+    reactor->workers = calloc(reactor->countWorkers, sizeof(Worker));
+    for (int i = 0; i < reactor->countWorkers; ++i) {
+        start_worker(reactor, &reactor->workers[i]);
+    }
+
+    int next = 0;
+    while (true) {
+        int fd = accept(server, 0, 0);
+        if (fd == -1) {
+            // out of descriptors, so give workers a chance to close some
+            if (errno == EMFILE || errno == ENFILE) {
+                usleep(1000);
+            }
+            continue;
+        }
+        Handoff handoff = {fd, now_ns()};
+
+        // count the connection before a worker can close it
+        long live = __atomic_add_fetch(&reactor->live, 1, __ATOMIC_RELAXED);
+        bool queued = false;
+        if (live <= reactor->maxConnections) {
+            // pass over workers whose queues are full
+            for (int i = 0; i < reactor->countWorkers && !queued; ++i) {
+                queued = hand_off(&reactor->workers[next], handoff);
+                next = (next + 1) % reactor->countWorkers;
+            }
+        }
+        if (!queued) {
+            __atomic_fetch_sub(&reactor->live, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&reactor->refused, 1, __ATOMIC_RELAXED);
+            close(fd);
+            continue;
+        }
+        __atomic_fetch_add(&reactor->total, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/** Initializes a broadcast with no subscribers.
+ *
+ * @param broadcast Broadcast to initialize
+ */
+void init_broadcast(Broadcast* broadcast) {
+    pthread_mutex_init(&broadcast->lock, NULL);
+    broadcast->subscribers = NULL;
+    broadcast->count = 0;
+    broadcast->dropped = 0;
+}
+
+/** Subscribes the connection whose input the calling thread is handling
+ * to a broadcast. Messages published from then on are sent on it after
+ * any replies already written.
+ *
+ * @param broadcast Broadcast to subscribe to
+ * @return false if no connection is being handled, it speaks in frames or
+ *         it is subscribed already
+ */
+bool reactor_subscribe(Broadcast* broadcast) {
+    Connection* connection = servedConnection;
+    if (connection == NULL || connection->framed ||
+            connection->subscriber != NULL) {
+        return false;
+    }
+    Subscriber* subscriber = calloc(1, sizeof(Subscriber));
+    subscriber->connection = connection;
+    subscriber->broadcast = broadcast;
+    pthread_mutex_init(&subscriber->lock, NULL);
+
+    pthread_mutex_lock(&broadcast->lock);
+    subscriber->next = broadcast->subscribers;
+    if (broadcast->subscribers != NULL) {
+        broadcast->subscribers->previous = subscriber;
+    }
+    broadcast->subscribers = subscriber;
+    __atomic_fetch_add(&broadcast->count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&broadcast->lock);
+    connection->subscriber = subscriber;
+    return true;
+}
+
+/** Queues a message for every subscriber of a broadcast, waking the
+ * workers of subscribers which had nothing queued. A subscriber with no
+ * room left for the message is dropped instead. Messages reach each
+ * subscriber in the order they were published.
+ *
+ * @param broadcast Broadcast to publish to
+ * @param data Message
+ * @param length Number of bytes in message
+ */
+void broadcast_publish(Broadcast* broadcast, const char* data,
+        size_t length) {
+    pthread_mutex_lock(&broadcast->lock);
+    for (Subscriber* subscriber = broadcast->subscribers; subscriber != NULL;
+            subscriber = subscriber->next) {
+        pthread_mutex_lock(&subscriber->lock);
+        if (subscriber->lost) {
+            pthread_mutex_unlock(&subscriber->lock);
+            continue;
+        }
+        if (subscriber->queue.length + length > SUBSCRIBER_QUEUE_MAX) {
+            subscriber->lost = true;
+            __atomic_fetch_add(&broadcast->dropped, 1, __ATOMIC_RELAXED);
+        } else {
+            output_append(&subscriber->queue, data, length);
+        }
+        bool wake = !subscriber->ready;
+        subscriber->ready = true;
+        pthread_mutex_unlock(&subscriber->lock);
+        if (!wake) {
+            continue;
+        }
+
+        // the subscriber cannot be freed while the broadcast is locked
+        Worker* worker = subscriber->connection->worker;
+        pthread_mutex_lock(&worker->queueLock);
+        subscriber->nextReady = worker->ready;
+        worker->ready = subscriber;
+        pthread_mutex_unlock(&worker->queueLock);
+        uint64_t signal = 1;
+        if (write(worker->wakeFd, &signal, sizeof(signal)) < 0) {
+            // the eventfd counter is already non zero, so the worker will
+            // wake
+        }
+    }
+    pthread_mutex_unlock(&broadcast->lock);
+}
@@ -0,0 +1,263 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// longest line accepted; a client sending a longer one is disconnected
+#define INPUT_LINE_MAX (1 << 20)
+
+// least free space offered to each read from a connection
+#define INPUT_READ_MIN 512
+
+// most events taken from epoll per wakeup
+#define REACTOR_MAX_EVENTS 256
+
+// most accepted connections waiting to be taken up by one worker
+#define WORK_QUEUE_SIZE 1024
+
+// pending output beyond which a connection's input is left unread
+#define OUTPUT_HIGH_WATER (1 << 20)
+
+// first byte sent by a client wanting length prefixed frames rather than
+// lines; a server offering them sends it back
+#define FRAME_HANDSHAKE 0xB2
+
+// bytes of the big endian length before each frame
+#define FRAME_LENGTH_BYTES 4
+
+// most bytes of messages a subscriber may have queued; one more drops it
+#define SUBSCRIBER_QUEUE_MAX (1 << 20)
+
+/** Replies waiting to be sent on a connection. **/
+typedef struct OutputBuffer {
+    // buffered bytes
+    char* data;
+
+    // number of bytes in data
+    size_t length;
+
+    // number of bytes of data already sent
+    size_t sent;
+
+    // number of bytes data has room for
+    size_t capacity;
+} OutputBuffer;
+
+/** Bytes received on a connection. Lines are framed in place between
+ * start and length, and the unframed tail is moved back to the front only
+ * when the space after it runs short.
+ */
+typedef struct InputBuffer {
+    // received bytes
+    char* data;
+
+    // offset of the first byte not yet handed to the handler
+    size_t start;
+
+    // number of bytes in data
+    size_t length;
+
+    // offset up to which data is known to hold no newline, never before
+    // start
+    size_t scanned;
+
+    // number of bytes data has room for
+    size_t capacity;
+} InputBuffer;
+
+/** Handles one line, or the body of one frame, received on a connection.
+ *
+ * @param line Line received, without its '\n', or frame body, without its
+ *        length; null terminated in place in the connection's input, and
+ *        the handler may modify it
+ * @param length Number of bytes in line
+ * @param output Buffer to write replies to, sent by the reactor once all
+ *        input to hand is handled
+ * @param context Program state given to run_reactor
+ * @return false if the connection should be closed after this line
+ */
+typedef bool (*LineHandler)(char* line, size_t length, OutputBuffer* output,
+        void* context);
+
+/** A connection's subscription to a broadcast. Publishers queue messages
+ * under its lock, and the connection's worker moves them to the
+ * connection's output.
+ */
+typedef struct Subscriber {
+    // connection the messages are sent on
+    struct Connection* connection;
+
+    // broadcast subscribed to
+    struct Broadcast* broadcast;
+
+    // guards the queue and flags
+    pthread_mutex_t lock;
+
+    // messages not yet moved to the connection's output
+    OutputBuffer queue;
+
+    // true while the subscriber is on its worker's ready list
+    bool ready;
+
+    // true once a message did not fit in the queue; the connection is
+    // then closed, and the client must watch afresh
+    bool lost;
+
+    // neighbours in the broadcast's list of subscribers
+    struct Subscriber* previous;
+    struct Subscriber* next;
+
+    // next subscriber on its worker's ready list
+    struct Subscriber* nextReady;
+} Subscriber;
+
+/** Connections subscribed to a stream of messages, which any thread may
+ * publish to. Each subscriber's queue is bounded, so a slow subscriber is
+ * dropped rather than holding up publishers or other subscribers.
+ */
+typedef struct Broadcast {
+    // guards the list of subscribers
+    pthread_mutex_t lock;
+
+    // subscribed connections
+    Subscriber* subscribers;
+
+    // number of subscribers, updated atomically
+    long count;
+
+    // number of subscribers dropped for falling behind, updated atomically
+    long dropped;
+} Broadcast;
+
+/** A client connection served by the reactor. **/
+typedef struct Connection {
+    // socket connected to the client
+    int fd;
+
+    // replies not yet sent
+    OutputBuffer output;
+
+    // true once no more input is wanted; the connection is closed as soon
+    // as its output is sent
+    bool closing;
+
+    // bytes received but not yet handled
+    InputBuffer input;
+
+    // true if the client asked for frames, which are then handed to the
+    // reactor's frame handler rather than framed as lines
+    bool framed;
+
+    // worker serving the connection
+    struct Worker* worker;
+
+    // subscription the connection receives, NULL if none
+    Subscriber* subscriber;
+
+    // monotonic time in ns at which the connection was accepted, or 0
+    // once its first byte has arrived
+    long acceptedAt;
+
+    // monotonic time in ms at which the client was last heard from
+    long lastActive;
+
+    // neighbours in the worker's least recently active first list
+    struct Connection* previous;
+    struct Connection* next;
+} Connection;
+
+/** An accepted connection on its way to a worker. **/
+typedef struct Handoff {
+    // socket connected to the client
+    int fd;
+
+    // monotonic time in ns at which the connection was accepted
+    long acceptedAt;
+} Handoff;
+
+/** A thread serving its share of connections with its own event loop. **/
+typedef struct Worker {
+    // reactor the worker belongs to
+    struct Reactor* reactor;
+
+    // epoll instance
+    int epollFd;
+
+    // eventfd signalled when connections are queued for the worker, or
+    // messages for its subscribers
+    int wakeFd;
+
+    // guards the queue
+    pthread_mutex_t queueLock;
+
+    // accepted connections waiting to be registered, as a ring
+    Handoff queue[WORK_QUEUE_SIZE];
+    int queueHead;
+    int queueCount;
+
+    // subscribers with messages queued, linked through nextReady; guarded
+    // by queueLock
+    Subscriber* ready;
+
+    // least and most recently active connections
+    Connection* oldest;
+    Connection* newest;
+} Worker;
+
+/** Acceptor, worker pool and connection manager for a server. Counters
+ * are updated atomically as workers share them.
+ */
+typedef struct Reactor {
+    // listening socket
+    int server;
+
+    // handler for lines received on connections
+    LineHandler handler;
+
+    // handler for the body of each frame received on connections which
+    // asked for frames, NULL if frames are not offered
+    LineHandler frameHandler;
+
+    // program state for handler
+    void* context;
+
+    // seconds a connection may be idle before it is closed, 0 for never
+    int idleTimeout;
+
+    // most connections served at once; further ones are closed at once
+    int maxConnections;
+
+    // worker threads
+    int countWorkers;
+    Worker* workers;
+
+    // number of connections currently open
+    long live;
+
+    // number of connections accepted, refused and timed out ever
+    long total;
+    long refused;
+    long expired;
+
+    // time from accepting a connection to its first byte arriving
+    long firstByteCount;
+    long firstByteTotalNs;
+    long firstByteMaxNs;
+} Reactor;
+
+long now_ns(void);
+int raise_file_limit(void);
+void output_append(OutputBuffer* output, const char* data, size_t length);
+void output_printf(OutputBuffer* output, const char* format, ...);
+bool output_send(OutputBuffer* output, int fd);
+void init_reactor(Reactor* reactor, LineHandler handler, void* context);
+void run_reactor(Reactor* reactor, int server);
+void init_broadcast(Broadcast* broadcast);
+bool reactor_subscribe(Broadcast* broadcast);
+void broadcast_publish(Broadcast* broadcast, const char* data,
+        size_t length);
+
+#endif
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include "networking.h"
+
+/** Scrambles a 64 bit value so that nearby inputs land far apart on the
+ * ring (splitmix64 finalizer).
+ *
+ * @param value Value to scramble
+ * @return Scrambled value
+ */
+uint64_t mix_hash(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
+
+/** For ring qsort.
+ *
+ * @param a Point one
+ * @param b Point two
+ * @return < 0 if first goes before second, 0 if equal, > 0 otherwise
+ */
+int ring_cmp_func(const void* a, const void* b) {
+    const RingPoint* first = (const RingPoint*) a;
+    const RingPoint* second = (const RingPoint*) b;
+    if (first->hash != second->hash) {
+        return first->hash < second->hash ? -1 : 1;
+    }
+    return first->shard - second->shard;
+}
+
+/** Builds a ring from a comma separated list of mapper ports.
+ *
+ * @param ring Ring to build
+ * @param list Ports of the shards, such as "4001,4002,4003"
+ * @return false if any port is not a strictly positive number < 65536
+ */
+bool parse_mapper_ring(MapperRing* ring, const char* list) {
+    int countShards = 1;
+    for (const char* c = list; *c != '\0'; ++c) {
+        if (*c == ',') {
+            countShards++;
+        }
+    }
+    ring->ports = malloc(sizeof(int) * countShards);
+    ring->countShards = countShards;
+
+    const char* port = list;
+    for (int i = 0; i < countShards; ++i) {
+        char* rest;
+        long value = strtol(port, &rest, 10);
+        if (rest == port || (*rest != ',' && *rest != '\0') || value <= 0 ||
+                value > 65535) {
+            free(ring->ports);
+            return false;
+        }
+        ring->ports[i] = (int) value;
+        port = rest + 1;
+    }
+
+    ring->countPoints = countShards * RING_REPLICAS;
+    ring->points = malloc(sizeof(RingPoint) * ring->countPoints);
+    for (int i = 0; i < countShards; ++i) {
+        for (int j = 0; j < RING_REPLICAS; ++j) {
+            RingPoint* point = &ring->points[i * RING_REPLICAS + j];
+            point->hash = mix_hash(((uint64_t) i << 32) | (uint64_t) j);
+            point->shard = i;
+        }
+    }
+    qsort(ring->points, ring->countPoints, sizeof(RingPoint), ring_cmp_func);
+    return true;
+}
+
+/** Finds the shard owning an id: that of the first point at or after the
+ * id's hash, going round to the first point past the last.
+ *
+ * @param ring Ring of shards
+ * @param id Airport id, need not be null terminated
+ * @param length Number of characters in id
+ * @return Index of the owning shard
+ */
+int ring_shard(const MapperRing* ring, const char* id, size_t length) {
+    uint64_t hash = mix_hash(hash_id(id, length));
+    int low = 0;
+    int high = ring->countPoints;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (ring->points[middle].hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return ring->points[low == ring->countPoints ? 0 : low].shard;
+}
+
+/** Finds the port of the shard owning an id.
+ *
+ * @param ring Ring of shards
+ * @param id Airport id
+ * @return Port of the owning shard
+ */
+int ring_port(const MapperRing* ring, const char* id) {
+    return ring->ports[ring_shard(ring, id, strlen(id))];
+}
+
+/** Compares two "id:port" lines by id alone, as the mapper orders them.
+ *
+ * @param first Line one
+ * @param second Line two
+ * @return < 0 if first goes before second, 0 if equal, > 0 otherwise
+ */
+int compare_mapping_lines(const char* first, const char* second) {
+    size_t firstLength = strcspn(first, ":\n");
+    size_t secondLength = strcspn(second, ":\n");
+    int order = memcmp(first, second,
+            firstLength < secondLength ? firstLength : secondLength);
+    if (order != 0 || firstLength == secondLength) {
+        return order;
+    }
+    return firstLength < secondLength ? -1 : 1;
+}
+
+/** Sends @ to every shard and writes their replies to out as one list in
+ * id order. Each shard's list is already in order, so they are merged as
+ * they arrive.
+ *
+ * @param ring Ring of shards
+ * @param out Where to write the merged list
+ * @return false if a shard could not be reached
+ */
+bool ring_dump(const MapperRing* ring, FILE* out) {
+    int countShards = ring->countShards;
+    FILE** readers = calloc(countShards, sizeof(FILE*));
+    char** lines = calloc(countShards, sizeof(char*));
+    size_t* sizes = calloc(countShards, sizeof(size_t));
+    bool reached = true;
+
+    for (int i = 0; i < countShards; ++i) {
+        int fd = outbound_socket_maker(ring->ports[i]);
+        if (fd == -1 || write(fd, "@\n", 2) != 2) {
+            reached = false;
+            if (fd != -1) {
+                close(fd);
+            }
+            continue;
+        }
+        // the mapper closes the connection once the list is sent
+        shutdown(fd, SHUT_WR);
+        readers[i] = fdopen(fd, "r");
+        if (getline(&lines[i], &sizes[i], readers[i]) == -1) {
+            fclose(readers[i]);
+            readers[i] = NULL;
+        }
+    }
+
+    // with few shards, scanning their heads beats keeping a heap
+    while (true) {
+        int least = -1;
+        for (int i = 0; i < countShards; ++i) {
+            if (readers[i] != NULL && (least == -1 ||
+                    compare_mapping_lines(lines[i], lines[least]) < 0)) {
+                least = i;
+            }
+        }
+        if (least == -1) {
+            break;
+        }
+        fputs(lines[least], out);
+        if (getline(&lines[least], &sizes[least], readers[least]) == -1) {
+            fclose(readers[least]);
+            readers[least] = NULL;
+        }
+    }
+    fflush(out);
+
+    for (int i = 0; i < countShards; ++i) {
+        free(lines[i]);
+    }
+    free(sizes);
+    free(lines);
+    free(readers);
+    return reached;
+}
@@ -0,0 +1,45 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// points each shard has on the ring; more even out the shards' shares
+#define RING_REPLICAS 128
+
+/** A point on the hash ring, owning the ids hashed up to it. **/
+typedef struct RingPoint {
+    // position on the ring
+    uint64_t hash;
+
+    // index of the shard owning the point
+    int shard;
+} RingPoint;
+
+/** Mapper shards among which the id space is split by consistent hashing.
+ * A shard is known by its place in the list of ports, so every client must
+ * be given the shards in the same order, but a shard may move to another
+ * port without its ids moving with it.
+ */
+typedef struct MapperRing {
+    // port of each shard
+    int* ports;
+
+    // number of shards
+    int countShards;
+
+    // points of every shard in increasing hash order
+    RingPoint* points;
+
+    // number of points
+    int countPoints;
+} MapperRing;
+
+bool parse_mapper_ring(MapperRing* ring, const char* list);
+int ring_shard(const MapperRing* ring, const char* id, size_t length);
+int ring_port(const MapperRing* ring, const char* id);
+bool ring_dump(const MapperRing* ring, FILE* out);
+
+#endif
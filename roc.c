@@ -1,3 +1,4 @@
+#include <poll.h>
 #include "mapper.h"
 
 /** Checks args given to roc program.
@@ -5,7 +6,8 @@
  * @param argc Program argument count
  * @param argv Program arguments
  * @exit
- *  ROC_INCORRECT_NUM_ARGS - incorrect number of args supplied
+ *  ROC_INCORRECT_NUM_ARGS - incorrect number of args supplied, or a plane
+ *                           id starting with ':'
  *  ROC_INVALID_MAPPER_PORT - invalid mapper port
  *  ROC_MAPPER_REQUIRED - No valid mapper port was given when needed
  */
@@ -16,19 +18,21 @@ void check_args(int argc, char** argv) {
         return;
     }
     
-    // mapper is not dash but is not a valid port either
+    // plane ids starting with ':' would be taken by control as a command
+    if (argv[1][0] == ':') {
+        roc_exit(ROC_INCORRECT_NUM_ARGS);
+        return;
+    }
+    
+    // mapper is not dash but is not a valid list of shard ports either
     if (strcmp(argv[2], "-") != 0) {
-        char* otherHalf;
-        int mapperPortNum = (int) strtol(argv[2], &otherHalf, 10);
-        
-        if (strlen(otherHalf) != 0) {
-            roc_exit(ROC_INVALID_MAPPER_PORT);
-            return;
-        }
-        if (mapperPortNum <= 0 || mapperPortNum > 65535) {
+        MapperRing ring;
+        if (!parse_mapper_ring(&ring, argv[2])) {
             roc_exit(ROC_INVALID_MAPPER_PORT);
             return;
         }
+        free(ring.ports);
+        free(ring.points);
     }
     
     // destination is not a valid port number (so the mapper is required)
@@ -59,88 +63,310 @@ void print_log(WorldState* worldState) {
     fflush(stdout);
 }
 
-/** Connects to each destination and stores destination info.
+/** Reads a visit's framed reply, and once enough of it has arrived, keeps
+ * control's info as the line a visit in lines would have read.
+ *
+ * @param visit Visit in frames whose socket is readable
+ */
+void read_framed_visit(Visit* visit) {
+    size_t header = FRAME_LENGTH_BYTES + FRAME_HEADER_BYTES;
+    ssize_t got = recv(visit->fd, visit->reply + visit->replyLength,
+            sizeof(visit->reply) - 1 - visit->replyLength, 0);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (got <= 0) {
+        visit->stage = VISIT_FAILED;
+        return;
+    }
+    visit->replyLength += got;
+    if (visit->replyLength < header) {
+        return;
+    }
+    size_t length = frame_u32(visit->reply);
+    if (length < FRAME_HEADER_BYTES || visit->reply[header - 1] != FRAME_OK) {
+        visit->stage = VISIT_FAILED;
+        return;
+    }
+    // anything past what a line would have kept is not waited for
+    size_t info = length - FRAME_HEADER_BYTES;
+    size_t kept = info < VISIT_INFO_MAX ? info : VISIT_INFO_MAX;
+    if (visit->replyLength < header + kept) {
+        return;
+    }
+    memmove(visit->reply, visit->reply + header, kept);
+    visit->replyLength = kept;
+    if (info < VISIT_INFO_MAX) {
+        visit->reply[visit->replyLength++] = '\n';
+    }
+    visit->stage = VISIT_DONE;
+}
+
+/** Moves a visit on as far as its socket allows without blocking. A visit
+ * in frames asks its destination for them once connected, and fails if the
+ * destination does not agree.
+ *
+ * @param visit Visit whose socket is ready
+ * @param message Plane id line to send in lines
+ * @param request Visit frame to send in frames
+ * @param requestLength Number of bytes in request
+ */
+void advance_visit(Visit* visit, const char* message, const char* request,
+        size_t requestLength) {
+    if (visit->stage == VISIT_CONNECTING) {
+        // connect has finished, one way or the other
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(visit->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0) {
+            visit->stage = VISIT_FAILED;
+            return;
+        }
+        if (visit->framed) {
+            char handshake = (char) FRAME_HANDSHAKE;
+            if (send(visit->fd, &handshake, 1, 0) != 1) {
+                visit->stage = VISIT_FAILED;
+                return;
+            }
+            visit->stage = VISIT_HANDSHAKE;
+            return;
+        }
+        visit->stage = VISIT_SENDING;
+    }
+    
+    if (visit->stage == VISIT_HANDSHAKE) {
+        char reply;
+        ssize_t got = recv(visit->fd, &reply, 1, 0);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (got != 1 || (unsigned char) reply != FRAME_HANDSHAKE) {
+            visit->stage = VISIT_FAILED;
+            return;
+        }
+        visit->stage = VISIT_SENDING;
+    }
+    
+    if (visit->stage == VISIT_SENDING) {
+        if (!visit->framed) {
+            request = message;
+            requestLength = strlen(message);
+        }
+        ssize_t sent = send(visit->fd, request + visit->sent,
+                requestLength - visit->sent, 0);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                visit->stage = VISIT_FAILED;
+            }
+            return;
+        }
+        visit->sent += sent;
+        if (visit->sent == requestLength) {
+            visit->stage = VISIT_READING;
+        }
+        return;
+    }
+    
+    if (visit->framed) {
+        read_framed_visit(visit);
+        return;
+    }
+    
+    // read up to the end of the info line, as fgets(input, 80, ...) would
+    ssize_t got = recv(visit->fd, visit->reply + visit->replyLength,
+            VISIT_INFO_MAX - visit->replyLength, 0);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (got <= 0) {
+        visit->stage = VISIT_DONE;
+        return;
+    }
+    char* newline = memchr(visit->reply + visit->replyLength, '\n', got);
+    visit->replyLength += got;
+    if (newline != NULL) {
+        visit->replyLength = newline - visit->reply + 1;
+    }
+    if (newline != NULL || visit->replyLength == VISIT_INFO_MAX) {
+        visit->stage = VISIT_DONE;
+    }
+}
+
+/** Connects to each destination not yet visited and stores destination
+ * info. Every destination is visited at once, so the time taken is that
+ * of the slowest destination rather than the sum over all of them.
  *
  * @param worldState The roc program state
  * @param planeId The planeId of the roc program
- * @return True if the connection failed. False otherwise
+ * @return True if any destination, visited now or before, could not be
+ *         connected to. False otherwise
  * @exit
  *   ROC_NO_MAP_ENTRY - Mapper has no value for one of the queried destinations
  */
 bool connect_to_destinations(WorldState* worldState, char* planeId) {
+    int countVisits = worldState->countAirports;
+    Visit* visits = calloc(countVisits + 1, sizeof(Visit));
+    struct pollfd* polls = malloc(sizeof(struct pollfd) * (countVisits + 1));
+    int* pollVisit = malloc(sizeof(int) * (countVisits + 1));
+    size_t messageLength = strlen(planeId) + 2;
+    char* message = malloc(messageLength);
+    snprintf(message, messageLength, "%s\n", planeId);
+    Frame frame = {0, FRAME_VISIT, planeId, strlen(planeId)};
+    size_t requestLength = FRAME_LENGTH_BYTES + FRAME_HEADER_BYTES +
+            frame.length;
+    char* request = malloc(requestLength);
+    encode_frame(request, &frame);
+    
+    for (int i = 0; i < countVisits; ++i) {
+        if (worldState->airports[i]->info != NULL) {
+            visits[i].fd = -1;
+            visits[i].stage = VISIT_DONE;
+            continue;
+        }
+        visits[i].fd = outbound_socket_start(worldState->airports[i]->port);
+        visits[i].stage = visits[i].fd == -1 ? VISIT_FAILED :
+                VISIT_CONNECTING;
+        visits[i].framed = using_frames();
+    }
+    
+    // wait on every visit still in progress until none are
+    while (true) {
+        int countPolls = 0;
+        for (int i = 0; i < countVisits; ++i) {
+            VisitStage stage = visits[i].stage;
+            if (stage == VISIT_DONE || stage == VISIT_FAILED) {
+                continue;
+            }
+            polls[countPolls].fd = visits[i].fd;
+            polls[countPolls].events = stage == VISIT_CONNECTING ||
+                    stage == VISIT_SENDING ? POLLOUT : POLLIN;
+            pollVisit[countPolls] = i;
+            countPolls++;
+        }
+        if (countPolls == 0) {
+            break;
+        }
+        if (poll(polls, countPolls, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        for (int i = 0; i < countPolls; ++i) {
+            if (polls[i].revents != 0) {
+                advance_visit(&visits[pollVisit[i]], message, request,
+                        requestLength);
+            }
+        }
+    }
+    
+    // record results in argument order
     bool failedToConnect = false;
-    for (int i = 0; i < worldState->countAirports; ++i) {
+    for (int i = 0; i < countVisits; ++i) {
         Airport* airport = worldState->airports[i];
-        int server = outbound_socket_maker(airport->port);
-        
-        if (server == -1) {
+        if (visits[i].fd != -1) {
+            close(visits[i].fd);
+        }
+        if (airport->info != NULL) {
+            failedToConnect = failedToConnect || strlen(airport->info) == 0;
+            continue;
+        }
+        airport->info = malloc(sizeof(char) * 80);
+        if (visits[i].stage != VISIT_DONE) {
             failedToConnect = true;
-            airport->info = malloc(sizeof(char) * 80);
             strncpy(airport->info, "", 1);
+        } else if (visits[i].replyLength == 0) {
+            roc_exit(ROC_NO_MAP_ENTRY);
         } else {
-            // write to server
-            int server2 = dup(server);
-            FILE* writer = fdopen(server, "w");
-            FILE* reader = fdopen(server2, "r");
-            
-            // write roc id
-            fprintf(writer, "%s\n", planeId);
-            fflush(writer);
-            // get control id
-            char input[80];
-            if (fgets(input, 80, reader) != NULL) {
-                airport->info = malloc(sizeof(char) * 80);
-                strncpy(airport->info, input, 80);
-            } else {
-                roc_exit(ROC_NO_MAP_ENTRY);
-            }
+            visits[i].reply[visits[i].replyLength] = '\0';
+            strncpy(airport->info, visits[i].reply, 80);
         }
     }
+    free(request);
+    free(message);
+    free(pollVisit);
+    free(polls);
+    free(visits);
     return failedToConnect;
 }
 
-/** Connects the roc to the mapper and gets port numbers.
+/** Connects the roc to the mapper shards and gets port numbers. Ids
+ * found in the cache are not asked for; each other id is asked of the
+ * shard owning it once, however often it is given, with every query sent
+ * before any reply is awaited. Shards are asked in frames if the roc was
+ * told to use them.
  *
  * @param worldState The roc program state
- * @param hasPort True if the program started with a mapper port
+ * @param hasPort True if the program started with mapper ports
  * @param needMapper True if the program needs a mapper
- * @param mapperPortNum The mapper port number
+ * @param mappers The mapper shards
+ * @param cache Ports already learnt, which learns the ports asked for
  * @exit
  *   ROC_MAPPER_CONNECTION_ERROR - Error connecting to mapper
  *   ROC_NO_MAP_ENTRY - Mapper has no value for one of the queried destinations
  */
 void roc_mapper_connect(WorldState* worldState, bool hasPort,
-        bool needMapper, int mapperPortNum) {
+        bool needMapper, const MapperRing* mappers, RouteCache* cache) {
     if (hasPort && needMapper) {
-        int server = outbound_socket_maker(mapperPortNum);
-        
-        // if there was error connecting to mapper
-        if (server == -1) {
-            roc_exit(ROC_MAPPER_CONNECTION_ERROR);
-        }
-        // make file streams to write and read
-        int server2 = dup(server);
-        FILE* writer = fdopen(server, "w");
-        FILE* reader = fdopen(server2, "r");
+        FILE** writers = calloc(mappers->countShards, sizeof(FILE*));
+        FILE** readers = calloc(mappers->countShards, sizeof(FILE*));
+        bool framed = using_frames();
+        int* asked = calloc(mappers->countShards, sizeof(int));
+        int* shards = malloc(sizeof(int) * (worldState->countAirports + 1));
+        bool* queried = calloc(worldState->countAirports + 1, sizeof(bool));
         
+        // send every query before waiting for any reply
         for (int i = 0; i < worldState->countAirports; ++i) {
             Airport* airport = worldState->airports[i];
-            // was given an id
+            if (airport->port != 0) {
+                continue;
+            }
+            int shard = ring_shard(mappers, airport->id, strlen(airport->id));
+            shards[i] = shard;
+            // was given an id whose port that shard gave already
+            airport->port = cache_lookup(cache, mappers->ports[shard],
+                    airport->id);
+            // was given an id not yet asked for
             if (airport->port == 0) {
-                char message[100];
-                snprintf(message, 100, "?%s\n", airport->id);
-                
-                if (fprintf(writer, "%s", message) < 0) {
+                if (writers[shard] == NULL) {
+                    int server = outbound_socket_framed(mappers->ports[shard]);
+                    
+                    // if there was error connecting to mapper
+                    if (server == -1) {
+                        roc_exit(ROC_MAPPER_CONNECTION_ERROR);
+                    }
+                    // make file streams to write and read
+                    int server2 = dup(server);
+                    writers[shard] = fdopen(server, "w");
+                    readers[shard] = fdopen(server2, "r");
+                }
+                // a framed query says which airport it is for
+                Frame frame = {(uint32_t) i, FRAME_QUERY, airport->id,
+                        strlen(airport->id)};
+                if (framed ? !write_frame(writers[shard], &frame) :
+                        fprintf(writers[shard], "?%s\n", airport->id) < 0) {
                     roc_exit(ROC_NO_MAP_ENTRY);
                 }
-                fflush(writer);
-                
+                asked[shard]++;
+                queried[i] = true;
+                cache_ask(cache, mappers->ports[shard], airport->id);
+            }
+        }
+        for (int i = 0; i < mappers->countShards; ++i) {
+            if (writers[i] != NULL) {
+                fflush(writers[i]);
+            }
+        }
+        
+        // each shard in lines replies in the order its queries were sent
+        for (int i = 0; i < worldState->countAirports; ++i) {
+            Airport* airport = worldState->airports[i];
+            if (queried[i] && !framed) {
                 // receive server response
                 char input[80];
-                if (fgets(input, 80, reader) != NULL) {
+                if (fgets(input, 80, readers[shards[i]]) != NULL) {
                     if (strcmp(input, ";\n") != 0) {
                         int port = (int) strtol(input, (char**) {0}, 10);
                         airport->port = port;
+                        cache_store(cache, mappers->ports[shards[i]],
+                                airport->id, port);
                     } else {
                         roc_exit(ROC_NO_MAP_ENTRY);
                     }
@@ -150,6 +376,42 @@ void roc_mapper_connect(WorldState* worldState, bool hasPort,
                 }
             }
         }
+        
+        // each framed reply names the airport it is for
+        char* buffer = NULL;
+        size_t capacity = 0;
+        for (int i = 0; i < mappers->countShards; ++i) {
+            for (int j = 0; framed && j < asked[i]; ++j) {
+                Frame frame;
+                if (!read_frame(readers[i], &frame, &buffer, &capacity) ||
+                        frame.requestId >= (uint32_t) worldState->countAirports ||
+                        frame.code != FRAME_OK || frame.length != 2) {
+                    roc_exit(ROC_NO_MAP_ENTRY);
+                }
+                Airport* airport = worldState->airports[frame.requestId];
+                if (!queried[frame.requestId]) {
+                    roc_exit(ROC_NO_MAP_ENTRY);
+                }
+                airport->port = frame_u16(frame.payload);
+                cache_store(cache, mappers->ports[i], airport->id,
+                        airport->port);
+            }
+        }
+        
+        // ids given again take the port asked for the first time
+        for (int i = 0; i < worldState->countAirports; ++i) {
+            Airport* airport = worldState->airports[i];
+            if (airport->port == CACHE_ASKING) {
+                airport->port = cache_lookup(cache,
+                        mappers->ports[shards[i]], airport->id);
+            }
+        }
+        free(buffer);
+        free(queried);
+        free(shards);
+        free(asked);
+        free(readers);
+        free(writers);
     }
 }
 
@@ -173,6 +435,8 @@ bool roc_find_destinations(WorldState* worldState, int argc, char** argv,
         Airport* airport = worldState->airports[i - 3];
         airport->id = malloc(sizeof(char) * 80);
         strncpy(airport->id, "", 2);
+        // not yet visited
+        airport->info = NULL;
         // if was int
         if (result != 0 && strlen(rest) == 0) {
             airport->port = result;
@@ -187,43 +451,175 @@ bool roc_find_destinations(WorldState* worldState, int argc, char** argv,
     return need_mapper;
 }
 
+/** Drops from the cache the port of every destination given by id which
+ * could not be connected to. Those whose port was read from the cache
+ * file are made ready to be asked for and visited again.
+ *
+ * @param worldState The roc program state
+ * @param mappers The mapper shards
+ * @param cache Ports learnt from the mappers
+ * @return True if any destination is to be asked for again
+ */
+bool forget_unreached(WorldState* worldState, const MapperRing* mappers,
+        RouteCache* cache) {
+    bool retry = false;
+    for (int i = 0; i < worldState->countAirports; ++i) {
+        Airport* airport = worldState->airports[i];
+        if (strlen(airport->info) != 0 || strlen(airport->id) == 0) {
+            continue;
+        }
+        if (cache_forget(cache, ring_port(mappers, airport->id),
+                airport->id)) {
+            free(airport->info);
+            airport->info = NULL;
+            airport->port = 0;
+            retry = true;
+        }
+    }
+    return retry;
+}
+
+/** Lists the mappings of every mapper shard, merged in id order, and ends
+ * the program.
+ *
+ * @param list Comma separated mapper ports, in the order the shards are
+ *        given to every other client
+ * @exit
+ *   NORMAL_END - Every shard was listed
+ *   ROC_INVALID_MAPPER_PORT - A mapper port is invalid
+ *   ROC_MAPPER_CONNECTION_ERROR - A shard could not be reached
+ */
+void roc_dump_mappers(const char* list) {
+    MapperRing mappers;
+    if (!parse_mapper_ring(&mappers, list)) {
+        roc_exit(ROC_INVALID_MAPPER_PORT);
+    }
+    bool reached = ring_dump(&mappers, stdout);
+    fflush(stdout);
+    roc_exit(reached ? NORMAL_END : ROC_MAPPER_CONNECTION_ERROR);
+}
+
+/** Parses the options given before the roc's arguments.
+ *
+ * @param argc Program argument count
+ * @param argv Program arguments
+ * @param cachePath Set to the cache file given, or NULL if none was
+ * @param ttl Set to the seconds cached ports are trusted for
+ * @param dumpList Set to the mapper ports whose mappings are to be listed,
+ *        or NULL if the roc is to fly
+ * @return Index of the first argument after the options, or -1 if the
+ *         options are invalid
+ * @options
+ *    -C file - keep ports learnt from the mapper in this file between runs
+ *    -T seconds - trust cached ports for this long
+ *    -u directory - connect through Unix domain sockets in this directory
+ *    -b - speak to the mapper and destinations in frames, which they must
+ *         offer
+ *    -D mappers - list every mapping of these mapper shards in id order,
+ *                 rather than fly
+ */
+int parse_roc_options(int argc, char** argv, char** cachePath, int* ttl,
+        char** dumpList) {
+    *cachePath = NULL;
+    *ttl = CACHE_DEFAULT_TTL;
+    *dumpList = NULL;
+    
+    // '+' stops at the first argument so plane ids may start with '-'
+    opterr = 0;
+    int option;
+    while ((option = getopt(argc, argv, "+C:T:u:bD:")) != -1) {
+        if (option == 'C' && strlen(optarg) != 0) {
+            *cachePath = optarg;
+        } else if (option == 'u' && strlen(optarg) != 0) {
+            if (!init_transport(optarg)) {
+                return -1;
+            }
+        } else if (option == 'b') {
+            use_frames();
+        } else if (option == 'D' && strlen(optarg) != 0) {
+            *dumpList = optarg;
+        } else if (option == 'T') {
+            char* rest;
+            long value = strtol(optarg, &rest, 10);
+            if (strlen(rest) != 0 || strlen(optarg) == 0 || value < 0 ||
+                    value > 1 << 24) {
+                return -1;
+            }
+            *ttl = (int) value;
+        } else {
+            return -1;
+        }
+    }
+    return optind;
+}
+
 /** Entry point to Roc program
  * @exit
  *   0 - Normal exit
  *   ROC_FAILED_TO_CONNECT - Failed to connect to at least one destination
  * **/
 int main(int argc, char** argv) {
+    char* cachePath;
+    int ttl;
+    char* dumpList;
+    int first = parse_roc_options(argc, argv, &cachePath, &ttl, &dumpList);
+    if (first == -1) {
+        roc_exit(ROC_INCORRECT_NUM_ARGS);
+    }
+    if (dumpList != NULL) {
+        roc_dump_mappers(dumpList);
+    }
+    // from here on arguments are as if no options were given
+    argc -= first - 1;
+    argv += first - 1;
+    
     // check args
     check_args(argc, argv);
     // get planeID
     char* planeID = argv[1];
     
-    // get mapper port - either number or a dash
+    // get mapper ports - either comma separated numbers or a dash
     char* mapperPort = argv[2];
     
     // has_port is true if a mapper port was inputted
     bool has_port = true;
     bool need_mapper = false;
-    int mapperPortNum;
+    MapperRing mappers;
     if (strcmp(mapperPort, "-") == 0) {
         has_port = false;
     } else {
-        mapperPortNum = (int) strtol(mapperPort, (char**) {0}, 10);
+        parse_mapper_ring(&mappers, mapperPort);
     }
     
     // initialize state
     WorldState* worldState = malloc(sizeof(WorldState));
-    worldState->countAirports = 0;
+    init_world_state(worldState);
     
     // find destinations
     need_mapper = roc_find_destinations(worldState, argc, argv, need_mapper);
     
     // connect to mapper and make streams
-    roc_mapper_connect(worldState, has_port, need_mapper, mapperPortNum);
+    RouteCache cache;
+    init_route_cache(&cache, cachePath, ttl);
+    roc_mapper_connect(worldState, has_port, need_mapper, &mappers, &cache);
     
     // connect to each destination and get info
     bool failedToConnect = connect_to_destinations(worldState, planeID);
     
+    // a cached port which could not be reached may have moved, so it is
+    // asked of the mapper again, once
+    if (failedToConnect && has_port &&
+            forget_unreached(worldState, &mappers, &cache)) {
+        roc_mapper_connect(worldState, has_port, true, &mappers, &cache);
+        failedToConnect = connect_to_destinations(worldState, planeID);
+        
+        // ports asked for again which still cannot be reached are dropped
+        if (failedToConnect) {
+            forget_unreached(worldState, &mappers, &cache);
+        }
+    }
+    save_route_cache(&cache);
+    
     print_log(worldState);
     
     if (failedToConnect) {
@@ -0,0 +1,2081 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "smoke.h"
+
+/** Prints how a smoke check went.
+ *
+ * @param name Name of the check
+ * @param passed true if the check passed
+ * @return passed
+ */
+bool smoke_check(const char* name, bool passed) {
+    printf("smoke %s %s\n", name, passed ? "ok" : "failed");
+    fflush(stdout);
+    return passed;
+}
+
+/** Connects to a server, giving up on a reply that takes too long.
+ *
+ * @param port Port of the server
+ * @param framed true to ask the server for frames
+ * @return Blocking socket, or -1 if it could not connect
+ */
+int smoke_connect(int port, bool framed) {
+    int fd = outbound_socket_maker(port);
+    if (fd == -1) {
+        return -1;
+    }
+    struct timeval timeout = {SMOKE_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (framed && !request_frames(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/** Reads one line from a socket, a byte at a time so nothing after it is
+ * read.
+ *
+ * @param fd Socket to read from
+ * @param line Where to store the line, with its '\n', null terminated
+ * @param size Number of bytes line has room for
+ * @return false if the line did not arrive whole in time
+ */
+bool smoke_read_line(int fd, char* line, size_t size) {
+    size_t length = 0;
+    while (length + 1 < size) {
+        if (recv(fd, line + length, 1, 0) != 1) {
+            break;
+        }
+        if (line[length++] == '\n') {
+            line[length] = '\0';
+            return true;
+        }
+    }
+    line[length] = '\0';
+    return false;
+}
+
+/** Sends lines to a server on a new connection and reads everything it
+ * sends back until it closes the connection.
+ *
+ * @param port Port of the server
+ * @param request Lines to send
+ * @param reply Where to store the reply, null terminated, SMOKE_REPLY_MAX
+ *        bytes long
+ * @return false if the server could not be reached or did not close the
+ *         connection in time
+ */
+bool smoke_ask(int port, const char* request, char* reply) {
+    reply[0] = '\0';
+    int fd = smoke_connect(port, false);
+    if (fd == -1) {
+        return false;
+    }
+    size_t length = strlen(request);
+    bool sent = send(fd, request, length, MSG_NOSIGNAL) == (ssize_t) length;
+    shutdown(fd, SHUT_WR);
+    size_t received = 0;
+    ssize_t got = 0;
+    while (sent && received + 1 < SMOKE_REPLY_MAX &&
+            (got = recv(fd, reply + received,
+            SMOKE_REPLY_MAX - 1 - received, 0)) > 0) {
+        received += got;
+    }
+    reply[received] = '\0';
+    close(fd);
+    return sent && got == 0;
+}
+
+/** Sends one frame to a server on a new connection and reads its reply.
+ *
+ * @param port Port of the server
+ * @param code FrameCommand of the request
+ * @param payload Payload of the request, null terminated
+ * @param reply Where to store the reply's fields, its payload pointing
+ *        into buffer
+ * @param buffer Buffer for the reply's body, grown as needed
+ * @param capacity Number of bytes buffer has room for
+ * @return false if the server could not be reached or did not answer the
+ *         request in time
+ */
+bool smoke_frame(int port, uint8_t code, char* payload, Frame* reply,
+        char** buffer, size_t* capacity) {
+    int fd = smoke_connect(port, true);
+    if (fd == -1) {
+        return false;
+    }
+    FILE* writer = fdopen(dup(fd), "w");
+    FILE* reader = fdopen(fd, "r");
+    Frame request = {7, code, payload, strlen(payload)};
+    bool answered = write_frame(writer, &request) && fflush(writer) == 0 &&
+            read_frame(reader, reply, buffer, capacity) &&
+            reply->requestId == request.requestId;
+    fclose(writer);
+    fclose(reader);
+    return answered;
+}
+
+/** Waits for a file to appear, as a snapshot does once it is renamed into
+ * place whole.
+ *
+ * @param path File to wait for
+ * @return false if it did not appear in time
+ */
+bool smoke_wait_for_file(const char* path) {
+    long deadline = now_ns() + SMOKE_TIMEOUT * 1000000000L;
+    struct stat status;
+    while (stat(path, &status) != 0) {
+        if (now_ns() >= deadline) {
+            return false;
+        }
+        usleep(10000);
+    }
+    return true;
+}
+
+/** Stops a server started for the smoke checks.
+ *
+ * @param pid Process id of the server, or -1 if it was not started
+ */
+void smoke_stop(pid_t pid) {
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+/** Removes a file or directory found under the smoke run's directory.
+ * Called by nftw, children first.
+ *
+ * @param path File to remove
+ * @param status Unused
+ * @param type Unused
+ * @param walk Unused
+ * @return 0, so that the walk goes on whatever happens
+ */
+int smoke_remove(const char* path, const struct stat* status, int type,
+        struct FTW* walk) {
+    (void) status;
+    (void) type;
+    (void) walk;
+    remove(path);
+    return 0;
+}
+
+/** Builds the path of a file in the smoke run's directory.
+ *
+ * @param smoke The smoke run
+ * @param name Name of the file
+ * @param path Where to store the path, JOURNAL_PATH_MAX bytes long
+ * @return path
+ */
+char* smoke_path(const Smoke* smoke, const char* name, char* path) {
+    snprintf(path, JOURNAL_PATH_MAX, "%s/%s", smoke->directory, name);
+    return path;
+}
+
+/** Starts a server for a smoke check, with the threads and socket
+ * directory the bench was given.
+ *
+ * @param smoke The smoke run
+ * @param path Program to run
+ * @param rest Arguments after the options, NULL terminated
+ * @param port Set to the port the server listens on
+ * @return Process id of the server, or -1 if it could not be started
+ */
+pid_t smoke_start(const Smoke* smoke, char* path, char** rest, int* port) {
+    return start_server(path, server_arguments(path, smoke->options, rest),
+            port);
+}
+
+/** Checks that watch sends every airport, then each one registered after
+ * it.
+ *
+ * @param smoke The smoke run
+ * @return false if the registration was not sent to the watcher
+ */
+bool smoke_watch(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+    int fd = mapper == -1 ? -1 : smoke_connect(mapperPort, false);
+    if (fd == -1) {
+        smoke_stop(mapper);
+        return false;
+    }
+    char line[SMOKE_REPLY_MAX];
+    bool subscribed = send(fd, "watch\n", 6, MSG_NOSIGNAL) == 6;
+    while (subscribed && (subscribed = smoke_read_line(fd, line,
+            sizeof(line))) && strcmp(line, ".\n") != 0) {
+        // airports known before subscribing
+    }
+    char reply[SMOKE_REPLY_MAX];
+    bool told = subscribed && smoke_ask(mapperPort, "!SMW:1005\n", reply) &&
+            smoke_read_line(fd, line, sizeof(line)) &&
+            strcmp(line, "SMW:1005\n") == 0;
+    close(fd);
+    smoke_stop(mapper);
+    return told;
+}
+
+/** Checks that a control started with -b registers in frames, and that
+ * the mapper and the control answer requests in frames.
+ *
+ * @param smoke The smoke run
+ * @return false if a request in frames was not answered as in lines
+ */
+bool smoke_frames(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+    char port[PORT_MAX_CHARS + 1];
+    snprintf(port, sizeof(port), "%d", mapperPort);
+    char* rest[] = {"-b", "SMF", "smokeinfo", port, NULL};
+    int controlPort;
+    pid_t control = mapper == -1 ? -1 : smoke_start(smoke,
+            smoke->controlPath, rest, &controlPort);
+
+    Frame reply;
+    char* buffer = NULL;
+    size_t capacity = 0;
+    char log[SMOKE_REPLY_MAX];
+    bool answered = control != -1 &&
+            smoke_frame(mapperPort, FRAME_QUERY, "SMF", &reply, &buffer,
+            &capacity) && reply.code == FRAME_OK && reply.length == 2 &&
+            frame_u16(reply.payload) == controlPort &&
+            smoke_frame(controlPort, FRAME_VISIT, "SMP", &reply, &buffer,
+            &capacity) && reply.code == FRAME_OK &&
+            strcmp(reply.payload, "smokeinfo") == 0 &&
+            smoke_ask(controlPort, "log\n", log) &&
+            strcmp(log, "SMP\n.\n") == 0;
+    free(buffer);
+    smoke_stop(control);
+    smoke_stop(mapper);
+    return answered;
+}
+
+/** Checks that ids in a -p file are answered as soon as the mapper
+ * serves.
+ *
+ * @param smoke The smoke run
+ * @return false if a preloaded id was not answered
+ */
+bool smoke_preload(const Smoke* smoke) {
+    char preload[JOURNAL_PATH_MAX];
+    FILE* mappings = fopen(smoke_path(smoke, "preload", preload), "w");
+    if (mappings == NULL) {
+        return false;
+    }
+    fprintf(mappings, "SMA:1001\nSMB:1002\n");
+    fclose(mappings);
+
+    char* rest[] = {"-p", preload, NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, rest, &mapperPort);
+    char reply[SMOKE_REPLY_MAX];
+    bool answered = mapper != -1 &&
+            smoke_ask(mapperPort, "?SMA\n?SMB\n", reply) &&
+            strcmp(reply, "1001\n1002\n") == 0;
+    smoke_stop(mapper);
+    return answered;
+}
+
+/** Checks that a mapper restarted with -d alone brings back the airports
+ * of its snapshot, written after a preload, and of the journal kept after
+ * it.
+ *
+ * @param smoke The smoke run
+ * @return false if an airport was not brought back
+ */
+bool smoke_restore(const Smoke* smoke) {
+    char directory[JOURNAL_PATH_MAX];
+    char preload[JOURNAL_PATH_MAX];
+    char snapshot[JOURNAL_PATH_MAX + 16];
+    smoke_path(smoke, "restore", directory);
+    snprintf(snapshot, sizeof(snapshot), "%s/snapshot", directory);
+    FILE* mappings = mkdir(directory, 0700) == 0 ?
+            fopen(smoke_path(smoke, "restore.preload", preload), "w") : NULL;
+    if (mappings == NULL) {
+        return false;
+    }
+    fprintf(mappings, "SMA:1001\nSMB:1002\n");
+    fclose(mappings);
+
+    // one airport after the snapshot is kept in the journal alone
+    char* preloading[] = {"-d", directory, "-p", preload, NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, preloading,
+            &mapperPort);
+    char reply[SMOKE_REPLY_MAX];
+    bool kept = mapper != -1 && smoke_wait_for_file(snapshot) &&
+            smoke_ask(mapperPort, "!SMC:1003\n?SMC\n", reply) &&
+            strcmp(reply, "1003\n") == 0;
+    smoke_stop(mapper);
+
+    char* restoring[] = {"-d", directory, NULL};
+    mapper = kept ? smoke_start(smoke, smoke->mapperPath, restoring,
+            &mapperPort) : -1;
+    bool restored = mapper != -1 && smoke_ask(mapperPort, "@\n", reply) &&
+            strcmp(reply, "SMA:1001\nSMB:1002\nSMC:1003\n") == 0;
+    smoke_stop(mapper);
+    return restored;
+}
+
+/** Checks that @since gives only the airports added after a version of
+ * this run, and has a version from before a restart start over.
+ *
+ * @param smoke The smoke run
+ * @return false if a version was caught up from wrongly
+ */
+bool smoke_since(const Smoke* smoke) {
+    char directory[JOURNAL_PATH_MAX];
+    if (mkdir(smoke_path(smoke, "since", directory), 0700) != 0) {
+        return false;
+    }
+    char* rest[] = {"-d", directory, NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, rest, &mapperPort);
+    char cursor[SMOKE_REPLY_MAX];
+    char reply[SMOKE_REPLY_MAX];
+    char request[SMOKE_REPLY_MAX + 32];
+    bool caught = mapper != -1 &&
+            smoke_ask(mapperPort, "!SMA:1001\n@since 0\n", cursor) &&
+            strchr(cursor, '\n') != NULL;
+    if (caught) {
+        *strchr(cursor, '\n') = '\0';
+        snprintf(request, sizeof(request), "!SMB:1002\n@since %s\n",
+                cursor);
+        caught = smoke_ask(mapperPort, request, reply) &&
+                strchr(reply, '\n') != NULL &&
+                strcmp(strchr(reply, '\n'), "\nSMB:1002\n.\n") == 0;
+    }
+    smoke_stop(mapper);
+
+    // a version from before the restart is not caught up from
+    mapper = caught ? smoke_start(smoke, smoke->mapperPath, rest,
+            &mapperPort) : -1;
+    snprintf(request, sizeof(request), "@since %s\n", cursor);
+    bool resynced = mapper != -1 && smoke_ask(mapperPort, request, reply) &&
+            strncmp(reply, "resync\n", 7) == 0 &&
+            strstr(reply, "\nSMA:1001\nSMB:1002\n.\n") != NULL;
+    smoke_stop(mapper);
+    return resynced;
+}
+
+/** Checks that percentiles are the top of the bucket reaching their
+ * share, that durations below 16 ns are kept exactly, and that an empty
+ * histogram counts nothing.
+ *
+ * @param smoke The smoke run
+ * @return false if a count or percentile is wrong
+ */
+bool smoke_histogram(const Smoke* smoke) {
+    (void) smoke;
+    Histogram* histogram = calloc(1, sizeof(Histogram));
+    bool empty = histogram_count(histogram) == 0 &&
+            histogram_percentile(histogram, 0.5) == 0;
+    for (int i = 0; i < 900; ++i) {
+        histogram_record(histogram, 5);
+    }
+    for (int i = 0; i < 90; ++i) {
+        histogram_record(histogram, 1000);
+    }
+    for (int i = 0; i < 10; ++i) {
+        histogram_record(histogram, 100000);
+    }
+    // 1000 is counted in 992..1023 and 100000 in 98304..102399
+    bool counted = histogram_count(histogram) == 1000 &&
+            histogram_percentile(histogram, 0.5) == 5 &&
+            histogram_percentile(histogram, 0.9) == 5 &&
+            histogram_percentile(histogram, 0.99) == 1023 &&
+            histogram_percentile(histogram, 0.999) == 102399 &&
+            histogram_percentile(histogram, 1) == 102399;
+    free(histogram);
+    return empty && counted;
+}
+
+/** Checks that :stats counts every command, and gives percentiles only
+ * for kinds of command it has timed. A mapper with one worker thread
+ * times the first of a run of commands and not the one after.
+ *
+ * @param smoke The smoke run
+ * @return false if a command's line is not as expected
+ */
+bool smoke_stats(const Smoke* smoke) {
+    char* rest[] = {"-t", "1", NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, rest, &mapperPort);
+    char reply[SMOKE_REPLY_MAX];
+    bool counted = mapper != -1 &&
+            smoke_ask(mapperPort, "?SMA\n^SM\n:stats\n", reply) &&
+            strstr(reply, "\ncommand ? count=1 lock_waits=0 "
+            "lock_wait_ns=0 samples=1 p50_ns=") != NULL &&
+            strstr(reply, "\ncommand ^ count=1 lock_waits=0 "
+            "lock_wait_ns=0 samples=0\n") != NULL &&
+            strstr(reply, "\ncommand @ ") == NULL &&
+            strcmp(reply + strlen(reply) - 3, "\n.\n") == 0;
+    smoke_stop(mapper);
+    return counted;
+}
+
+/** Checks that the mapper's index by id finds every airport registered
+ * as it grows, keeps the first port of an id registered twice, and finds
+ * no id that was never registered.
+ *
+ * @param smoke The smoke run
+ * @return false if an airport was lost or a lookup was wrong
+ */
+bool smoke_table(const Smoke* smoke) {
+    (void) smoke;
+    WorldState* worldState = malloc(sizeof(WorldState));
+    init_world_state(worldState);
+    char line[32];
+    for (int i = 0; i < 5000; ++i) {
+        snprintf(line, sizeof(line), "!id%d:%d", i, 1000 + i);
+        add_mapping(line, worldState);
+    }
+    snprintf(line, sizeof(line), "!id7:9");
+    add_mapping(line, worldState);
+
+    bool found = worldState->countAirports == 5000 &&
+            worldState->table.count == 5000 &&
+            worldState->table.capacity >= 2 * worldState->table.count;
+    for (int i = 0; found && i < 5000; ++i) {
+        snprintf(line, sizeof(line), "id%d", i);
+        Airport* airport = get_airport(worldState, line);
+        found = airport != NULL && airport->port == 1000 + i;
+    }
+    return found && get_airport(worldState, "id5000") == NULL &&
+            get_airport(worldState, "id") == NULL;
+}
+
+/** Checks that @ lists airports in id order whatever order they were
+ * registered in, and that ^ lists exactly the ids starting with its
+ * prefix, over the wire and for a few thousand ids in the index itself.
+ *
+ * @param smoke The smoke run
+ * @return false if a listing was out of order or had ids missing or extra
+ */
+bool smoke_ordered(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+    char reply[SMOKE_REPLY_MAX];
+    bool listed = mapper != -1 && smoke_ask(mapperPort,
+            "!SMB:2\n!SN:5\n!SMA:1\n!SL:4\n!SM:3\n@\n^SM\n^SMC\n", reply) &&
+            strcmp(reply, "SL:4\nSM:3\nSMA:1\nSMB:2\nSN:5\n"
+            "SM:3\nSMA:1\nSMB:2\n") == 0;
+    smoke_stop(mapper);
+
+    // ids in a scrambled order, some the prefix of others
+    WorldState* worldState = malloc(sizeof(WorldState));
+    init_world_state(worldState);
+    char line[32];
+    int expected = 0;
+    for (int i = 0; i < 3000; ++i) {
+        int scrambled = (i * 7919) % 3000;
+        snprintf(line, sizeof(line), "!%d:%d", scrambled, 1000 + scrambled);
+        add_mapping(line, worldState);
+        expected += strncmp(line + 1, "12", 2) == 0;
+    }
+    OutputBuffer output;
+    memset(&output, 0, sizeof(OutputBuffer));
+    print_mappings(worldState, &output);
+    size_t dumped = output.length;
+    print_prefix_mappings(worldState, "12", &output);
+    output_append(&output, "", 1);
+
+    // each line is after the one before it, and prefixed lines start so
+    char* previous = NULL;
+    int countDumped = 0;
+    int countPrefixed = 0;
+    for (char* id = output.data; listed && *id != '\0';
+            id = strchr(id, '\n') + 1) {
+        *strchr(id, ':') = '\0';
+        if (id < output.data + dumped) {
+            listed = previous == NULL || strcmp(previous, id) < 0;
+            countDumped++;
+        } else {
+            listed = strncmp(id, "12", 2) == 0 && (countPrefixed == 0 ||
+                    strcmp(previous, id) < 0);
+            countPrefixed++;
+        }
+        previous = id;
+        id += strlen(id) + 1;
+    }
+    free(output.data);
+    return listed && countDumped == 3000 && countPrefixed == expected;
+}
+
+/** Checks that queries made by several clients at once, while another
+ * client registers, are each answered as if they ran alone, with the
+ * mapper's worker threads sharing the lock between readers.
+ *
+ * @param smoke The smoke run
+ * @return false if a reply was wrong or a registration was lost
+ */
+bool smoke_readers(const Smoke* smoke) {
+    char* rest[] = {"-t", "4", NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, rest, &mapperPort);
+    char queries[SMOKE_REPLY_MAX];
+    char expected[SMOKE_REPLY_MAX];
+    char reply[SMOKE_REPLY_MAX];
+    OutputBuffer registrations;
+    memset(&registrations, 0, sizeof(OutputBuffer));
+    queries[0] = '\0';
+    expected[0] = '\0';
+    for (int i = 0; i < 100; ++i) {
+        output_printf(&registrations, "!RA%d:%d\n", i, 2000 + i);
+        snprintf(queries + strlen(queries), 16, "?RA%d\n", i);
+        snprintf(expected + strlen(expected), 16, "%d\n", 2000 + i);
+    }
+    output_append(&registrations, "", 1);
+    bool answered = mapper != -1 &&
+            smoke_ask(mapperPort, registrations.data, reply);
+    free(registrations.data);
+
+    pid_t readers[4];
+    int countReaders = 0;
+    while (answered && countReaders < 4) {
+        pid_t reader = fork();
+        if (reader == 0) {
+            for (int j = 0; j < 50; ++j) {
+                if (!smoke_ask(mapperPort, queries, reply) ||
+                        strcmp(reply, expected) != 0) {
+                    _exit(1);
+                }
+            }
+            _exit(0);
+        }
+        answered = reader != -1;
+        readers[countReaders++] = reader;
+    }
+
+    // registrations one at a time, each taking the lock while reads go on
+    char request[48];
+    for (int i = 0; answered && i < 100; ++i) {
+        snprintf(request, sizeof(request), "!RB%d:%d\n?RB%d\n", i, 3000 + i,
+                i);
+        char port[16];
+        snprintf(port, sizeof(port), "%d\n", 3000 + i);
+        answered = smoke_ask(mapperPort, request, reply) &&
+                strcmp(reply, port) == 0;
+    }
+    for (int i = 0; i < countReaders && readers[i] != -1; ++i) {
+        int status;
+        answered = waitpid(readers[i], &status, 0) == readers[i] &&
+                WIFEXITED(status) && WEXITSTATUS(status) == 0 && answered;
+    }
+    smoke_stop(mapper);
+    return answered;
+}
+
+/** Checks that a server holds many connections open at once and answers
+ * each, with lines arriving in pieces on connections served in turn, and
+ * that control closes a connection after log.
+ *
+ * @param smoke The smoke run
+ * @return false if a connection was not answered or not closed
+ */
+bool smoke_connections(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+    char reply[SMOKE_REPLY_MAX];
+    bool answered = mapper != -1 &&
+            smoke_ask(mapperPort, "!SMA:1001\n", reply);
+    int fds[300];
+    int countFds = 0;
+    while (answered && countFds < 300) {
+        fds[countFds] = smoke_connect(mapperPort, false);
+        answered = fds[countFds] != -1 &&
+                send(fds[countFds], "?SM", 3, MSG_NOSIGNAL) == 3;
+        countFds += fds[countFds] != -1;
+    }
+    // each line is finished only once every connection holds its start
+    for (int i = countFds - 1; answered && i >= 0; --i) {
+        answered = send(fds[i], "A\n", 2, MSG_NOSIGNAL) == 2 &&
+                smoke_read_line(fds[i], reply, sizeof(reply)) &&
+                strcmp(reply, "1001\n") == 0;
+    }
+    for (int i = 0; i < countFds; ++i) {
+        close(fds[i]);
+    }
+    smoke_stop(mapper);
+
+    // a control registered with no mapper
+    char* rest[] = {"SMC", "info", NULL};
+    int controlPort;
+    pid_t control = answered ? smoke_start(smoke, smoke->controlPath, rest,
+            &controlPort) : -1;
+    int fd = control == -1 ? -1 : smoke_connect(controlPort, false);
+    bool closed = fd != -1 && send(fd, "log\n", 4, MSG_NOSIGNAL) == 4 &&
+            smoke_read_line(fd, reply, sizeof(reply)) &&
+            strcmp(reply, ".\n") == 0 && recv(fd, reply, 1, 0) == 0;
+    if (fd != -1) {
+        close(fd);
+    }
+    smoke_stop(control);
+    return answered && closed;
+}
+
+/** Asks a server with :conns until it reports the given number of live
+ * connections, the asking one included.
+ *
+ * @param port Port of the server
+ * @param live Number of connections expected
+ * @return false if the count was not reached in time
+ */
+bool smoke_wait_for_conns(int port, int live) {
+    long deadline = now_ns() + SMOKE_TIMEOUT * 1000000000L;
+    char expected[16];
+    snprintf(expected, sizeof(expected), "%d\n", live);
+    char reply[SMOKE_REPLY_MAX];
+    while (!smoke_ask(port, ":conns\n", reply) ||
+            strcmp(reply, expected) != 0) {
+        if (now_ns() >= deadline) {
+            return false;
+        }
+        usleep(10000);
+    }
+    return true;
+}
+
+/** Checks that connections are counted while open and reclaimed once the
+ * client closes them, that one idle past -i is closed by the server, and
+ * that one beyond the -c cap is closed at once.
+ *
+ * @param smoke The smoke run
+ * @return false if a connection was not counted or closed as expected
+ */
+bool smoke_lifetimes(const Smoke* smoke) {
+    char* rest[] = {"-i", "1", "-c", "3", NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, rest, &mapperPort);
+    int fds[3];
+    int countFds = 0;
+    char reply[SMOKE_REPLY_MAX];
+    bool counted = mapper != -1;
+    while (counted && countFds < 3) {
+        fds[countFds] = smoke_connect(mapperPort, false);
+        counted = fds[countFds] != -1;
+        countFds += counted;
+
+        // two held and the asking one make three
+        if (countFds == 2) {
+            counted = counted && smoke_wait_for_conns(mapperPort, 3);
+        }
+    }
+    counted = counted && send(fds[2], "?SM\n", 4, MSG_NOSIGNAL) == 4 &&
+            smoke_read_line(fds[2], reply, sizeof(reply));
+
+    // the cap is reached, so a fourth connection is closed unanswered
+    int refused = counted ? smoke_connect(mapperPort, false) : -1;
+    bool capped = refused != -1 &&
+            send(refused, "?SM\n", 4, MSG_NOSIGNAL) == 4 &&
+            recv(refused, reply, 1, 0) <= 0;
+    if (refused != -1) {
+        close(refused);
+    }
+
+    // closed by the client, then by the server once idle for a second
+    for (int i = 0; i < countFds - 1; ++i) {
+        close(fds[i]);
+    }
+    bool reclaimed = counted && smoke_wait_for_conns(mapperPort, 2);
+    long idleSince = now_ns();
+
+    // a :conns sent before the server saw the client close may have been
+    // refused too
+    bool expired = reclaimed && send(fds[2], "?SM\n", 4, MSG_NOSIGNAL) == 4 &&
+            smoke_read_line(fds[2], reply, sizeof(reply)) &&
+            recv(fds[2], reply, 1, 0) == 0 &&
+            now_ns() - idleSince >= 900000000L &&
+            smoke_ask(mapperPort, ":stats\n", reply) &&
+            strstr(reply, " refused=0 ") == NULL &&
+            strstr(reply, " expired=1\n") != NULL;
+    if (countFds == 3) {
+        close(fds[2]);
+    }
+    smoke_stop(mapper);
+    return counted && capped && reclaimed && expired;
+}
+
+/** Waits for a process to be running a given number of threads, as a
+ * server starts its workers after printing its port.
+ *
+ * @param pid Process to count in
+ * @param count Number of threads expected
+ * @return false if the process did not have that many threads in time
+ */
+bool smoke_wait_for_threads(pid_t pid, int count) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    long deadline = now_ns() + SMOKE_TIMEOUT * 1000000000L;
+    while (now_ns() < deadline) {
+        DIR* tasks = opendir(path);
+        if (tasks == NULL) {
+            return false;
+        }
+        int running = 0;
+        struct dirent* task;
+        while ((task = readdir(tasks)) != NULL) {
+            running += task->d_name[0] != '.';
+        }
+        closedir(tasks);
+        if (running == count) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+/** Checks that a server started with -t runs that many workers beside its
+ * acceptor, whatever number of connections it serves, and that :latency
+ * measures each connection's wait for its first byte.
+ *
+ * @param smoke The smoke run
+ * @return false if the threads or the connections measured are wrong
+ */
+bool smoke_pool(const Smoke* smoke) {
+    char* rest[] = {"-t", "3", NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, rest, &mapperPort);
+    int fds[40];
+    int countFds = 0;
+    char reply[SMOKE_REPLY_MAX];
+    bool served = mapper != -1 && smoke_wait_for_threads(mapper, 4);
+    while (served && countFds < 40) {
+        fds[countFds] = smoke_connect(mapperPort, false);
+        served = fds[countFds] != -1;
+        countFds += served;
+    }
+    for (int i = 0; served && i < countFds; ++i) {
+        served = send(fds[i], "?SM\n", 4, MSG_NOSIGNAL) == 4 &&
+                smoke_read_line(fds[i], reply, sizeof(reply)) &&
+                strcmp(reply, ";\n") == 0;
+    }
+
+    // the asking connection has sent its first byte too
+    long measured = 0;
+    long mean = 0;
+    long max = 0;
+    served = served && smoke_wait_for_threads(mapper, 4) &&
+            smoke_ask(mapperPort, ":latency\n", reply) &&
+            sscanf(reply, "%ld %ld %ld", &measured, &mean, &max) == 3 &&
+            measured == 41 && mean <= max;
+    for (int i = 0; i < countFds; ++i) {
+        close(fds[i]);
+    }
+    smoke_stop(mapper);
+    return served;
+}
+
+/** Checks that one ? line names several ids and gets a line per id, misses
+ * included, that queries sent together are answered in order, and that a
+ * ! line registers pairs only when its fields pair up.
+ *
+ * @param smoke The smoke run
+ * @return false if a reply was wrong or a line was registered wrongly
+ */
+bool smoke_lookups(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+    char reply[SMOKE_REPLY_MAX];
+    bool answered = mapper != -1 && smoke_ask(mapperPort,
+            "!LA:1:LB:2\n!LC:3:4\n!LD:5:LE\n"
+            "?LA:LX:LB\n?LC\n?LD\n?LE\n?LB:LA\n?\n", reply) &&
+            strcmp(reply, "1\n;\n2\n;\n;\n;\n2\n1\n;\n") == 0;
+
+    // a few hundred queries in one write come back in the order sent
+    OutputBuffer queries;
+    memset(&queries, 0, sizeof(OutputBuffer));
+    for (int i = 0; i < 300; ++i) {
+        output_printf(&queries, i % 3 == 2 ? "?LX\n" : "?L%c\n",
+                i % 3 == 0 ? 'A' : 'B');
+    }
+    output_append(&queries, "", 1);
+    answered = answered && smoke_ask(mapperPort, queries.data, reply);
+    for (int i = 0; answered && i < 300; ++i) {
+        answered = strncmp(reply + i * 2, i % 3 == 0 ? "1\n" :
+                i % 3 == 1 ? "2\n" : ";\n", 2) == 0;
+    }
+    answered = answered && strlen(reply) == 600;
+    free(queries.data);
+    smoke_stop(mapper);
+    return answered;
+}
+
+/** Starts a roc or a bench with the socket directory the bench was given,
+ * or a microbench, which reaches no server, for a check to read what it
+ * prints.
+ *
+ * @param smoke The smoke run
+ * @param path Program to run
+ * @param rest Arguments after the options, NULL terminated
+ * @param out Set to the read end of the program's standard output
+ * @return Process id, or -1 if it could not be started
+ */
+pid_t smoke_spawn(const Smoke* smoke, char* path, char** rest, int* out) {
+    char* args[16];
+    int count = 0;
+    args[count++] = path;
+    if (smoke->options->socketDirectory != NULL &&
+            path != smoke->microbenchPath) {
+        args[count++] = "-u";
+        args[count++] = smoke->options->socketDirectory;
+    }
+    for (int i = 0; rest[i] != NULL && count < 15; ++i) {
+        args[count++] = rest[i];
+    }
+    args[count] = NULL;
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        // the failures a check provokes are expected, so not reported
+        int quiet = open("/dev/null", O_WRONLY);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(quiet, STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(path, args);
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid == -1) {
+        close(fds[0]);
+        return -1;
+    }
+    *out = fds[0];
+    return pid;
+}
+
+/** Reads everything a program started by smoke_spawn prints and waits for
+ * it to exit.
+ *
+ * @param pid Process id of the program, or -1 if it was not started
+ * @param out Read end of its standard output
+ * @param output Where to store what it printed, null terminated,
+ *        SMOKE_REPLY_MAX bytes long
+ * @return Exit status of the program, or -1 if it did not exit normally
+ */
+int smoke_finish(pid_t pid, int out, char* output) {
+    output[0] = '\0';
+    if (pid == -1) {
+        return -1;
+    }
+    size_t length = 0;
+    ssize_t got;
+    while (length + 1 < SMOKE_REPLY_MAX &&
+            (got = read(out, output + length,
+            SMOKE_REPLY_MAX - 1 - length)) > 0) {
+        length += got;
+    }
+    output[length] = '\0';
+    close(out);
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+/** Listens on a port of its own as a server would, over the transport the
+ * bench was given, so that a check can play a destination.
+ *
+ * @param port Set to the port listened on
+ * @return Listening socket, or -1 if it could not be made
+ */
+int smoke_listen(int* port) {
+    struct sockaddr_storage address;
+    socklen_t length = port_address(0, &address);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in bound;
+    socklen_t boundLength = sizeof(bound);
+    if (fd == -1 || bind(fd, (struct sockaddr*) &address, length) != 0 ||
+            getsockname(fd, (struct sockaddr*) &bound, &boundLength) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    *port = ntohs(bound.sin_port);
+
+    // reached at the port's path instead, with the TCP port held as a
+    // server holds it
+    length = port_address(*port, &address);
+    if (address.ss_family == AF_UNIX) {
+        int local = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (local == -1 || bind(local, (struct sockaddr*) &address,
+                length) != 0) {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        fd = local;
+    }
+    if (listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/** Accepts a connection made to a socket from smoke_listen, giving up on a
+ * client which sends nothing in time.
+ *
+ * @param server Listening socket
+ * @return Connected socket, or -1 if none arrived
+ */
+int smoke_accept(int server) {
+    struct pollfd waiting = {server, POLLIN, 0};
+    if (poll(&waiting, 1, SMOKE_TIMEOUT * 1000) != 1) {
+        return -1;
+    }
+    int fd = accept(server, NULL, NULL);
+    struct timeval timeout = {SMOKE_TIMEOUT, 0};
+    if (fd != -1) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    return fd;
+}
+
+/** Runs a roc to the end with the socket directory the bench was given.
+ *
+ * @param smoke The smoke run
+ * @param rest Arguments after the options, NULL terminated
+ * @param output Where to store what it printed, null terminated,
+ *        SMOKE_REPLY_MAX bytes long
+ * @return Exit status of the roc, or -1 if it did not exit normally
+ */
+int smoke_roc(const Smoke* smoke, char** rest, char* output) {
+    int out;
+    pid_t roc = smoke_spawn(smoke, smoke->rocPath, rest, &out);
+    return smoke_finish(roc, out, output);
+}
+
+/** Asks the mapper for an id until it gives the port expected, as a
+ * control registering in lines is not answered.
+ *
+ * @param mapperPort Port of the mapper
+ * @param id Id asked for
+ * @param port Port expected
+ * @return false if the mapper did not give the port in time
+ */
+bool smoke_wait_for_port(int mapperPort, const char* id, int port) {
+    long deadline = now_ns() + SMOKE_TIMEOUT * 1000000000L;
+    char request[64];
+    char expected[16];
+    char reply[SMOKE_REPLY_MAX];
+    snprintf(request, sizeof(request), "?%s\n", id);
+    snprintf(expected, sizeof(expected), "%d\n", port);
+    while (!smoke_ask(mapperPort, request, reply) ||
+            strcmp(reply, expected) != 0) {
+        if (now_ns() >= deadline) {
+            return false;
+        }
+        usleep(10000);
+    }
+    return true;
+}
+
+/** Checks that a roc visits its destinations at once rather than one
+ * after the other: two destinations played by the check must both be sent
+ * the plane id before either answers, and the answers, given in reverse,
+ * are still printed in argument order. Then checks a flight through the
+ * mapper to real controls, one of them visited twice, and that a
+ * destination which can not be reached fails the roc without losing the
+ * others.
+ *
+ * @param smoke The smoke run
+ * @return false if a visit waited for another or went wrong
+ */
+bool smoke_fanout(const Smoke* smoke) {
+    int ports[2];
+    int servers[2] = {smoke_listen(&ports[0]), smoke_listen(&ports[1])};
+    char portNames[3][PORT_MAX_CHARS + 1];
+    for (int i = 0; i < 2; ++i) {
+        snprintf(portNames[i], sizeof(portNames[i]), "%d", ports[i]);
+    }
+    char* rest[] = {"FAN", "-", portNames[0], portNames[1], NULL};
+    int out;
+    pid_t roc = servers[0] == -1 || servers[1] == -1 ? -1 :
+            smoke_spawn(smoke, smoke->rocPath, rest, &out);
+    int fds[2] = {-1, -1};
+    char line[SMOKE_REPLY_MAX];
+    bool parallel = roc != -1;
+    for (int i = 0; parallel && i < 2; ++i) {
+        fds[i] = smoke_accept(servers[i]);
+        parallel = fds[i] != -1 && smoke_read_line(fds[i], line,
+                sizeof(line)) && strcmp(line, "FAN\n") == 0;
+    }
+    parallel = parallel && send(fds[1], "second\n", 7, MSG_NOSIGNAL) == 7 &&
+            send(fds[0], "first\n", 6, MSG_NOSIGNAL) == 6;
+    if (roc != -1 && !parallel) {
+        kill(roc, SIGTERM);
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+        if (servers[i] != -1) {
+            close(servers[i]);
+        }
+    }
+    char output[SMOKE_REPLY_MAX];
+    parallel = smoke_finish(roc, out, output) == 0 && parallel &&
+            strcmp(output, "first\nsecond\n") == 0;
+
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+    snprintf(portNames[0], sizeof(portNames[0]), "%d", mapperPort);
+    char* first[] = {"FA", "info1", portNames[0], NULL};
+    char* second[] = {"FB", "info2", portNames[0], NULL};
+    int controlPorts[2];
+    pid_t controls[2];
+    controls[0] = mapper == -1 ? -1 : smoke_start(smoke, smoke->controlPath,
+            first, &controlPorts[0]);
+    controls[1] = controls[0] == -1 ? -1 : smoke_start(smoke,
+            smoke->controlPath, second, &controlPorts[1]);
+
+    // the listening socket is closed, so its port is not served
+    int closedPort = 0;
+    int closed = smoke_listen(&closedPort);
+    if (closed != -1) {
+        close(closed);
+    }
+    snprintf(portNames[1], sizeof(portNames[1]), "%d", controlPorts[1]);
+    snprintf(portNames[2], sizeof(portNames[2]), "%d", closedPort);
+    char* flight[] = {"FLY", portNames[0], "FA", portNames[1], "FA", NULL};
+    char* failing[] = {"FLY", portNames[0], "FB", portNames[2], NULL};
+    char log[SMOKE_REPLY_MAX];
+    bool flown = controls[1] != -1 &&
+            smoke_wait_for_port(mapperPort, "FA", controlPorts[0]) &&
+            smoke_roc(smoke, flight, output) == 0 &&
+            strcmp(output, "info1\ninfo2\ninfo1\n") == 0 &&
+            smoke_ask(controlPorts[0], "log\n", log) &&
+            strcmp(log, "FLY\nFLY\n.\n") == 0 &&
+            smoke_wait_for_port(mapperPort, "FB", controlPorts[1]) &&
+            smoke_roc(smoke, failing, output) == ROC_FAILED_TO_CONNECT &&
+            strcmp(output, "info2\n") == 0;
+    smoke_stop(controls[1]);
+    smoke_stop(controls[0]);
+    smoke_stop(mapper);
+    return parallel && flown;
+}
+
+/** Sends a request of any length to a server on a new connection and reads
+ * everything it sends back until it closes the connection. The request is
+ * sent whole before anything is read, so the replies must fit below
+ * OUTPUT_HIGH_WATER for the server to keep reading.
+ *
+ * @param port Port of the server
+ * @param request Bytes to send
+ * @param reply Where to append the reply
+ * @return false if the server could not be reached or did not close the
+ *         connection in time
+ */
+bool smoke_exchange(int port, const OutputBuffer* request,
+        OutputBuffer* reply) {
+    int fd = smoke_connect(port, false);
+    if (fd == -1) {
+        return false;
+    }
+    bool sent = true;
+    for (size_t done = 0; sent && done < request->length; ) {
+        ssize_t got = send(fd, request->data + done, request->length - done,
+                MSG_NOSIGNAL);
+        sent = got > 0;
+        done += sent ? got : 0;
+    }
+    shutdown(fd, SHUT_WR);
+    char chunk[SMOKE_REPLY_MAX];
+    ssize_t got = 0;
+    while (sent && (got = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+        output_append(reply, chunk, got);
+    }
+    close(fd);
+    return sent && got == 0;
+}
+
+/** Checks that a dump, a log and thousands of pipelined answers too big
+ * for one write each arrive whole and in order.
+ *
+ * @param smoke The smoke run
+ * @return false if a reply was cut short or out of order
+ */
+bool smoke_outputs(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+    OutputBuffer request;
+    OutputBuffer expected;
+    OutputBuffer reply;
+    memset(&request, 0, sizeof(OutputBuffer));
+    memset(&expected, 0, sizeof(OutputBuffer));
+    memset(&reply, 0, sizeof(OutputBuffer));
+
+    // registered, dumped and queried on one connection, so in that order
+    int count = 20000;
+    for (int i = 0; i < count; ++i) {
+        output_printf(&request, "!O%05d:%d\n", i, 1000 + i);
+    }
+    output_append(&request, "@\n", 2);
+    for (int i = 0; i < count; ++i) {
+        output_printf(&expected, "O%05d:%d\n", i, 1000 + i);
+    }
+    for (int i = count - 1; i >= 0; --i) {
+        output_printf(&request, "?O%05d\n", i);
+        output_printf(&expected, "%d\n", 1000 + i);
+    }
+    bool whole = mapper != -1 &&
+            smoke_exchange(mapperPort, &request, &reply) &&
+            reply.length == expected.length &&
+            memcmp(reply.data, expected.data, expected.length) == 0;
+    smoke_stop(mapper);
+
+    // a control answers every visit, then logs them all
+    char* rest[] = {"OC", "seen", NULL};
+    int controlPort;
+    pid_t control = smoke_start(smoke, smoke->controlPath, rest,
+            &controlPort);
+    request.length = 0;
+    expected.length = 0;
+    reply.length = 0;
+    count = 5000;
+    for (int i = 0; i < count; ++i) {
+        output_printf(&request, "P%04d\n", i);
+        output_append(&expected, "seen\n", 5);
+    }
+    output_append(&request, "log\n", 4);
+    for (int i = 0; i < count; ++i) {
+        output_printf(&expected, "P%04d\n", i);
+    }
+    output_append(&expected, ".\n", 2);
+    whole = whole && control != -1 &&
+            smoke_exchange(controlPort, &request, &reply) &&
+            reply.length == expected.length &&
+            memcmp(reply.data, expected.data, expected.length) == 0;
+    smoke_stop(control);
+    free(request.data);
+    free(expected.data);
+    free(reply.data);
+    return whole;
+}
+
+/** Checks that lines split across writes are put back together, that a
+ * line far longer than a read is handled whole, and that a line beyond
+ * INPUT_LINE_MAX closes only its own connection.
+ *
+ * @param smoke The smoke run
+ * @return false if a line was mishandled
+ */
+bool smoke_lines(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+
+    // pauses between the pieces so each arrives in a read of its own
+    const char* pieces[] = {"!SP", "LIT:77\n?SPL", "IT\n"};
+    int fd = mapper == -1 ? -1 : smoke_connect(mapperPort, false);
+    bool split = fd != -1;
+    for (int i = 0; split && i < 3; ++i) {
+        size_t length = strlen(pieces[i]);
+        split = send(fd, pieces[i], length, MSG_NOSIGNAL) ==
+                (ssize_t) length;
+        usleep(50000);
+    }
+    char line[SMOKE_REPLY_MAX];
+    split = split && smoke_read_line(fd, line, sizeof(line)) &&
+            strcmp(line, "77\n") == 0;
+    if (fd != -1) {
+        close(fd);
+    }
+
+    // an id of a couple of hundred kilobytes is registered and found
+    OutputBuffer request;
+    OutputBuffer reply;
+    memset(&request, 0, sizeof(OutputBuffer));
+    memset(&reply, 0, sizeof(OutputBuffer));
+    size_t idLength = 200000;
+    char* id = malloc(idLength + 1);
+    memset(id, 'L', idLength);
+    id[idLength] = '\0';
+    output_printf(&request, "!%s:5\n?%s\n", id, id);
+    bool long_ = split && smoke_exchange(mapperPort, &request, &reply) &&
+            reply.length == 2 && memcmp(reply.data, "5\n", 2) == 0;
+
+    // past the limit the connection is closed without an answer, and the
+    // server goes on serving others
+    request.length = 0;
+    reply.length = 0;
+    output_append(&request, "?", 1);
+    while (request.length <= INPUT_LINE_MAX + INPUT_READ_MIN) {
+        output_append(&request, id, idLength);
+    }
+    fd = long_ ? smoke_connect(mapperPort, false) : -1;
+    bool limited = fd != -1;
+    for (size_t done = 0; limited && done < request.length; ) {
+        ssize_t got = send(fd, request.data + done, request.length - done,
+                MSG_NOSIGNAL);
+        if (got <= 0) {
+            break;
+        }
+        done += got;
+    }
+    if (fd != -1) {
+        errno = 0;
+        ssize_t got = recv(fd, line, sizeof(line), 0);
+        limited = limited && (got == 0 || (got == -1 && errno != EAGAIN &&
+                errno != EWOULDBLOCK));
+        close(fd);
+    }
+    char answer[SMOKE_REPLY_MAX];
+    limited = limited && smoke_ask(mapperPort, "?SPLIT\n", answer) &&
+            strcmp(answer, "77\n") == 0;
+    free(id);
+    free(request.data);
+    free(reply.data);
+    smoke_stop(mapper);
+    return split && long_ && limited;
+}
+
+/** Checks that ids keep their shard whatever the ports, spread evenly,
+ * move only to a shard that is added, and that roc -D merges the shards'
+ * lists of controls registered through a ring.
+ *
+ * @param smoke The smoke run
+ * @return false if the ring misplaced an id or the merged list is wrong
+ */
+bool smoke_ring(const Smoke* smoke) {
+    MapperRing rings[3];
+    bool parsed = parse_mapper_ring(&rings[0], "4001,4002,4003") &&
+            parse_mapper_ring(&rings[1], "5001,5002,5003") &&
+            parse_mapper_ring(&rings[2], "4001,4002,4003,4004");
+    MapperRing invalid;
+    parsed = parsed && !parse_mapper_ring(&invalid, "4001,,4002") &&
+            !parse_mapper_ring(&invalid, "0") &&
+            !parse_mapper_ring(&invalid, "4001,65536");
+    int count = 3000;
+    int shares[3] = {0, 0, 0};
+    bool stable = parsed;
+    for (int i = 0; stable && i < count; ++i) {
+        char id[16];
+        int length = snprintf(id, sizeof(id), "R%d", i);
+        int shard = ring_shard(&rings[0], id, length);
+        int grown = ring_shard(&rings[2], id, length);
+        stable = shard == ring_shard(&rings[1], id, length) &&
+                (grown == shard || grown == 3);
+        shares[shard]++;
+    }
+    for (int i = 0; stable && i < 3; ++i) {
+        stable = shares[i] > count / 5 && shares[i] < count / 2;
+    }
+    for (int i = 0; parsed && i < 3; ++i) {
+        free(rings[i].ports);
+        free(rings[i].points);
+    }
+
+    char* none[] = {NULL};
+    int mapperPorts[2];
+    pid_t mappers[2];
+    mappers[0] = smoke_start(smoke, smoke->mapperPath, none, &mapperPorts[0]);
+    mappers[1] = mappers[0] == -1 ? -1 :
+            smoke_start(smoke, smoke->mapperPath, none, &mapperPorts[1]);
+    char list[2 * PORT_MAX_CHARS + 2];
+    snprintf(list, sizeof(list), "%d,%d", mapperPorts[0], mapperPorts[1]);
+    MapperRing ring;
+    bool built = stable && mappers[1] != -1 &&
+            parse_mapper_ring(&ring, list);
+    bool merged = built;
+
+    // registered with the shard owning each id only
+    const char* ids[] = {"RA", "RB", "RC", "RD", "RE", "RF"};
+    int countControls = 6;
+    pid_t controls[6];
+    int controlPorts[6];
+    char expected[SMOKE_REPLY_MAX] = "";
+    char owned[2][SMOKE_REPLY_MAX] = {"", ""};
+    for (int i = 0; i < countControls; ++i) {
+        char* rest[] = {(char*) ids[i], "info", list, NULL};
+        controls[i] = merged ? smoke_start(smoke, smoke->controlPath, rest,
+                &controlPorts[i]) : -1;
+        merged = controls[i] != -1 && smoke_wait_for_port(
+                ring_port(&ring, ids[i]), ids[i], controlPorts[i]);
+        char line[PORT_MAX_CHARS + 8];
+        snprintf(line, sizeof(line), "%s:%d\n", ids[i], controlPorts[i]);
+        strcat(expected, line);
+        strcat(owned[merged ? ring_shard(&ring, ids[i], 2) : 0], line);
+    }
+    char reply[SMOKE_REPLY_MAX];
+    for (int i = 0; merged && i < 2; ++i) {
+        merged = smoke_ask(mapperPorts[i], "@\n", reply) &&
+                strcmp(reply, owned[i]) == 0;
+    }
+    char* dump[] = {"-D", list, NULL};
+    merged = merged && smoke_roc(smoke, dump, reply) == 0 &&
+            strcmp(reply, expected) == 0;
+
+    // a roc given the same ring finds each control on its shard
+    char* flight[] = {"RING", list, "RF", "RA", NULL};
+    merged = merged && smoke_roc(smoke, flight, reply) == 0 &&
+            strcmp(reply, "info\ninfo\n") == 0;
+    for (int i = 0; i < countControls; ++i) {
+        smoke_stop(controls[i]);
+    }
+    smoke_stop(mappers[1]);
+    smoke_stop(mappers[0]);
+    if (built) {
+        free(ring.ports);
+        free(ring.points);
+    }
+    return merged;
+}
+
+/** Reads how many ? lines a mapper has answered from its :stats.
+ *
+ * @param port Port of the mapper
+ * @return Number of ? lines answered, or -1 if it could not be read
+ */
+long smoke_queries(int port) {
+    char reply[SMOKE_REPLY_MAX];
+    long count;
+    if (!smoke_ask(port, ":stats\n", reply)) {
+        return -1;
+    }
+    char* line = strstr(reply, "\ncommand ? count=");
+    if (line == NULL || sscanf(line, "\ncommand ? count=%ld", &count) != 1) {
+        return -1;
+    }
+    return count;
+}
+
+/** Checks that a roc asks for an id given twice once, keeps what it learnt
+ * in its cache file, trusts the file's ports until they expire, and asks
+ * the mapper again for a cached port that cannot be reached.
+ *
+ * @param smoke The smoke run
+ * @return false if the roc asked the mapper more or less than it should
+ */
+bool smoke_cache(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+    char mapperName[PORT_MAX_CHARS + 1];
+    snprintf(mapperName, sizeof(mapperName), "%d", mapperPort);
+    char* rest[] = {"CA", "ca", mapperName, NULL};
+    int controlPort;
+    pid_t control = mapper == -1 ? -1 : smoke_start(smoke, smoke->controlPath,
+            rest, &controlPort);
+    char path[JOURNAL_PATH_MAX];
+    smoke_path(smoke, "routes", path);
+    char* flight[] = {"-C", path, "CACHE", mapperName, "CA", "CA", NULL};
+    char output[SMOKE_REPLY_MAX];
+    long before = -1;
+    bool once = control != -1 &&
+            smoke_wait_for_port(mapperPort, "CA", controlPort) &&
+            (before = smoke_queries(mapperPort)) >= 0 &&
+            smoke_roc(smoke, flight, output) == 0 &&
+            strcmp(output, "ca\nca\n") == 0 &&
+            smoke_queries(mapperPort) == before + 1;
+
+    // the file holds the one port learnt, written whole under its name
+    char expected[SMOKE_REPLY_MAX];
+    snprintf(expected, sizeof(expected), " %d %d CA\n", controlPort,
+            mapperPort);
+    FILE* file = fopen(path, "r");
+    char line[SMOKE_REPLY_MAX] = "";
+    long expires = 0;
+    bool saved = once && file != NULL &&
+            fgets(line, sizeof(line), file) != NULL &&
+            sscanf(line, "%ld", &expires) == 1 &&
+            expires > time(NULL) && strstr(line, expected) != NULL &&
+            fgets(line, sizeof(line), file) == NULL;
+    if (file != NULL) {
+        fclose(file);
+    }
+    DIR* directory = opendir(smoke->directory);
+    struct dirent* found;
+    while (directory != NULL && (found = readdir(directory)) != NULL) {
+        saved = saved && strncmp(found->d_name, "routes.", 7) != 0;
+    }
+    if (directory != NULL) {
+        closedir(directory);
+    }
+
+    // unexpired ports are used without asking, expired ones are asked for
+    before = saved ? smoke_queries(mapperPort) : -1;
+    bool trusted = before >= 0 && smoke_roc(smoke, flight, output) == 0 &&
+            strcmp(output, "ca\nca\n") == 0 &&
+            smoke_queries(mapperPort) == before;
+    file = fopen(path, "w");
+    if (file != NULL) {
+        fprintf(file, "%ld %d %d CA\n", (long) time(NULL) - 1, controlPort,
+                mapperPort);
+        fclose(file);
+    }
+    trusted = trusted && file != NULL &&
+            smoke_roc(smoke, flight, output) == 0 &&
+            smoke_queries(mapperPort) == before + 1;
+
+    // a cached port nothing listens on is asked for again, once
+    int closedPort = 0;
+    int closed = smoke_listen(&closedPort);
+    if (closed != -1) {
+        close(closed);
+    }
+    file = fopen(path, "w");
+    if (file != NULL) {
+        fprintf(file, "%ld %d %d CA\n", (long) time(NULL) + 300, closedPort,
+                mapperPort);
+        fclose(file);
+    }
+    struct stat first;
+    struct stat second;
+    bool moved = trusted && file != NULL && stat(path, &first) == 0 &&
+            smoke_roc(smoke, flight, output) == 0 &&
+            strcmp(output, "ca\nca\n") == 0 &&
+            smoke_queries(mapperPort) == before + 2 &&
+            stat(path, &second) == 0 && first.st_ino != second.st_ino;
+    file = fopen(path, "r");
+    moved = moved && file != NULL &&
+            fgets(line, sizeof(line), file) != NULL &&
+            strstr(line, expected) != NULL;
+    if (file != NULL) {
+        fclose(file);
+    }
+    smoke_stop(control);
+    smoke_stop(mapper);
+    return once && saved && trusted && moved;
+}
+
+/** Checks that a server reached through a socket directory keeps its TCP
+ * port from other programs, and that a socket path is only taken over
+ * once nothing answers there.
+ *
+ * @param smoke The smoke run
+ * @return false if a live path was seen as free or a stale one as taken
+ */
+bool smoke_sockets(const Smoke* smoke) {
+    struct sockaddr_storage address;
+    memset(&address, 0, sizeof(struct sockaddr_storage));
+    struct sockaddr_un* local = (struct sockaddr_un*) &address;
+    local->sun_family = AF_UNIX;
+    smoke_path(smoke, "taken.sock", local->sun_path);
+    socklen_t length = sizeof(struct sockaddr_un);
+    bool free_ = !socket_path_in_use(&address, length);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool taken = fd != -1 &&
+            bind(fd, (struct sockaddr*) &address, length) == 0 &&
+            listen(fd, 1) == 0 && socket_path_in_use(&address, length);
+    if (fd != -1) {
+        close(fd);
+    }
+    // the file outlives its server, which has gone
+    bool stale = taken && access(local->sun_path, F_OK) == 0 &&
+            !socket_path_in_use(&address, length);
+
+    // a server's path answers, and its TCP port is bound but not served
+    char* directory[] = {"-u", (char*) smoke->directory, NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, directory,
+            &mapperPort);
+    bool held = false;
+    if (mapper != -1) {
+        snprintf(local->sun_path, sizeof(local->sun_path), "%s/%d.sock",
+                smoke->directory, mapperPort);
+        struct sockaddr_in tcp;
+        memset(&tcp, 0, sizeof(struct sockaddr_in));
+        tcp.sin_family = AF_INET;
+        tcp.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        tcp.sin_port = htons(mapperPort);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        held = socket_path_in_use(&address, length) && fd != -1 &&
+                bind(fd, (struct sockaddr*) &tcp, sizeof(tcp)) != 0 &&
+                errno == EADDRINUSE;
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    smoke_stop(mapper);
+    return free_ && taken && stale && held;
+}
+
+/** Checks that a string pool packs strings end to end, gives one longer
+ * than a block a block of its own, and that control's registry keeps ids
+ * of any length whole with its index growing geometrically.
+ *
+ * @param smoke The smoke run
+ * @return false if a string was damaged or storage grew too much
+ */
+bool smoke_strings(const Smoke* smoke) {
+    (void) smoke;
+    StringPool pool;
+    init_string_pool(&pool);
+    size_t longLength = 2 * POOL_BLOCK_SIZE;
+    char* longString = malloc(longLength + 1);
+    memset(longString, 'S', longLength);
+    longString[longLength] = '\0';
+    int count = 100000;
+    char** copies = malloc(sizeof(char*) * count);
+    size_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        char id[16];
+        int length = snprintf(id, sizeof(id), "S%d", i);
+        copies[i] = pool_copy(&pool, id, length);
+        total += length + 1;
+        if (i == count / 2) {
+            char* copy = pool_copy(&pool, longString, longLength);
+            free(longString);
+            longString = copy;
+        }
+    }
+    bool packed = strlen(longString) == longLength &&
+            longString[longLength - 1] == 'S' &&
+            pool.reserved <= total + longLength + 1 + 2 * POOL_BLOCK_SIZE;
+    for (int i = 0; packed && i < count; ++i) {
+        char id[16];
+        snprintf(id, sizeof(id), "S%d", i);
+        packed = strcmp(copies[i], id) == 0;
+    }
+    free(copies);
+    free_string_pool(&pool);
+
+    // a plane id past the 80 characters once allocated for each is whole
+    PlaneRegistry registry;
+    init_plane_registry(&registry);
+    char longId[301];
+    memset(longId, 'P', 300);
+    longId[300] = '\0';
+    int planes = 1000;
+    int visits = 20000;
+    for (int i = 0; i < visits; ++i) {
+        char id[16];
+        int length = snprintf(id, sizeof(id), "P%04d", i % planes);
+        plane_registry_visit(&registry, id, length);
+    }
+    plane_registry_visit(&registry, longId, 300);
+    PlaneTally tally;
+    plane_registry_tally(&registry, &tally);
+    finish_plane_tally(&tally);
+    bool whole = registry.countPlanes == planes + 1 &&
+            registry.capacityPlanes < 2 * (planes + 1) + 16 &&
+            registry.visits == visits + 1 &&
+            tally.countEntries == planes + 1;
+    for (int i = 0; whole && i < planes; ++i) {
+        char id[16];
+        snprintf(id, sizeof(id), "P%04d", i);
+        whole = strcmp(tally.entries[i].id, id) == 0 &&
+                tally.entries[i].count == visits / planes;
+    }
+    whole = whole && strcmp(tally.entries[planes].id, longId) == 0 &&
+            tally.entries[planes].count == 1;
+    free_plane_tally(&tally);
+    free(registry.planes);
+    free(registry.slots);
+    free(registry.ordered);
+    free(registry.history);
+    free_string_pool(&registry.ids);
+    return packed && whole;
+}
+
+/** Checks that control keeps one entry per distinct plane with its count,
+ * lists the counts for :counts and expands them for log, and takes a plane
+ * named counts as a visit.
+ *
+ * @param smoke The smoke run
+ * @return false if a count or a listing was wrong
+ */
+bool smoke_counts(const Smoke* smoke) {
+    char* rest[] = {"CO", "here", NULL};
+    int controlPort;
+    pid_t control = smoke_start(smoke, smoke->controlPath, rest,
+            &controlPort);
+    char reply[SMOKE_REPLY_MAX];
+    bool counted = control != -1 &&
+            smoke_ask(controlPort, "CB\nCA\ncounts\nCA\nCB\nCA\n", reply) &&
+            strcmp(reply, "here\nhere\nhere\nhere\nhere\nhere\n") == 0 &&
+            smoke_ask(controlPort, ":counts\nCA\n", reply) &&
+            strcmp(reply, "CA 3\nCB 2\ncounts 1\n.\n") == 0 &&
+            smoke_ask(controlPort, "log\n", reply) &&
+            strcmp(reply, "CA\nCA\nCA\nCB\nCB\ncounts\n.\n") == 0 &&
+            smoke_ask(controlPort, ":stats\n", reply) &&
+            strstr(reply, "\nentries planes=3 visits=6 ") != NULL;
+    smoke_stop(control);
+    return counted;
+}
+
+/** Checks that :log-since returns the latest sequence number and only the
+ * visits after the cursor given, in visit order, and that a line spelt
+ * log-since is taken as a visit.
+ *
+ * @param smoke The smoke run
+ * @return false if a reply held the wrong visits
+ */
+bool smoke_log_since(const Smoke* smoke) {
+    char* rest[] = {"LS", "here", NULL};
+    int controlPort;
+    pid_t control = smoke_start(smoke, smoke->controlPath, rest,
+            &controlPort);
+    char reply[SMOKE_REPLY_MAX];
+    bool polled = control != -1 &&
+            smoke_ask(controlPort, "V1\nV2\nV1\n", reply) &&
+            smoke_ask(controlPort, ":log-since 0\n", reply) &&
+            strcmp(reply, "3\nV1\nV2\nV1\n.\n") == 0 &&
+            smoke_ask(controlPort, ":log-since 2\n", reply) &&
+            strcmp(reply, "3\nV1\n.\n") == 0 &&
+            smoke_ask(controlPort, ":log-since 3\n", reply) &&
+            strcmp(reply, "3\n.\n") == 0 &&
+            smoke_ask(controlPort, ":log-since 9\n", reply) &&
+            strcmp(reply, "3\n.\n") == 0 &&
+            smoke_ask(controlPort, ":log-since x\n", reply) &&
+            strcmp(reply, ".\n") == 0 &&
+            smoke_ask(controlPort, "log-since 0\n", reply) &&
+            strcmp(reply, "here\n") == 0 &&
+            smoke_ask(controlPort, ":log-since 3\n", reply) &&
+            strcmp(reply, "4\nlog-since 0\n.\n") == 0;
+    smoke_stop(control);
+    return polled;
+}
+
+/** Checks that control holds no more visits than it retains, compacts the
+ * planes left with none, spills the rest to a segment trimmed to its cap,
+ * and reads a spilled cursor from the block holding it.
+ *
+ * @param smoke The smoke run
+ * @return false if a visit was lost, misread or storage outgrew its bounds
+ */
+bool smoke_retention(const Smoke* smoke) {
+    char path[JOURNAL_PATH_MAX];
+    smoke_path(smoke, "spill", path);
+    PlaneRegistry registry;
+    init_plane_registry(&registry);
+    long retain = 100;
+    long spillMax = 20000;
+    int planes = 300;
+    long visits = 50000;
+    bool bounded = plane_registry_retain(&registry, retain, path, spillMax);
+    for (long i = 0; bounded && i < visits; ++i) {
+        char id[16];
+        int length = snprintf(id, sizeof(id), "T%03ld", i % planes);
+        plane_registry_visit(&registry, id, length);
+    }
+    struct stat status;
+    fflush(registry.spill);
+    bounded = bounded && registry.visits == visits &&
+            registry.oldest == visits - retain + 1 &&
+            registry.spilled == visits - retain &&
+            registry.livePlanes == retain &&
+            registry.countPlanes <= 2 * registry.livePlanes + 64 &&
+            registry.spillDropped > 0 &&
+            registry.spillDropped % SPILL_BLOCK_VISITS == 0 &&
+            stat(path, &status) == 0 && status.st_size < 2 * spillMax;
+
+    // log counts every visit still on disk or in memory
+    long* expected = calloc(planes, sizeof(long));
+    for (long i = registry.spillDropped; i < visits; ++i) {
+        expected[i % planes]++;
+    }
+    PlaneTally tally;
+    if (bounded) {
+        plane_registry_tally(&registry, &tally);
+        finish_plane_tally(&tally);
+        bounded = tally.countEntries == planes;
+        for (int i = 0; bounded && i < planes; ++i) {
+            char id[16];
+            snprintf(id, sizeof(id), "T%03d", i);
+            bounded = strcmp(tally.entries[i].id, id) == 0 &&
+                    tally.entries[i].count == expected[i];
+        }
+        free_plane_tally(&tally);
+    }
+    free(expected);
+
+    // a cursor among the spilled visits is read from its own block
+    long since = registry.spilled - 10;
+    SpillReader reader;
+    bool sought = bounded && open_spill_reader(&registry, &reader, since) &&
+            reader.sequence > since - SPILL_BLOCK_VISITS &&
+            reader.sequence <= since;
+    int code;
+    long next = since + 1;
+    while (sought && (code = spill_next(&reader)) != -1) {
+        if (reader.sequence <= since) {
+            continue;
+        }
+        char id[16];
+        snprintf(id, sizeof(id), "T%03ld", (next - 1) % planes);
+        sought = reader.sequence == next++ &&
+                strcmp(reader.ids[code], id) == 0;
+    }
+    sought = sought && next == registry.spilled + 1;
+    if (bounded) {
+        close_spill_reader(&reader);
+    }
+    if (registry.spill != NULL) {
+        fclose(registry.spill);
+    }
+    free(registry.planes);
+    free(registry.slots);
+    free(registry.ordered);
+    free(registry.history);
+    free(registry.spillBlocks);
+    free_string_pool(&registry.ids);
+
+    // a control given -r and -s answers from memory and its segment
+    char* rest[] = {"-r", "5", "-s", path, "-m", "64", "RT", "here", NULL};
+    int controlPort;
+    pid_t control = sought ? smoke_start(smoke, smoke->controlPath, rest,
+            &controlPort) : -1;
+    char request[SMOKE_REPLY_MAX] = "";
+    char log[SMOKE_REPLY_MAX] = "";
+    char since3[SMOKE_REPLY_MAX] = "20\n";
+    for (int i = 1; i <= 20; ++i) {
+        char line[16];
+        snprintf(line, sizeof(line), "R%02d\n", i);
+        strcat(request, line);
+        strcat(log, line);
+        if (i > 3) {
+            strcat(since3, line);
+        }
+    }
+    strcat(log, ".\n");
+    strcat(since3, ".\n");
+    char reply[SMOKE_REPLY_MAX];
+    bool served = control != -1 && smoke_ask(controlPort, request, reply) &&
+            smoke_ask(controlPort, ":log-since 3\n", reply) &&
+            strcmp(reply, since3) == 0 &&
+            smoke_ask(controlPort, ":log-since 17\n", reply) &&
+            strcmp(reply, "20\nR18\nR19\nR20\n.\n") == 0 &&
+            smoke_ask(controlPort, "log\n", reply) &&
+            strcmp(reply, log) == 0 &&
+            smoke_ask(controlPort, ":stats\n", reply) &&
+            strstr(reply, " visits=20 retained=5 spilled=15\n") != NULL;
+    smoke_stop(control);
+    return bounded && sought && served;
+}
+
+/** Checks that roc refuses a plane id which control would take as an admin
+ * command, and that control answers those commands while logging planes
+ * named after the old unprefixed spellings.
+ *
+ * @param smoke The smoke run
+ * @return false if a command and a plane id were confused
+ */
+bool smoke_prefixes(const Smoke* smoke) {
+    char* rest[] = {"PX", "here", NULL};
+    int controlPort;
+    pid_t control = smoke_start(smoke, smoke->controlPath, rest,
+            &controlPort);
+    char portName[PORT_MAX_CHARS + 1];
+    snprintf(portName, sizeof(portName), "%d", controlPort);
+    char* commands[] = {":stats", "-", portName, NULL};
+    char* plane[] = {"stats", "-", portName, NULL};
+    char output[SMOKE_REPLY_MAX];
+    char reply[SMOKE_REPLY_MAX];
+    bool prefixed = control != -1 &&
+            smoke_roc(smoke, commands, output) == ROC_INCORRECT_NUM_ARGS &&
+            strlen(output) == 0 &&
+            smoke_roc(smoke, plane, output) == 0 &&
+            strcmp(output, "here\n") == 0 &&
+            smoke_ask(controlPort, "conns\nlatency\n", reply) &&
+            strcmp(reply, "here\nhere\n") == 0 &&
+            smoke_ask(controlPort, ":stats\n", reply) &&
+            strncmp(reply, "connections live=", 17) == 0 &&
+            strstr(reply, "\nentries planes=3 visits=3 ") != NULL &&
+            smoke_ask(controlPort, ":conns\n", reply) &&
+            strcmp(reply, "1\n") == 0 &&
+            smoke_ask(controlPort, "log\n", reply) &&
+            strcmp(reply, "conns\nlatency\nstats\n.\n") == 0;
+    smoke_stop(control);
+    return prefixed;
+}
+
+/** Checks that a short bench run in lines and in frames answers every
+ * request and reports throughput, latency percentiles and CPU.
+ *
+ * @param smoke The smoke run
+ * @return false if a run failed, lost requests or left out a report
+ */
+bool smoke_bench(const Smoke* smoke) {
+    char* lines[] = {"-n", "2", "-m", "8", "-d", "1", NULL};
+    char* frames[] = {"-n", "2", "-m", "8", "-d", "1", "-b", NULL};
+    char** runs[] = {lines, frames};
+    bool reported = true;
+    for (int i = 0; reported && i < 2; ++i) {
+        int out;
+        pid_t bench = smoke_spawn(smoke, smoke->benchPath, runs[i], &out);
+        char output[SMOKE_REPLY_MAX];
+        long count = 0;
+        long errors = -1;
+        char* requests;
+        reported = smoke_finish(bench, out, output) == 0 &&
+                strncmp(output, "run controls=2 rocs=8 ", 22) == 0 &&
+                strstr(output, i == 0 ? " protocol=lines\n" :
+                " protocol=frames\n") != NULL &&
+                (requests = strstr(output, "\nrequests count=")) != NULL &&
+                sscanf(requests, "\nrequests count=%ld per_second=%*d "
+                "errors=%ld", &count, &errors) == 2 &&
+                count > 0 && errors == 0 &&
+                strstr(output, "\nlatency lookup p50_ns=") != NULL &&
+                strstr(output, "\nlatency visit p50_ns=") != NULL &&
+                strstr(output, "\nlatency trip p50_ns=") != NULL &&
+                strstr(output, "\ncpu mapper_ns_per_lookup=") != NULL;
+    }
+    return reported;
+}
+
+/** Checks that a small microbench run times every operation in both id
+ * orders, one line each, and that looking up ids allocates nothing.
+ *
+ * @param smoke The smoke run
+ * @return false if the run failed or an operation was missing
+ */
+bool smoke_microbench(const Smoke* smoke) {
+    char* rest[] = {"-n", "1000", "-o", "1000", NULL};
+    int out;
+    pid_t microbench = smoke_spawn(smoke, smoke->microbenchPath, rest, &out);
+    char output[SMOKE_REPLY_MAX];
+    bool timed = smoke_finish(microbench, out, output) == 0;
+    const char* operations[] = {"add_mapping", "get_airport",
+            "do_mapper_query", "print_mappings", "control_visit"};
+    const char* orders[] = {"random", "sorted"};
+    int lines = 0;
+    for (char* line = output; timed && *line != '\0';
+            line = strchr(line, '\n') + 1) {
+        char operation[32];
+        char order[16];
+        long entries;
+        double nanoseconds;
+        double allocations;
+        timed = strchr(line, '\n') != NULL &&
+                sscanf(line, "op=%31s order=%15s entries=%ld ops=%*d "
+                "ns_per_op=%lf allocs_per_op=%lf", operation, order,
+                &entries, &nanoseconds, &allocations) == 5 &&
+                strcmp(operation, operations[lines % 5]) == 0 &&
+                strcmp(order, orders[lines / 5 % 2]) == 0 &&
+                entries == 1000 && nanoseconds > 0 &&
+                (strcmp(operation, "get_airport") != 0 || allocations == 0);
+        lines++;
+    }
+    return timed && lines == 10;
+}
+
+/** Checks that registrations and queries are checked alike whether they
+ * come in lines or in frames.
+ *
+ * @param smoke The smoke run
+ * @return false if a frame was taken where its line would not be, or the
+ *         two were answered differently
+ */
+bool smoke_registrations(const Smoke* smoke) {
+    char* none[] = {NULL};
+    int mapperPort;
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, none, &mapperPort);
+
+    // ports of 257 are framed as two bytes of 1
+    Frame reply;
+    char* buffer = NULL;
+    size_t capacity = 0;
+    char lines[SMOKE_REPLY_MAX];
+    bool alike = mapper != -1 &&
+            smoke_frame(mapperPort, FRAME_REGISTER, "\x01\x01SM:X", &reply,
+            &buffer, &capacity) && reply.code == FRAME_REJECTED &&
+            smoke_frame(mapperPort, FRAME_REGISTER, "\x01\x01SMR", &reply,
+            &buffer, &capacity) && reply.code == FRAME_OK &&
+            smoke_frame(mapperPort, FRAME_QUERY, "SMR", &reply, &buffer,
+            &capacity) && reply.code == FRAME_OK &&
+            frame_u16(reply.payload) == 257 &&
+            smoke_frame(mapperPort, FRAME_QUERY, "SM", &reply, &buffer,
+            &capacity) && reply.code == FRAME_NOT_FOUND &&
+            smoke_ask(mapperPort, "!SMZ:0\n!SMY:70000\n?SMR\n?SMZ\n?SMY\n",
+            lines) && strcmp(lines, "257\n;\n;\n") == 0;
+    free(buffer);
+    smoke_stop(mapper);
+    return alike;
+}
+
+/** Writes a mappings file laid out as a snapshot.
+ *
+ * @param path File to write
+ * @param ids Airport ids
+ * @param ports Airport ports, one per id
+ * @param count Number of airports
+ * @return false if the file could not be written
+ */
+bool smoke_write_records(const char* path, const char** ids,
+        const uint32_t* ports, size_t count) {
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.generation = 0;
+    header.count = count;
+    header.length = 0;
+    for (size_t i = 0; i < count; ++i) {
+        header.length += 2 * sizeof(uint32_t) + strlen(ids[i]) + 1;
+    }
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    fwrite(&header, sizeof(SnapshotHeader), 1, file);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t fields[2] = {ports[i], (uint32_t) strlen(ids[i])};
+        fwrite(fields, sizeof(fields), 1, file);
+        fwrite(ids[i], 1, strlen(ids[i]) + 1, file);
+    }
+    return fclose(file) == 0;
+}
+
+/** Starts a mapper preloading a file, which is expected to refuse it.
+ *
+ * @param smoke The smoke run
+ * @param preload File of mappings
+ * @return false if the mapper served, and so was stopped
+ */
+bool smoke_preload_refused(const Smoke* smoke, char* preload) {
+    char* rest[] = {"-p", preload, NULL};
+    int mapperPort;
+    // the mapper's complaint is expected, so is kept out of the report
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    close(null);
+    pid_t mapper = smoke_start(smoke, smoke->mapperPath, rest, &mapperPort);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    smoke_stop(mapper);
+    return mapper == -1;
+}
+
+/** Checks that a record file holding a mapping no registration would take
+ * is refused whole, and that a preload kept with -d is on disk by the time
+ * the mapper serves, without waiting on a background snapshot.
+ *
+ * @param smoke The smoke run
+ * @return false if a bad file was loaded, or the preload was not kept
+ */
+bool smoke_records(const Smoke* smoke) {
+    char preload[JOURNAL_PATH_MAX];
+    smoke_path(smoke, "records", preload);
+    const char* ids[] = {"SMA", "SMB"};
+    const char* colons[] = {"SMA", "S:B"};
+    uint32_t ports[] = {1001, 1002};
+    uint32_t zero[] = {1001, 0};
+    uint32_t wide[] = {1001, 70000};
+    bool refused = smoke_write_records(preload, ids, zero, 2) &&
+            smoke_preload_refused(smoke, preload) &&
+            smoke_write_records(preload, ids, wide, 2) &&
+            smoke_preload_refused(smoke, preload) &&
+            smoke_write_records(preload, colons, ports, 2) &&
+            smoke_preload_refused(smoke, preload);
+
+    char directory[JOURNAL_PATH_MAX];
+    char snapshot[JOURNAL_PATH_MAX + 16];
+    smoke_path(smoke, "records.d", directory);
+    snprintf(snapshot, sizeof(snapshot), "%s/snapshot", directory);
+    char* keeping[] = {"-d", directory, "-p", preload, NULL};
+    int mapperPort;
+    pid_t mapper = refused && mkdir(directory, 0700) == 0 &&
+            smoke_write_records(preload, ids, ports, 2) ?
+            smoke_start(smoke, smoke->mapperPath, keeping, &mapperPort) : -1;
+    struct stat status;
+    bool kept = mapper != -1 && stat(snapshot, &status) == 0;
+    if (mapper != -1) {
+        kill(mapper, SIGKILL);
+        waitpid(mapper, NULL, 0);
+    }
+
+    char* restoring[] = {"-d", directory, NULL};
+    mapper = kept ? smoke_start(smoke, smoke->mapperPath, restoring,
+            &mapperPort) : -1;
+    char reply[SMOKE_REPLY_MAX];
+    bool restored = mapper != -1 &&
+            smoke_ask(mapperPort, "?SMA\n?SMB\n", reply) &&
+            strcmp(reply, "1001\n1002\n") == 0;
+    smoke_stop(mapper);
+    return refused && kept && restored;
+}
+
+/** Runs every smoke check, each against servers of its own, and prints
+ * how each went.
+ *
+ * @param options Options of the bench; its threads and socket directory
+ *        are passed on to the servers
+ * @return false if a check failed
+ */
+bool run_smoke(const BenchOptions* options) {
+    SmokeCheck checks[] = {
+        {"preload", smoke_preload},
+        {"restore", smoke_restore},
+        {"since", smoke_since},
+        {"watch", smoke_watch},
+        {"frames", smoke_frames},
+        {"histogram", smoke_histogram},
+        {"stats", smoke_stats},
+        {"table", smoke_table},
+        {"ordered", smoke_ordered},
+        {"readers", smoke_readers},
+        {"connections", smoke_connections},
+        {"lifetimes", smoke_lifetimes},
+        {"pool", smoke_pool},
+        {"lookups", smoke_lookups},
+        {"fanout", smoke_fanout},
+        {"outputs", smoke_outputs},
+        {"lines", smoke_lines},
+        {"ring", smoke_ring},
+        {"cache", smoke_cache},
+        {"sockets", smoke_sockets},
+        {"strings", smoke_strings},
+        {"counts", smoke_counts},
+        {"log-since", smoke_log_since},
+        {"retention", smoke_retention},
+        {"prefixes", smoke_prefixes},
+        {"bench", smoke_bench},
+        {"microbench", smoke_microbench},
+        {"registrations", smoke_registrations},
+        {"records", smoke_records}
+    };
+    Smoke smoke;
+    smoke.options = options;
+    smoke.mapperPath = sibling_program("mapper");
+    smoke.controlPath = sibling_program("control");
+    smoke.rocPath = sibling_program("roc");
+    smoke.benchPath = sibling_program("bench");
+    smoke.microbenchPath = sibling_program("microbench");
+    strcpy(smoke.directory, "/tmp/smoke2310.XXXXXX");
+    if (mkdtemp(smoke.directory) == NULL || smoke.mapperPath == NULL ||
+            smoke.controlPath == NULL || smoke.rocPath == NULL ||
+            smoke.benchPath == NULL || smoke.microbenchPath == NULL) {
+        return smoke_check("start", false);
+    }
+    bool passed = true;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(SmokeCheck); ++i) {
+        passed = smoke_check(checks[i].name, checks[i].run(&smoke)) &&
+                passed;
+    }
+    nftw(smoke.directory, smoke_remove, 16, FTW_DEPTH | FTW_PHYS);
+    free(smoke.mapperPath);
+    free(smoke.controlPath);
+    free(smoke.rocPath);
+    free(smoke.benchPath);
+    free(smoke.microbenchPath);
+    return passed;
+}
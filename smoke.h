@@ -0,0 +1,96 @@
+#ifndef SMOKE_H
+#define SMOKE_H
+
+#include <stdbool.h>
+#include <ftw.h>
+#include "bench.h"
+
+// seconds a smoke check waits for a reply or a snapshot before failing
+#define SMOKE_TIMEOUT 5
+
+// longest reply a smoke check reads
+#define SMOKE_REPLY_MAX 4096
+
+/** Programs and scratch directory shared by the smoke checks. **/
+typedef struct Smoke {
+    // options of the bench, passed on to the servers
+    const BenchOptions* options;
+
+    // programs built alongside the bench
+    char* mapperPath;
+    char* controlPath;
+    char* rocPath;
+    char* benchPath;
+    char* microbenchPath;
+
+    // directory the checks keep files in, removed once they are done
+    char directory[32];
+} Smoke;
+
+/** A smoke check, run against servers of its own. **/
+typedef struct SmokeCheck {
+    // name printed with how the check went
+    const char* name;
+
+    // runs the check, returning false if it failed
+    bool (*run)(const Smoke* smoke);
+} SmokeCheck;
+
+bool smoke_check(const char* name, bool passed);
+int smoke_connect(int port, bool framed);
+bool smoke_read_line(int fd, char* line, size_t size);
+bool smoke_ask(int port, const char* request, char* reply);
+bool smoke_frame(int port, uint8_t code, char* payload, Frame* reply,
+        char** buffer, size_t* capacity);
+bool smoke_wait_for_file(const char* path);
+void smoke_stop(pid_t pid);
+int smoke_remove(const char* path, const struct stat* status, int type,
+        struct FTW* walk);
+char* smoke_path(const Smoke* smoke, const char* name, char* path);
+pid_t smoke_start(const Smoke* smoke, char* path, char** rest, int* port);
+bool smoke_preload(const Smoke* smoke);
+bool smoke_restore(const Smoke* smoke);
+bool smoke_since(const Smoke* smoke);
+bool smoke_watch(const Smoke* smoke);
+bool smoke_frames(const Smoke* smoke);
+bool smoke_histogram(const Smoke* smoke);
+bool smoke_stats(const Smoke* smoke);
+bool smoke_table(const Smoke* smoke);
+bool smoke_ordered(const Smoke* smoke);
+bool smoke_readers(const Smoke* smoke);
+bool smoke_connections(const Smoke* smoke);
+bool smoke_wait_for_conns(int port, int live);
+bool smoke_lifetimes(const Smoke* smoke);
+bool smoke_wait_for_threads(pid_t pid, int count);
+bool smoke_pool(const Smoke* smoke);
+bool smoke_lookups(const Smoke* smoke);
+pid_t smoke_spawn(const Smoke* smoke, char* path, char** rest, int* out);
+int smoke_finish(pid_t pid, int out, char* output);
+int smoke_listen(int* port);
+int smoke_accept(int server);
+int smoke_roc(const Smoke* smoke, char** rest, char* output);
+bool smoke_wait_for_port(int mapperPort, const char* id, int port);
+bool smoke_fanout(const Smoke* smoke);
+bool smoke_exchange(int port, const OutputBuffer* request,
+        OutputBuffer* reply);
+bool smoke_outputs(const Smoke* smoke);
+bool smoke_lines(const Smoke* smoke);
+bool smoke_ring(const Smoke* smoke);
+long smoke_queries(int port);
+bool smoke_cache(const Smoke* smoke);
+bool smoke_sockets(const Smoke* smoke);
+bool smoke_strings(const Smoke* smoke);
+bool smoke_counts(const Smoke* smoke);
+bool smoke_log_since(const Smoke* smoke);
+bool smoke_retention(const Smoke* smoke);
+bool smoke_prefixes(const Smoke* smoke);
+bool smoke_bench(const Smoke* smoke);
+bool smoke_microbench(const Smoke* smoke);
+bool smoke_registrations(const Smoke* smoke);
+bool smoke_write_records(const char* path, const char** ids,
+        const uint32_t* ports, size_t count);
+bool smoke_preload_refused(const Smoke* smoke, char* preload);
+bool smoke_records(const Smoke* smoke);
+bool run_smoke(const BenchOptions* options);
+
+#endif
@@ -0,0 +1,189 @@
+#include <string.h>
+#include <stdbool.h>
+#include "stats.h"
+
+// shard the calling thread counts in, -1 until it first counts
+__thread int statsShard = -1;
+
+// number of threads which have been given a shard
+int countStatsThreads = 0;
+
+// number of commands the calling thread has asked to time
+__thread unsigned long statsSamples = 0;
+
+/** Finds the bucket a duration is counted in.
+ *
+ * @param value Duration in ns
+ * @return Index of the bucket
+ */
+int histogram_bucket(long value) {
+    if (value < (1L << HISTOGRAM_SUB_BITS)) {
+        return value < 0 ? 0 : (int) value;
+    }
+    int exponent = 63 - __builtin_clzl((unsigned long) value);
+    if (exponent > HISTOGRAM_MAX_EXPONENT) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    int shift = exponent - HISTOGRAM_SUB_BITS;
+    int sub = (int) (value >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+/** Finds the largest duration counted in a bucket.
+ *
+ * @param bucket Index of the bucket
+ * @return Duration in ns
+ */
+long histogram_bucket_top(int bucket) {
+    if (bucket < (1 << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+    int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    long sub = bucket & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return (((1L << HISTOGRAM_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+/** Counts a duration in a histogram. Called from any thread.
+ *
+ * @param histogram Histogram to count in
+ * @param value Duration in ns
+ */
+void histogram_record(Histogram* histogram, long value) {
+    __atomic_fetch_add(&histogram->buckets[histogram_bucket(value)], 1,
+            __ATOMIC_RELAXED);
+}
+
+/** Tells whether the command a thread is about to handle is timed. Each
+ * thread times its first command and one in STATS_SAMPLE_EVERY after, so
+ * that percentiles are drawn from a sample while counts stay exact.
+ *
+ * @return true if the command's latency is to be recorded
+ */
+bool sample_command(void) {
+    return statsSamples++ % STATS_SAMPLE_EVERY == 0;
+}
+
+/** Counts a command handled. Called from any worker thread.
+ *
+ * @param stats Counters of the server
+ * @param kind Kind of command
+ * @param latencyNs Time taken to handle the command, or -1 if it was not
+ *        timed
+ * @param lockWaitNs Time spent waiting for the lock, 0 if it was free
+ */
+void record_command(ServerStats* stats, CommandKind kind, long latencyNs,
+        long lockWaitNs) {
+    if (statsShard == -1) {
+        statsShard = __atomic_fetch_add(&countStatsThreads, 1,
+                __ATOMIC_RELAXED) % STATS_SHARDS;
+    }
+    CommandStats* command = &stats->shards[statsShard][kind];
+    __atomic_fetch_add(&command->count, 1, __ATOMIC_RELAXED);
+    if (lockWaitNs > 0) {
+        __atomic_fetch_add(&command->lockWaits, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&command->lockWaitNs, lockWaitNs,
+                __ATOMIC_RELAXED);
+    }
+    if (latencyNs >= 0) {
+        histogram_record(&command->latency, latencyNs);
+    }
+}
+
+/** Sums the counters of every shard for one kind of command.
+ *
+ * @param stats Counters of the server
+ * @param kind Kind of command
+ * @param total Where to store the sums
+ */
+void gather_command(ServerStats* stats, CommandKind kind,
+        CommandStats* total) {
+    memset(total, 0, sizeof(CommandStats));
+    for (int i = 0; i < STATS_SHARDS; ++i) {
+        CommandStats* command = &stats->shards[i][kind];
+        total->count += __atomic_load_n(&command->count, __ATOMIC_RELAXED);
+        total->lockWaits += __atomic_load_n(&command->lockWaits,
+                __ATOMIC_RELAXED);
+        total->lockWaitNs += __atomic_load_n(&command->lockWaitNs,
+                __ATOMIC_RELAXED);
+        for (int j = 0; j < HISTOGRAM_BUCKETS; ++j) {
+            total->latency.buckets[j] += __atomic_load_n(
+                    &command->latency.buckets[j], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/** Counts the values recorded in a histogram.
+ *
+ * @param histogram Histogram to count
+ * @return Number of values recorded
+ */
+long histogram_count(const Histogram* histogram) {
+    long total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        total += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/** Finds the duration below which a given share of values fall.
+ *
+ * @param histogram Histogram to search
+ * @param quantile Share of values, such as 0.99
+ * @return Largest duration in the bucket reaching that share, or 0 if
+ *         nothing has been recorded
+ */
+long histogram_percentile(const Histogram* histogram, double quantile) {
+    long counts[HISTOGRAM_BUCKETS];
+    long total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        counts[i] = __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    long target = (long) (quantile * total + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+    long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= target) {
+            return histogram_bucket_top(i);
+        }
+    }
+    return histogram_bucket_top(HISTOGRAM_BUCKETS - 1);
+}
+
+/** Names a kind of command as the stats command reports it.
+ *
+ * @param kind Kind of command
+ * @return Name of the command
+ */
+const char* command_name(CommandKind kind) {
+    switch (kind) {
+        case COMMAND_QUERY:
+            return "?";
+        case COMMAND_REGISTER:
+            return "!";
+        case COMMAND_PREFIX:
+            return "^";
+        case COMMAND_DUMP:
+            return "@";
+        case COMMAND_VISIT:
+            return "visit";
+        case COMMAND_LOG:
+            return "log";
+        case COMMAND_COUNTS:
+            return ":counts";
+        case COMMAND_LOG_SINCE:
+            return ":log-since";
+        case COMMAND_WATCH:
+            return "watch";
+        case COMMAND_DUMP_SINCE:
+            return "@since";
+        default:
+            return "other";
+    }
+}
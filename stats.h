@@ -0,0 +1,81 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+
+// sub-buckets per power of two, as a power of two; values are recorded
+// to within 1 part in 16
+#define HISTOGRAM_SUB_BITS 4
+
+// largest power of two recorded separately, about 18 minutes in ns
+#define HISTOGRAM_MAX_EXPONENT 40
+
+// number of buckets in a histogram
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BITS + 2) \
+        << HISTOGRAM_SUB_BITS)
+
+/** Log-linear histogram of durations in ns: values below 16 have a bucket
+ * each and every power of two above is split into 16 buckets, as in HDR
+ * histograms. Buckets are updated atomically.
+ */
+typedef struct Histogram {
+    // number of values recorded in each bucket
+    long buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+/** Kinds of command counted separately. **/
+typedef enum CommandKind {
+    COMMAND_QUERY = 0,
+    COMMAND_REGISTER = 1,
+    COMMAND_PREFIX = 2,
+    COMMAND_DUMP = 3,
+    COMMAND_VISIT = 4,
+    COMMAND_LOG = 5,
+    COMMAND_COUNTS = 6,
+    COMMAND_LOG_SINCE = 7,
+    COMMAND_WATCH = 8,
+    COMMAND_DUMP_SINCE = 9,
+    COMMAND_KINDS = 10
+} CommandKind;
+
+/** Counters for one kind of command, updated atomically. **/
+typedef struct CommandStats {
+    // number of commands handled
+    long count;
+
+    // number of commands which found the lock taken, and the total time
+    // they waited for it
+    long lockWaits;
+    long lockWaitNs;
+
+    // time taken to handle the commands timed, lock wait included
+    Histogram latency;
+} CommandStats;
+
+// number of sets of counters threads are spread over
+#define STATS_SHARDS 16
+
+// one command in this many is timed, as reading the clock twice costs
+// more than a query takes to handle
+#define STATS_SAMPLE_EVERY 32
+
+/** Counters for every kind of command a server handles. Each thread counts
+ * in its own shard, so that threads do not fight over the counters' cache
+ * lines; the shards are summed when the counters are read. Allocate zeroed,
+ * so that the pages of unused shards are never touched.
+ */
+typedef struct ServerStats {
+    CommandStats shards[STATS_SHARDS][COMMAND_KINDS];
+} ServerStats;
+
+void histogram_record(Histogram* histogram, long value);
+bool sample_command(void);
+void record_command(ServerStats* stats, CommandKind kind, long latencyNs,
+        long lockWaitNs);
+void gather_command(ServerStats* stats, CommandKind kind,
+        CommandStats* total);
+long histogram_count(const Histogram* histogram);
+long histogram_percentile(const Histogram* histogram, double quantile);
+const char* command_name(CommandKind kind);
+
+#endif